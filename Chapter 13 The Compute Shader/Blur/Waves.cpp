@@ -3,13 +3,71 @@
 //***************************************************************************************
 
 #include "Waves.h"
-#include <ppl.h>
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cmath>
+#include <immintrin.h>
 
 using namespace DirectX;
 
+namespace
+{
+
+// The inner loops are written once against these; AVX builds (/arch:AVX) process
+// eight grid points at a time, everything else four with SSE.
+#if defined(__AVX__)
+typedef __m256 SimdFloat;
+const int SimdWidth = 8;
+inline SimdFloat SimdLoad(const float* p) { return _mm256_loadu_ps(p); }
+inline void SimdStore(float* p, SimdFloat v) { _mm256_storeu_ps(p, v); }
+inline SimdFloat SimdSet1(float x) { return _mm256_set1_ps(x); }
+inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a, b); }
+inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+inline SimdFloat SimdDiv(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a, b); }
+inline SimdFloat SimdSqrt(SimdFloat a) { return _mm256_sqrt_ps(a); }
+#else
+typedef __m128 SimdFloat;
+const int SimdWidth = 4;
+inline SimdFloat SimdLoad(const float* p) { return _mm_loadu_ps(p); }
+inline void SimdStore(float* p, SimdFloat v) { _mm_storeu_ps(p, v); }
+inline SimdFloat SimdSet1(float x) { return _mm_set1_ps(x); }
+inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm_add_ps(a, b); }
+inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a, b); }
+inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a, b); }
+inline SimdFloat SimdDiv(SimdFloat a, SimdFloat b) { return _mm_div_ps(a, b); }
+inline SimdFloat SimdSqrt(SimdFloat a) { return _mm_sqrt_ps(a); }
+#endif
+
+// r grown by border grid points on every side, clipped to the interior of an m by n grid.
+Waves::Region Inflate(const Waves::Region& r, int border, int m, int n)
+{
+	Waves::Region result;
+	result.FirstRow = std::max(1, r.FirstRow - border);
+	result.EndRow = std::min(m - 1, r.EndRow + border);
+	result.FirstCol = std::max(1, r.FirstCol - border);
+	result.EndCol = std::min(n - 1, r.EndCol + border);
+	return result;
+}
+
+}
+
+void Waves::Region::Add(const Region& r)
+{
+	if(r.Empty())
+		return;
+	if(Empty())
+	{
+		*this = r;
+		return;
+	}
+	FirstRow = std::min(FirstRow, r.FirstRow);
+	EndRow = std::max(EndRow, r.EndRow);
+	FirstCol = std::min(FirstCol, r.FirstCol);
+	EndCol = std::max(EndCol, r.EndCol);
+}
+
 Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
 {
     mNumRows = m;
@@ -27,28 +85,18 @@ Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
     mK2 = (4.0f - 8.0f*e) / d;
     mK3 = (2.0f*e) / d;
 
-    mPrevSolution.resize(m*n);
-    mCurrSolution.resize(m*n);
-    mNormals.resize(m*n);
-    mTangentX.resize(m*n);
-
-    // Generate grid vertices in system memory.
+    // Generate grid vertices in system memory.  Only the heights change; x and z
+    // follow from the grid index.
+    mMinX = -(n - 1)*dx*0.5f;
+    mMaxZ = (m - 1)*dx*0.5f;
 
-    float halfWidth = (n - 1)*dx*0.5f;
-    float halfDepth = (m - 1)*dx*0.5f;
-    for(int i = 0; i < m; ++i)
-    {
-        float z = halfDepth - i*dx;
-        for(int j = 0; j < n; ++j)
-        {
-            float x = -halfWidth + j*dx;
-
-            mPrevSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mCurrSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mNormals[i*n + j] = XMFLOAT3(0.0f, 1.0f, 0.0f);
-            mTangentX[i*n + j] = XMFLOAT3(1.0f, 0.0f, 0.0f);
-        }
-    }
+    mPrevHeights.assign(m*n, 0.0f);
+    mCurrHeights.assign(m*n, 0.0f);
+    mNormalX.assign(m*n, 0.0f);
+    mNormalY.assign(m*n, 1.0f);
+    mNormalZ.assign(m*n, 0.0f);
+    mTangentX.assign(m*n, 1.0f);
+    mTangentY.assign(m*n, 0.0f);
 }
 
 Waves::~Waves()
@@ -85,72 +133,391 @@ float Waves::Depth()const
 	return mNumRows*mSpatialStep;
 }
 
-void Waves::Update(float dt)
+int Waves::Update(float dt)
 {
-	static float t = 0;
-
 	// Accumulate time.
-	t += dt;
+	mAccumulator += dt;
 
 	// Only update the simulation at the specified time step.
-	if( t >= mTimeStep )
+	int steps = (int)(mAccumulator / mTimeStep);
+	mAccumulator -= steps*mTimeStep;
+	steps = std::min(steps, mMaxSubsteps);
+
+	mDirtyRegion = mDisturbedRegion;
+	mDisturbedRegion = Region();
+	if(steps == 0 || mActiveRegion.Empty())
+		return steps;
+
+	mStepRegion = Inflate(mActiveRegion, steps, mNumRows, mNumCols);
+	if(mTemporalBlocking && steps > 1)
+		StepTemporalBlocked(steps);
+	else
 	{
-		// Only update interior points; we use zero boundary conditions.
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows-1; ++i)
+		// Normals are only needed for the solution the caller will see.
+		for(int k = 0; k < steps; ++k)
+			Step(k == steps - 1);
+	}
+	ComputeEdgeNormals();
+	FindActiveRegion();
+
+	// The normals of the points around the stepped ones changed too.
+	mDirtyRegion.Add(Inflate(mStepRegion, 1, mNumRows, mNumCols));
+	return steps;
+}
+
+void Waves::SetThreadPool(ThreadPool* pool)
+{
+	mThreadPool = pool;
+}
+
+void Waves::SetGrainSize(int grainRows)
+{
+	assert(grainRows > 0);
+	mBlockRows = grainRows;
+}
+
+void Waves::SetMaxSubsteps(int maxSubsteps)
+{
+	assert(maxSubsteps > 0);
+	mMaxSubsteps = maxSubsteps;
+}
+
+void Waves::SetTemporalBlocking(bool enable)
+{
+	mTemporalBlocking = enable;
+}
+
+void Waves::SetRestThreshold(float threshold)
+{
+	assert(threshold >= 0.0f);
+	mRestThreshold = threshold;
+}
+
+void Waves::Step(bool computeNormals)
+{
+	// Only update interior points; we use zero boundary conditions.  Points outside
+	// the step region stay zero, so it is treated the same way.
+	int blockCount = (mStepRegion.EndRow - mStepRegion.FirstRow + mBlockRows - 1) / mBlockRows;
+	mThreadPool->ParallelFor(0, blockCount, 1, [this, computeNormals](int firstBlock, int lastBlock)
+	{
+		for(int block = firstBlock; block < lastBlock; ++block)
+		{
+			int begin = mStepRegion.FirstRow + block*mBlockRows;
+			StepBlock(begin, std::min(begin + mBlockRows, mStepRegion.EndRow), computeNormals);
+		}
+	});
+
+	// We just overwrote the previous buffer with the new data, so
+	// this data needs to become the current solution and the old
+	// current solution becomes the new previous solution.
+	std::swap(mPrevHeights, mCurrHeights);
+
+	if(!computeNormals)
+		return;
+
+	// Finish the normals the blocks could not compute on their own.
+	mThreadPool->ParallelFor(0, blockCount, 8, [this](int firstBlock, int lastBlock)
+	{
+		for(int block = firstBlock; block < lastBlock; ++block)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
-			{
-				// After this update we will be discarding the old previous
-				// buffer, so overwrite that buffer with the new update.
-				// Note how we can do this inplace (read/write to same element) 
-				// because we won't need prev_ij again and the assignment happens last.
-
-				// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-				// Moreover, our +z axis goes "down"; this is just to 
-				// keep consistent with our row indices going down.
-
-				mPrevSolution[i*mNumCols+j].y = 
-					mK1*mPrevSolution[i*mNumCols+j].y +
-					mK2*mCurrSolution[i*mNumCols+j].y +
-					mK3*(mCurrSolution[(i+1)*mNumCols+j].y + 
-					     mCurrSolution[(i-1)*mNumCols+j].y + 
-					     mCurrSolution[i*mNumCols+j+1].y + 
-						 mCurrSolution[i*mNumCols+j-1].y);
-			}
-		});
-
-		// We just overwrote the previous buffer with the new data, so
-		// this data needs to become the current solution and the old
-		// current solution becomes the new previous solution.
-		std::swap(mPrevSolution, mCurrSolution);
-
-		t = 0.0f; // reset time
-
-		//
-		// Compute normals using finite difference scheme.
-		//
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows - 1; ++i)
+			int begin = mStepRegion.FirstRow + block*mBlockRows;
+			int end = std::min(begin + mBlockRows, mStepRegion.EndRow);
+			const float* heights = mCurrHeights.data();
+			if(!NormalsInBlock(begin, begin, end))
+				ComputeNormals(heights + (begin-1)*mNumCols, heights + begin*mNumCols, heights + (begin+1)*mNumCols, begin);
+			if(end - 1 != begin && !NormalsInBlock(end - 1, begin, end))
+				ComputeNormals(heights + (end-2)*mNumCols, heights + (end-1)*mNumCols, heights + end*mNumCols, end - 1);
+		}
+	});
+}
+
+void Waves::StepBlock(int begin, int end, bool computeNormals)
+{
+	const float* curr = mCurrHeights.data();
+	float* next = mPrevHeights.data();
+	for(int i = begin; i < end; ++i)
+	{
+		StepRow(next + i*mNumCols, curr + (i-1)*mNumCols, curr + i*mNumCols, curr + (i+1)*mNumCols);
+
+		// The normals of row i-1 need the new heights of row i.
+		if(computeNormals && i - 1 >= begin && NormalsInBlock(i - 1, begin, end))
+			ComputeNormals(next + (i-2)*mNumCols, next + (i-1)*mNumCols, next + i*mNumCols, i - 1);
+	}
+	if(computeNormals && NormalsInBlock(end - 1, begin, end))
+		ComputeNormals(next + (end-2)*mNumCols, next + (end-1)*mNumCols, next + end*mNumCols, end - 1);
+}
+
+bool Waves::NormalsInBlock(int i, int begin, int end)const
+{
+	// Rows outside the step region do not change.
+	return (i - 1 >= begin || i - 1 < mStepRegion.FirstRow) && (i + 1 < end || i + 1 >= mStepRegion.EndRow);
+}
+
+void Waves::StepTemporalBlocked(int steps)
+{
+	// Every block writes its rows of the new solution pair to separate buffers, as its
+	// neighbours still read the old rows around it.
+	mNextPrevHeights.resize(mPrevHeights.size());
+	mNextCurrHeights.resize(mCurrHeights.size());
+
+	// Blocks recompute their halo rows, so they are made big enough for that to be a
+	// small part of the work.
+	int blockRows = std::max(mBlockRows, 8*(steps + 1));
+	int blockCount = (mStepRegion.EndRow - mStepRegion.FirstRow + blockRows - 1) / blockRows;
+	mThreadPool->ParallelFor(0, blockCount, 1, [this, steps, blockRows](int firstBlock, int lastBlock)
+	{
+		for(int block = firstBlock; block < lastBlock; ++block)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
-			{
-				float l = mCurrSolution[i*mNumCols+j-1].y;
-				float r = mCurrSolution[i*mNumCols+j+1].y;
-				float t = mCurrSolution[(i-1)*mNumCols+j].y;
-				float b = mCurrSolution[(i+1)*mNumCols+j].y;
-				mNormals[i*mNumCols+j].x = -r+l;
-				mNormals[i*mNumCols+j].y = 2.0f*mSpatialStep;
-				mNormals[i*mNumCols+j].z = b-t;
-
-				XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i*mNumCols+j]));
-				XMStoreFloat3(&mNormals[i*mNumCols+j], n);
-
-				mTangentX[i*mNumCols+j] = XMFLOAT3(2.0f*mSpatialStep, r-l, 0.0f);
-				XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i*mNumCols+j]));
-				XMStoreFloat3(&mTangentX[i*mNumCols+j], T);
-			}
-		});
+			int begin = mStepRegion.FirstRow + block*blockRows;
+			StepWindow(begin, std::min(begin + blockRows, mStepRegion.EndRow), steps);
+		}
+	});
+
+	// Only the stepped rows were written.
+	size_t first = (size_t)mStepRegion.FirstRow*mNumCols;
+	size_t last = (size_t)mStepRegion.EndRow*mNumCols;
+	std::copy(mNextPrevHeights.begin() + first, mNextPrevHeights.begin() + last, mPrevHeights.begin() + first);
+	std::copy(mNextCurrHeights.begin() + first, mNextCurrHeights.begin() + last, mCurrHeights.begin() + first);
+}
+
+void Waves::ComputeEdgeNormals()
+{
+	// The rows either side of the step region have new neighbours.
+	const float* heights = mCurrHeights.data();
+	for(int i : { mStepRegion.FirstRow - 1, mStepRegion.EndRow })
+	{
+		if(i >= 1 && i < mNumRows - 1)
+			ComputeNormals(heights + (i-1)*mNumCols, heights + i*mNumCols, heights + (i+1)*mNumCols, i);
+	}
+}
+
+void Waves::FindActiveRegion()
+{
+	const float* prev = mPrevHeights.data();
+	const float* curr = mCurrHeights.data();
+	auto moving = [&](int k) { return std::fabs(prev[k]) > mRestThreshold || std::fabs(curr[k]) > mRestThreshold; };
+
+	// Nothing outside the step region can be in motion.
+	Region active;
+	for(int i = mStepRegion.FirstRow; i < mStepRegion.EndRow; ++i)
+	{
+		int row = i*mNumCols;
+		int first = mStepRegion.FirstCol;
+		while(first < mStepRegion.EndCol && !moving(row + first))
+			++first;
+		if(first == mStepRegion.EndCol)
+			continue;
+		int last = mStepRegion.EndCol - 1;
+		while(!moving(row + last))
+			--last;
+
+		Region rowRegion;
+		rowRegion.FirstRow = i;
+		rowRegion.EndRow = i + 1;
+		rowRegion.FirstCol = first;
+		rowRegion.EndCol = last + 1;
+		active.Add(rowRegion);
+	}
+	mActiveRegion = active;
+
+	// Flatten the rest of the step region.  The normals there are already within the
+	// rest threshold of flat and are left alone.
+	auto flatten = [this](int i, int firstCol, int endCol)
+	{
+		auto first = i*mNumCols + firstCol;
+		std::fill(mPrevHeights.begin() + first, mPrevHeights.begin() + first + (endCol - firstCol), 0.0f);
+		std::fill(mCurrHeights.begin() + first, mCurrHeights.begin() + first + (endCol - firstCol), 0.0f);
+	};
+	for(int i = mStepRegion.FirstRow; i < mStepRegion.EndRow; ++i)
+	{
+		if(i < active.FirstRow || i >= active.EndRow)
+			flatten(i, mStepRegion.FirstCol, mStepRegion.EndCol);
+		else
+		{
+			flatten(i, mStepRegion.FirstCol, active.FirstCol);
+			flatten(i, active.EndCol, mStepRegion.EndCol);
+		}
+	}
+}
+
+void Waves::StepWindow(int begin, int end, int steps)
+{
+	// Each step only has valid results one row further in from the edges of the
+	// window than the last, so the window takes in a halo of steps rows on either
+	// side, plus one more for the normals of the block's edge rows.
+	int edgeBegin = mStepRegion.FirstRow - 1;
+	int edgeEnd = mStepRegion.EndRow + 1;
+	int windowBegin = std::max(edgeBegin, begin - steps - 1);
+	int windowEnd = std::min(edgeEnd, end + steps + 1);
+	size_t windowSize = (size_t)(windowEnd - windowBegin)*mNumCols;
+
+	static thread_local std::vector<float> window;
+	window.resize(2*windowSize);
+	float* buffers[2] = { window.data(), window.data() + windowSize };
+	auto row = [&](int buffer, int i) { return buffers[buffer] + (i - windowBegin)*mNumCols; };
+
+	// Rows step k can compute: the window shrinks by a row per step, except at the
+	// rows bordering the step region, which do not change.
+	auto firstRow = [&](int k) { return windowBegin == edgeBegin ? edgeBegin + 1 : windowBegin + k; };
+	auto lastRow = [&](int k) { return windowEnd == edgeEnd ? edgeEnd - 1 : windowEnd - k; };
+
+	// Step k writes buffer (k+1)%2 (holding step k-2) from buffer k%2 (step k-1).  It
+	// trails step k-1 by a row: row i needs step k-1 at row i+1, and once step k-1
+	// has done row i+1 it no longer needs step k-2 at row i.  So all steps advance
+	// together down the window, and rows are copied in just ahead of the first step
+	// and out just behind the last, touching only a few rows at a time.
+	int copyRow = windowBegin;
+	int outRow = begin;
+	for(int i = firstRow(1); i < lastRow(1) + steps - 1; ++i)
+	{
+		for(; copyRow <= std::min(i + 1, windowEnd - 1); ++copyRow)
+		{
+			size_t offset = (size_t)copyRow*mNumCols;
+			std::copy(&mPrevHeights[offset], &mPrevHeights[offset] + mNumCols, row(0, copyRow));
+			std::copy(&mCurrHeights[offset], &mCurrHeights[offset] + mNumCols, row(1, copyRow));
+		}
+
+		for(int k = 1; k <= steps; ++k)
+		{
+			int r = i - (k - 1);
+			if(r < firstRow(k) || r >= lastRow(k))
+				continue;
+			int src = k % 2;
+			StepRow(row(1 - src, r), row(src, r - 1), row(src, r), row(src, r + 1));
+		}
+
+		// A row is finished once the last step has done it and the row below it.
+		int newest = (steps + 1) % 2;
+		int lastDone = std::min(i - (steps - 1), lastRow(steps) - 1);
+		for(; outRow < end && outRow <= lastDone && (outRow + 1 <= lastDone || outRow + 1 == edgeEnd - 1); ++outRow)
+		{
+			size_t offset = (size_t)outRow*mNumCols;
+			std::copy(row(1 - newest, outRow), row(1 - newest, outRow) + mNumCols, &mNextPrevHeights[offset]);
+			std::copy(row(newest, outRow), row(newest, outRow) + mNumCols, &mNextCurrHeights[offset]);
+			ComputeNormals(row(newest, outRow - 1), row(newest, outRow), row(newest, outRow + 1), outRow);
+		}
+	}
+	assert(outRow == end);
+}
+
+void Waves::StepRow(float* prev, const float* up, const float* curr, const float* down)const
+{
+	// After this update we will be discarding the old previous
+	// buffer, so overwrite that buffer with the new update.
+	// Note how we can do this inplace (read/write to same element)
+	// because we won't need prev_ij again and the assignment happens last.
+
+	// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+	// Moreover, our +z axis goes "down"; this is just to
+	// keep consistent with our row indices going down.
+	SimdFloat k1 = SimdSet1(mK1);
+	SimdFloat k2 = SimdSet1(mK2);
+	SimdFloat k3 = SimdSet1(mK3);
+	int j = mStepRegion.FirstCol;
+	for(; j + SimdWidth <= mStepRegion.EndCol; j += SimdWidth)
+	{
+		SimdFloat neighbors = SimdAdd(SimdAdd(SimdAdd(SimdLoad(down + j), SimdLoad(up + j)),
+			SimdLoad(curr + j + 1)), SimdLoad(curr + j - 1));
+		SimdStore(prev + j, SimdAdd(SimdAdd(SimdMul(k1, SimdLoad(prev + j)), SimdMul(k2, SimdLoad(curr + j))),
+			SimdMul(k3, neighbors)));
+	}
+	for(; j < mStepRegion.EndCol; ++j)
+	{
+		prev[j] = mK1*prev[j] + mK2*curr[j] + mK3*(down[j] + up[j] + curr[j+1] + curr[j-1]);
+	}
+}
+
+void Waves::ComputeNormals(const float* top, const float* row, const float* bottom, int i)
+{
+	//
+	// Compute normals using finite difference scheme.
+	//
+	float* nx = &mNormalX[i*mNumCols];
+	float* ny = &mNormalY[i*mNumCols];
+	float* nz = &mNormalZ[i*mNumCols];
+	float* tx = &mTangentX[i*mNumCols];
+	float* ty = &mTangentY[i*mNumCols];
+
+	// n = normalize(l-r, 2dx, b-t) and tangent = normalize(2dx, r-l, 0).
+	float twoDx = 2.0f*mSpatialStep;
+	SimdFloat one = SimdSet1(1.0f);
+	SimdFloat twoDxV = SimdSet1(twoDx);
+	SimdFloat twoDxSq = SimdSet1(twoDx*twoDx);
+	// The normals change one column beyond the stepped heights.
+	int j = std::max(1, mStepRegion.FirstCol - 1);
+	int end = std::min(mNumCols - 1, mStepRegion.EndCol + 1);
+	for(; j + SimdWidth <= end; j += SimdWidth)
+	{
+		SimdFloat l = SimdLoad(row + j - 1);
+		SimdFloat r = SimdLoad(row + j + 1);
+		SimdFloat x = SimdSub(l, r);
+		SimdFloat z = SimdSub(SimdLoad(bottom + j), SimdLoad(top + j));
+		SimdFloat xSq = SimdMul(x, x);
+
+		SimdFloat invLength = SimdDiv(one, SimdSqrt(SimdAdd(SimdAdd(xSq, twoDxSq), SimdMul(z, z))));
+		SimdStore(nx + j, SimdMul(x, invLength));
+		SimdStore(ny + j, SimdMul(twoDxV, invLength));
+		SimdStore(nz + j, SimdMul(z, invLength));
+
+		invLength = SimdDiv(one, SimdSqrt(SimdAdd(twoDxSq, xSq)));
+		SimdStore(tx + j, SimdMul(twoDxV, invLength));
+		SimdStore(ty + j, SimdMul(SimdSub(r, l), invLength));
+	}
+	for(; j < end; ++j)
+	{
+		float l = row[j-1];
+		float r = row[j+1];
+		float x = l - r;
+		float z = bottom[j] - top[j];
+
+		float invLength = 1.0f / sqrtf(x*x + twoDx*twoDx + z*z);
+		nx[j] = x*invLength;
+		ny[j] = twoDx*invLength;
+		nz[j] = z*invLength;
+
+		invLength = 1.0f / sqrtf(twoDx*twoDx + x*x);
+		tx[j] = twoDx*invLength;
+		ty[j] = (r - l)*invLength;
+	}
+}
+
+void Waves::ComputeNormal(int i, int j)
+{
+	const float* heights = mCurrHeights.data();
+	int k = i*mNumCols + j;
+	float twoDx = 2.0f*mSpatialStep;
+	float x = heights[k-1] - heights[k+1];
+	float z = heights[k+mNumCols] - heights[k-mNumCols];
+
+	float invLength = 1.0f / sqrtf(x*x + twoDx*twoDx + z*z);
+	mNormalX[k] = x*invLength;
+	mNormalY[k] = twoDx*invLength;
+	mNormalZ[k] = z*invLength;
+
+	invLength = 1.0f / sqrtf(twoDx*twoDx + x*x);
+	mTangentX[k] = twoDx*invLength;
+	mTangentY[k] = -x*invLength;
+}
+
+void Waves::ComputeRingNormals(const Region& r)
+{
+	int firstRow = std::max(r.FirstRow, 1);
+	int endRow = std::min(r.EndRow, mNumRows - 1);
+	int firstCol = std::max(r.FirstCol, 1);
+	int endCol = std::min(r.EndCol, mNumCols - 1);
+	for(int i = firstRow; i < endRow; ++i)
+	{
+		if(i == r.FirstRow || i == r.EndRow - 1)
+		{
+			for(int j = firstCol; j < endCol; ++j)
+				ComputeNormal(i, j);
+			continue;
+		}
+		for(int j : { r.FirstCol, r.EndCol - 1 })
+		{
+			if(j >= firstCol && j < endCol)
+				ComputeNormal(i, j);
+		}
 	}
 }
 
@@ -163,10 +530,87 @@ void Waves::Disturb(int i, int j, float magnitude)
 	float halfMag = 0.5f*magnitude;
 
 	// Disturb the ijth vertex height and its neighbors.
-	mCurrSolution[i*mNumCols+j].y     += magnitude;
-	mCurrSolution[i*mNumCols+j+1].y   += halfMag;
-	mCurrSolution[i*mNumCols+j-1].y   += halfMag;
-	mCurrSolution[(i+1)*mNumCols+j].y += halfMag;
-	mCurrSolution[(i-1)*mNumCols+j].y += halfMag;
+	mCurrHeights[i*mNumCols+j]     += magnitude;
+	mCurrHeights[i*mNumCols+j+1]   += halfMag;
+	mCurrHeights[i*mNumCols+j-1]   += halfMag;
+	mCurrHeights[(i+1)*mNumCols+j] += halfMag;
+	mCurrHeights[(i-1)*mNumCols+j] += halfMag;
+
+	Region disturbed;
+	disturbed.FirstRow = i - 1;
+	disturbed.EndRow = i + 2;
+	disturbed.FirstCol = j - 1;
+	disturbed.EndCol = j + 2;
+	mActiveRegion.Add(disturbed);
+	mDisturbedRegion.Add(disturbed);
+}
+
+void Waves::SetHeight(int i, int j, float height, float previousHeight)
+{
+	assert(i >= 0 && i < mNumRows);
+	assert(j >= 0 && j < mNumCols);
+
+	// Step swaps the two solutions but only writes the interior, so a boundary point
+	// needs the same height in both to hold it.
+	bool boundary = i == 0 || i == mNumRows - 1 || j == 0 || j == mNumCols - 1;
+	mCurrHeights[i*mNumCols+j] = height;
+	mPrevHeights[i*mNumCols+j] = boundary ? height : previousHeight;
+
+	Region point;
+	point.FirstRow = i;
+	point.EndRow = i + 1;
+	point.FirstCol = j;
+	point.EndCol = j + 1;
+	mActiveRegion.Add(point);
+	mDisturbedRegion.Add(point);
+}
+
+void Waves::Scroll(int rowOffset, int colOffset)
+{
+	auto scroll = [&](std::vector<float>& values, float flat)
+	{
+		std::vector<float> scrolled(values.size(), flat);
+		int firstRow = std::max(0, -rowOffset);
+		int endRow = std::min(mNumRows, mNumRows - rowOffset);
+		int firstCol = std::max(0, -colOffset);
+		int endCol = std::min(mNumCols, mNumCols - colOffset);
+		for(int i = firstRow; i < endRow && firstCol < endCol; ++i)
+		{
+			auto source = values.begin() + (i + rowOffset)*mNumCols + firstCol + colOffset;
+			std::copy(source, source + (endCol - firstCol), scrolled.begin() + i*mNumCols + firstCol);
+		}
+		values.swap(scrolled);
+	};
+	scroll(mPrevHeights, 0.0f);
+	scroll(mCurrHeights, 0.0f);
+	scroll(mNormalX, 0.0f);
+	scroll(mNormalY, 1.0f);
+	scroll(mNormalZ, 0.0f);
+	scroll(mTangentX, 1.0f);
+	scroll(mTangentY, 0.0f);
+
+	// Zero boundary conditions.
+	for(auto heights : { &mPrevHeights, &mCurrHeights })
+	{
+		std::fill(heights->begin(), heights->begin() + mNumCols, 0.0f);
+		std::fill(heights->end() - mNumCols, heights->end(), 0.0f);
+		for(int i = 1; i < mNumRows - 1; ++i)
+		{
+			(*heights)[i*mNumCols] = 0.0f;
+			(*heights)[i*mNumCols + mNumCols - 1] = 0.0f;
+		}
+	}
+
+	// Points scrolled in from the old boundary may be moving, so the next Update
+	// steps the whole grid and works out what is still active.
+	mActiveRegion.FirstRow = 1;
+	mActiveRegion.EndRow = mNumRows - 1;
+	mActiveRegion.FirstCol = 1;
+	mActiveRegion.EndCol = mNumCols - 1;
+
+	// Every point now shows a different part of the water.
+	mDisturbedRegion.FirstRow = 0;
+	mDisturbedRegion.EndRow = mNumRows;
+	mDisturbedRegion.FirstCol = 0;
+	mDisturbedRegion.EndCol = mNumCols;
 }
-	
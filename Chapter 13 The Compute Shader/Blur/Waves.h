@@ -4,6 +4,11 @@
 // Performs the calculations for the wave simulation.  After the simulation has been
 // updated, the client must copy the current solution into vertex buffers for rendering.
 // This class only does the calculations, it does not do any drawing.
+//
+// The solution is kept as a structure of arrays (one height per grid point, normal and
+// tangent components in separate arrays) so the stencil reads contiguous floats and
+// the update can be vectorized.  Each step advances the heights and recomputes the
+// normals and tangents in a single sweep over blocks of rows.
 //***************************************************************************************
 
 #ifndef WAVES_H
@@ -11,6 +16,7 @@
 
 #include <vector>
 #include <DirectXMath.h>
+#include "../../Common/ThreadPool.h"
 
 class Waves
 {
@@ -20,6 +26,20 @@ public:
     Waves& operator=(const Waves& rhs) = delete;
     ~Waves();
 
+	// Rows [FirstRow, EndRow) and columns [FirstCol, EndCol) of the grid.
+	struct Region
+	{
+		int FirstRow = 0;
+		int EndRow = 0;
+		int FirstCol = 0;
+		int EndCol = 0;
+
+		bool Empty()const { return FirstRow >= EndRow || FirstCol >= EndCol; }
+
+		// Grows the region to the bounding rectangle of itself and r.
+		void Add(const Region& r);
+	};
+
 	int RowCount()const;
 	int ColumnCount()const;
 	int VertexCount()const;
@@ -28,18 +48,100 @@ public:
 	float Depth()const;
 
 	// Returns the solution at the ith grid point.
-    const DirectX::XMFLOAT3& Position(int i)const { return mCurrSolution[i]; }
+    DirectX::XMFLOAT3 Position(int i)const
+    {
+        return DirectX::XMFLOAT3(mMinX + (i % mNumCols)*mSpatialStep, mCurrHeights[i], mMaxZ - (i / mNumCols)*mSpatialStep);
+    }
 
 	// Returns the solution normal at the ith grid point.
-    const DirectX::XMFLOAT3& Normal(int i)const { return mNormals[i]; }
+    DirectX::XMFLOAT3 Normal(int i)const { return DirectX::XMFLOAT3(mNormalX[i], mNormalY[i], mNormalZ[i]); }
 
 	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
-    const DirectX::XMFLOAT3& TangentX(int i)const { return mTangentX[i]; }
+    DirectX::XMFLOAT3 TangentX(int i)const { return DirectX::XMFLOAT3(mTangentX[i], mTangentY[i], 0.0f); }
+
+	// Row-major heights of the current solution, RowCount()*ColumnCount() floats.
+	const float* Heights()const { return mCurrHeights.data(); }
+	const float* PreviousHeights()const { return mPrevHeights.data(); }
+
+	// Grid points whose position or normal changed in the last Update, including
+	// those moved by Disturb since the Update before it.  A copy of the solution that
+	// was current before the last Update only needs this rectangle refreshed.
+	const Region& DirtyRegion()const { return mDirtyRegion; }
+
+	// Grid points still in motion.  Everything outside is flat and is not simulated.
+	const Region& ActiveRegion()const { return mActiveRegion; }
 
-	void Update(float dt);
+	// Accumulates dt and advances the simulation by as many whole time steps as are
+	// due, carrying the remainder over to the next call.  At most MaxSubsteps steps
+	// are taken per call; time beyond that is dropped so a slow frame cannot make the
+	// next one slower.  Returns the number of steps taken.
+	int Update(float dt);
 	void Disturb(int i, int j, float magnitude);
 
+	// Overwrites the current and previous height of grid point (i, j), which may be on
+	// the boundary.  Used to couple the grid to another simulation.  A boundary point
+	// is never stepped, so it keeps height through later steps and previousHeight is
+	// not used.
+	void SetHeight(int i, int j, float height, float previousHeight);
+
+	// Recomputes the normals and tangents of the interior points on the edge of r:
+	// its first and last row and column.  Update computes normals from the heights
+	// it stepped to, so call this for points whose neighbours SetHeight has moved
+	// since, such as r = [1, RowCount()-1) x [1, ColumnCount()-1) after the boundary.
+	void ComputeRingNormals(const Region& r);
+
+	// Moves the grid over the water so that the point at (i + rowOffset, j + colOffset)
+	// ends up at (i, j).  Points scrolled in are flat, as is the new boundary.
+	void Scroll(int rowOffset, int colOffset);
+
+	// The update runs on ThreadPool::Default() unless given another pool, in
+	// blocks of grainRows rows per task (16 by default).
+	void SetThreadPool(ThreadPool* pool);
+	void SetGrainSize(int grainRows);
+
+	// Catch-up limit for Update (8 by default).
+	void SetMaxSubsteps(int maxSubsteps);
+
+	// With temporal blocking several due steps are taken block by block: each block of
+	// rows, plus the halo it depends on, is advanced through all of them while it is in
+	// cache rather than sweeping the whole grid once per step.  The results are the
+	// same either way.  Off by default; it only pays off once the grid no longer fits
+	// in the last level cache and Update regularly has to catch up.
+	void SetTemporalBlocking(bool enable);
+
+	// A grid point is at rest when its height is within threshold of zero in both the
+	// current and the previous solution.  After each Update the active region shrinks
+	// to the bounding rectangle of the points not at rest, and the points it loses are
+	// set to zero.  1e-4 by default; 0 only lets exactly flat water come to rest.
+	void SetRestThreshold(float threshold);
+
 private:
+	void Step(bool computeNormals);
+	void StepTemporalBlocked(int steps);
+	void ComputeEdgeNormals();
+	void FindActiveRegion();
+
+	// Advances rows [begin, end) of the step region, computing normals one row behind
+	// the heights.  Rows at the block edges need new heights from the neighbouring
+	// blocks, so their normals are computed after all blocks are done.
+	void StepBlock(int begin, int end, bool computeNormals);
+	bool NormalsInBlock(int i, int begin, int end)const;
+
+	// Advances rows [begin, end) by steps steps in a private copy of the rows around
+	// them and writes the two newest solutions to mNextPrevHeights/mNextCurrHeights.
+	void StepWindow(int begin, int end, int steps);
+
+	// Overwrites prev with the next solution of the row between up and down, in the
+	// columns of the step region.
+	void StepRow(float* prev, const float* up, const float* curr, const float* down)const;
+
+	// Recomputes the normals and tangents of row i from its heights and those of the
+	// rows above and below it.
+	void ComputeNormals(const float* top, const float* row, const float* bottom, int i);
+
+	// The same for the single interior point (i, j).
+	void ComputeNormal(int i, int j);
+
     int mNumRows = 0;
     int mNumCols = 0;
 
@@ -54,10 +156,41 @@ private:
     float mTimeStep = 0.0f;
     float mSpatialStep = 0.0f;
 
-    std::vector<DirectX::XMFLOAT3> mPrevSolution;
-    std::vector<DirectX::XMFLOAT3> mCurrSolution;
-    std::vector<DirectX::XMFLOAT3> mNormals;
-    std::vector<DirectX::XMFLOAT3> mTangentX;
+    // Grid point (0, 0) is at (mMinX, 0, mMaxZ).
+    float mMinX = 0.0f;
+    float mMaxZ = 0.0f;
+
+    ThreadPool* mThreadPool = &ThreadPool::Default();
+
+    // Rows per block of the update sweep.
+    int mBlockRows = 16;
+
+    // Time not yet simulated.
+    float mAccumulator = 0.0f;
+    int mMaxSubsteps = 8;
+    bool mTemporalBlocking = false;
+
+    // Heights outside the active region are zero in both solutions.  Update steps
+    // the active region grown by the number of steps, as motion spreads by one grid
+    // point per step.
+    Region mActiveRegion;
+    Region mStepRegion;
+    Region mDirtyRegion;
+    Region mDisturbedRegion;
+    float mRestThreshold = 1e-4f;
+
+    std::vector<float> mPrevHeights;
+    std::vector<float> mCurrHeights;
+    std::vector<float> mNormalX;
+    std::vector<float> mNormalY;
+    std::vector<float> mNormalZ;
+    // The x-axis tangent has no z component.
+    std::vector<float> mTangentX;
+    std::vector<float> mTangentY;
+
+    // Output of temporally blocked steps, swapped with the solution afterwards.
+    std::vector<float> mNextPrevHeights;
+    std::vector<float> mNextCurrHeights;
 };
 
-#endif // WAVES_H
\ No newline at end of file
+#endif // WAVES_H
@@ -3,6 +3,7 @@
 #include "../../Common/d3dUtil.h"
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
+#include "GpuWaves.h"
 
 struct ObjectConstants
 {
@@ -57,7 +58,8 @@ struct FrameResource
 {
 public:
     
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount);
+    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount,
+        UINT waveImpulseCount, UINT waveTileCount);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
     ~FrameResource();
@@ -73,6 +75,10 @@ public:
     std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialCB = nullptr;
     std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
 
+    // Impulses for the wave simulation, binned by GpuWaves::Update.
+    std::unique_ptr<UploadBuffer<GpuWaves::Impulse>> WaveImpulses = nullptr;
+    std::unique_ptr<UploadBuffer<GpuWaves::ImpulseTile>> WaveImpulseTiles = nullptr;
+
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
     UINT64 Fence = 0;
@@ -7,6 +7,7 @@
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cmath>
 
 GpuWaves::GpuWaves(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList, 
 	               int m, int n, float dx, float dt, float speed, float damping)
@@ -79,6 +80,16 @@ UINT GpuWaves::DescriptorCount()const
 	return 6;
 }
 
+UINT GpuWaves::TileCount()const
+{
+	return (mNumCols / 16)*(mNumRows / 16);
+}
+
+UINT GpuWaves::ImpulseCapacity()const
+{
+	return 16384;
+}
+
 void GpuWaves::BuildResources(ID3D12GraphicsCommandList* cmdList)
 {
 	// All the textures for the wave simulation will be bound as a shader resource and
@@ -217,7 +228,9 @@ void GpuWaves::Update(
 	const GameTimer& gt,
 	ID3D12GraphicsCommandList* cmdList,
 	ID3D12RootSignature* rootSig,
-	ID3D12PipelineState* pso)
+	ID3D12PipelineState* pso,
+	UploadBuffer<Impulse>* impulseBuffer,
+	UploadBuffer<ImpulseTile>* tileBuffer)
 {
 	static float t = 0.0f;
 
@@ -233,6 +246,12 @@ void GpuWaves::Update(
 		// Set the update constants.
 		cmdList->SetComputeRoot32BitConstants(0, 3, mK, 0);
 
+		// Impulses queued since the last step are added by this one.
+		UINT impulseCount = BinImpulses(impulseBuffer, tileBuffer);
+		cmdList->SetComputeRoot32BitConstants(0, 1, &impulseCount, 3);
+		cmdList->SetComputeRootShaderResourceView(4, impulseBuffer->Resource()->GetGPUVirtualAddress());
+		cmdList->SetComputeRootShaderResourceView(5, tileBuffer->Resource()->GetGPUVirtualAddress());
+
 		cmdList->SetComputeRootDescriptorTable(1, mPrevSolUav);
 		cmdList->SetComputeRootDescriptorTable(2, mCurrSolUav);
 		cmdList->SetComputeRootDescriptorTable(3, mNextSolUav);
@@ -274,34 +293,74 @@ void GpuWaves::Update(
 	}
 }
 
-void GpuWaves::Disturb(
-	ID3D12GraphicsCommandList* cmdList,
-	ID3D12RootSignature* rootSig,
-	ID3D12PipelineState* pso,
-	UINT i, UINT j,
-	float magnitude)
+void GpuWaves::Disturb(const Impulse* impulses, UINT count)
 {
-	cmdList->SetPipelineState(pso);
-	cmdList->SetComputeRootSignature(rootSig);
-
-	// Set the disturb constants.
-	UINT disturbIndex[2] = { j, i };
-	cmdList->SetComputeRoot32BitConstants(0, 1, &magnitude, 3);
-	cmdList->SetComputeRoot32BitConstants(0, 2, disturbIndex, 4);
-
-	cmdList->SetComputeRootDescriptorTable(3, mCurrSolUav);
-
-	// The current solution is in the GENERIC_READ state so it can be read by the vertex shader.
-	// Change it to UNORDERED_ACCESS for the compute shader.  Note that a UAV can still be
-	// read in a compute shader.
-	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mCurrSol.Get(),
-		D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
-
-	// One thread group kicks off one thread, which displaces the height of one
-	// vertex and its neighbors.
-	cmdList->Dispatch(1, 1, 1);
+	mQueuedImpulses.insert(mQueuedImpulses.end(), impulses, impulses + count);
 }
 
+UINT GpuWaves::BinImpulses(UploadBuffer<Impulse>* impulseBuffer, UploadBuffer<ImpulseTile>* tileBuffer)
+{
+	// Tiles [firstRow, endRow) x [firstCol, endCol) holding the texels an impulse
+	// reaches, which are closer to its center than twice its radius.
+	int tileCols = (int)mNumCols / 16;
+	auto tiles = [&](const Impulse& impulse, int& firstRow, int& endRow, int& firstCol, int& endCol)
+	{
+		int reach = (int)std::ceil(std::max(1.0f, 2.0f*impulse.Radius)) - 1;
+		firstRow = std::max(0, (int)impulse.Row - reach) / 16;
+		endRow = (std::min((int)mNumRows - 1, (int)impulse.Row + reach) + 16) / 16;
+		firstCol = std::max(0, (int)impulse.Col - reach) / 16;
+		endCol = (std::min((int)mNumCols - 1, (int)impulse.Col + reach) + 16) / 16;
+	};
+
+	// Count each tile's impulses, keeping whole impulses only while they fit.
+	mTileStart.assign(TileCount() + 1, 0);
+	UINT binned = 0;
+	size_t accepted = 0;
+	for(; accepted < mQueuedImpulses.size(); ++accepted)
+	{
+		int firstRow, endRow, firstCol, endCol;
+		tiles(mQueuedImpulses[accepted], firstRow, endRow, firstCol, endCol);
+		UINT entries = (UINT)(std::max(0, endRow - firstRow)*std::max(0, endCol - firstCol));
+		if(binned + entries > ImpulseCapacity())
+			break;
+		binned += entries;
+		for(int row = firstRow; row < endRow; ++row)
+		{
+			for(int col = firstCol; col < endCol; ++col)
+				++mTileStart[row*tileCols + col + 1];
+		}
+	}
+	if(binned == 0)
+	{
+		mQueuedImpulses.clear();
+		return 0;
+	}
+	for(UINT t = 0; t < TileCount(); ++t)
+		mTileStart[t + 1] += mTileStart[t];
 
+	// Placing the impulses moves each tile's start to the next tile's.
+	mBinnedImpulses.resize(binned);
+	for(size_t k = 0; k < accepted; ++k)
+	{
+		int firstRow, endRow, firstCol, endCol;
+		tiles(mQueuedImpulses[k], firstRow, endRow, firstCol, endCol);
+		for(int row = firstRow; row < endRow; ++row)
+		{
+			for(int col = firstCol; col < endCol; ++col)
+				mBinnedImpulses[mTileStart[row*tileCols + col]++] = mQueuedImpulses[k];
+		}
+	}
+	mQueuedImpulses.clear();
 
- 
\ No newline at end of file
+	// Upload heaps are write combined, so both buffers are written in order.
+	for(UINT k = 0; k < binned; ++k)
+		impulseBuffer->CopyData(k, mBinnedImpulses[k]);
+	for(UINT t = 0; t < TileCount(); ++t)
+	{
+		ImpulseTile tile;
+		tile.First = t == 0 ? 0 : mTileStart[t - 1];
+		tile.Count = mTileStart[t] - tile.First;
+		tileBuffer->CopyData(t, tile);
+	}
+	return binned;
+}
@@ -1,10 +1,8 @@
 //=============================================================================
 // WaveSim.hlsl by Frank Luna (C) 2011 All Rights Reserved.
 //
-// UpdateWavesCS(): Solves 2D wave equation using the compute shader.
-//
-// DisturbWavesCS(): Runs one thread to disturb a grid height and its
-//     neighbors to generate a wave. 
+// UpdateWavesCS(): Solves 2D wave equation using the compute shader, adding in
+//     the impulses queued with the batched GpuWaves::Disturb.
 //=============================================================================
 
 // For updating the simulation.
@@ -13,17 +11,31 @@ cbuffer cbUpdateSettings
 	float gWaveConstant0;
 	float gWaveConstant1;
 	float gWaveConstant2;
-	
-	float gDisturbMag;
-	int2 gDisturbIndex;
+
+	// Number of binned impulses; zero when there are none to read.
+	uint gImpulseCount;
+};
+
+struct Impulse
+{
+	uint Row;
+	uint Col;
+	float Magnitude;
+	float Radius;
 };
  
 RWTexture2D<float> gPrevSolInput : register(u0);
 RWTexture2D<float> gCurrSolInput : register(u1);
 RWTexture2D<float> gOutput       : register(u2);
+
+// Impulses binned by thread group: group (x, y) adds gImpulses[First, First + Count)
+// with (First, Count) = gImpulseTiles[y*groupsX + x].
+StructuredBuffer<Impulse> gImpulses     : register(t0);
+StructuredBuffer<uint2>   gImpulseTiles : register(t1);
  
 [numthreads(16, 16, 1)]
-void UpdateWavesCS(int3 dispatchThreadID : SV_DispatchThreadID)
+void UpdateWavesCS(int3 groupID : SV_GroupID,
+                   int3 dispatchThreadID : SV_DispatchThreadID)
 {
 	// We do not need to do bounds checking because:
 	//	 *out-of-bounds reads return 0, which works for us--it just means the boundary of 
@@ -33,7 +45,7 @@ void UpdateWavesCS(int3 dispatchThreadID : SV_DispatchThreadID)
 	int x = dispatchThreadID.x;
 	int y = dispatchThreadID.y;
 
-	gOutput[int2(x,y)] = 
+	float h = 
 		gWaveConstant0 * gPrevSolInput[int2(x,y)].r +
 		gWaveConstant1 * gCurrSolInput[int2(x,y)].r +
 		gWaveConstant2 *(
@@ -41,26 +53,24 @@ void UpdateWavesCS(int3 dispatchThreadID : SV_DispatchThreadID)
 			gCurrSolInput[int2(x,y-1)].r + 
 			gCurrSolInput[int2(x+1,y)].r + 
 			gCurrSolInput[int2(x-1,y)].r);
-}
 
-[numthreads(1, 1, 1)]
-void DisturbWavesCS(int3 groupThreadID : SV_GroupThreadID,
-                    int3 dispatchThreadID : SV_DispatchThreadID)
-{
-	// We do not need to do bounds checking because:
-	//	 *out-of-bounds reads return 0, which works for us--it just means the boundary of 
-	//    our water simulation is clamped to 0 in local space.
-	//   *out-of-bounds writes are a no-op.
-	
-	int x = gDisturbIndex.x;
-	int y = gDisturbIndex.y;
+	// Every thread of the group walks the same list, so the loop does not diverge.
+	if(gImpulseCount > 0)
+	{
+		uint width, height;
+		gOutput.GetDimensions(width, height);
+		uint2 tile = gImpulseTiles[groupID.y*(width/16) + groupID.x];
+		for(uint k = tile.x; k < tile.x + tile.y; ++k)
+		{
+			Impulse impulse = gImpulses[k];
 
-	float halfMag = 0.5f*gDisturbMag;
+			// Raised cosine, half the magnitude at Radius and zero at twice Radius.
+			float w = max(1.0f, 2.0f*impulse.Radius);
+			float d = distance(float2(x, y), float2(impulse.Col, impulse.Row));
+			if(d < w)
+				h += 0.5f*impulse.Magnitude*(1.0f + cos(3.14159265f*d/w));
+		}
+	}
 
-	// Buffer is RW so operator += is well defined.
-	gOutput[int2(x,y)]   += gDisturbMag;
-	gOutput[int2(x+1,y)] += halfMag;
-	gOutput[int2(x-1,y)] += halfMag;
-	gOutput[int2(x,y+1)] += halfMag;
-	gOutput[int2(x,y-1)] += halfMag;
+	gOutput[int2(x,y)] = h;
 }
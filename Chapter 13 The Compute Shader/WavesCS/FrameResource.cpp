@@ -1,6 +1,7 @@
 #include "FrameResource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount,
+    UINT waveImpulseCount, UINT waveTileCount)
 {
     ThrowIfFailed(device->CreateCommandAllocator(
         D3D12_COMMAND_LIST_TYPE_DIRECT,
@@ -10,6 +11,9 @@ FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCo
     PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
     MaterialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, true);
     ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+
+    WaveImpulses = std::make_unique<UploadBuffer<GpuWaves::Impulse>>(device, waveImpulseCount, false);
+    WaveImpulseTiles = std::make_unique<UploadBuffer<GpuWaves::ImpulseTile>>(device, waveTileCount, false);
 }
 
 FrameResource::~FrameResource()
@@ -11,6 +11,7 @@
 
 #include "../../Common/d3dUtil.h"
 #include "../../Common/GameTimer.h"
+#include "../../Common/UploadBuffer.h"
 
 class GpuWaves
 {
@@ -22,6 +23,24 @@ public:
 	GpuWaves& operator=(const GpuWaves& rhs) = delete;
 	~GpuWaves()=default;
 
+	// A disturbance for the batched Disturb, laid out as WaveSim.hlsl reads it.
+	// Magnitude is added at texel (Col, Row) and falls off as a raised cosine to half
+	// of it Radius texels away and to nothing at twice Radius.
+	struct Impulse
+	{
+		UINT Row;
+		UINT Col;
+		float Magnitude;
+		float Radius;
+	};
+
+	// The impulses [First, First + Count) of one 16x16 thread group tile.
+	struct ImpulseTile
+	{
+		UINT First;
+		UINT Count;
+	};
+
 	UINT RowCount()const;
 	UINT ColumnCount()const;
 	UINT VertexCount()const;
@@ -34,6 +53,12 @@ public:
 
 	UINT DescriptorCount()const;
 
+	// Sizes of the per frame upload buffers Update bins queued impulses into: one
+	// ImpulseTile per thread group tile, and up to ImpulseCapacity() impulses counting
+	// one per tile each reaches.
+	UINT TileCount()const;
+	UINT ImpulseCapacity()const;
+
 	void BuildResources(ID3D12GraphicsCommandList* cmdList);
 
 	void BuildDescriptors(
@@ -41,20 +66,27 @@ public:
 		CD3DX12_GPU_DESCRIPTOR_HANDLE hGpuDescriptor,
 		UINT descriptorSize);
 
+	// The impulse buffers must not be in use by the GPU, so come from the current
+	// frame resource.  They are bound as root SRVs in parameters 4 and 5 of rootSig.
 	void Update(
 		const GameTimer& gt,
 		ID3D12GraphicsCommandList* cmdList, 
 		ID3D12RootSignature* rootSig,
-		ID3D12PipelineState* pso);
+		ID3D12PipelineState* pso,
+		UploadBuffer<Impulse>* impulseBuffer,
+		UploadBuffer<ImpulseTile>* tileBuffer);
 
-	void Disturb(
-		ID3D12GraphicsCommandList* cmdList,
-		ID3D12RootSignature* rootSig,
-		ID3D12PipelineState* pso, 
-		UINT i, UINT j, 
-		float magnitude);
+	// Queues count impulses for the next update step.  Instead of a dispatch per
+	// impulse, the update shader adds them to the new solution as it computes it:
+	// they are binned by the thread group tiles they reach, so each group only reads
+	// its own.  Impulses that would overflow ImpulseCapacity() in one step are dropped.
+	void Disturb(const Impulse* impulses, UINT count);
 
 private:
+	// Bins the queued impulses into the upload buffers and returns how many binned
+	// entries there are.
+	UINT BinImpulses(UploadBuffer<Impulse>* impulseBuffer, UploadBuffer<ImpulseTile>* tileBuffer);
+
 
 	UINT mNumRows;
 	UINT mNumCols;
@@ -85,6 +117,12 @@ private:
 
 	Microsoft::WRL::ComPtr<ID3D12Resource> mPrevUploadBuffer = nullptr;
 	Microsoft::WRL::ComPtr<ID3D12Resource> mCurrUploadBuffer = nullptr;
+
+	// Impulses queued since the last step, and the same binned by tile.  The impulses
+	// of tile t start at mTileStart[t].
+	std::vector<Impulse> mQueuedImpulses;
+	std::vector<Impulse> mBinnedImpulses;
+	std::vector<UINT> mTileStart;
 };
 
 #endif // GPUWAVES_H
\ No newline at end of file
@@ -526,11 +526,14 @@ void WavesCSApp::UpdateWavesGPU(const GameTimer& gt)
 
 		float r = MathHelper::RandF(1.0f, 2.0f);
 
-		mWaves->Disturb(mCommandList.Get(), mWavesRootSignature.Get(), mPSOs["wavesDisturb"].Get(), i, j, r);
+		// Applied by the next update step.
+		GpuWaves::Impulse impulse = { (UINT)i, (UINT)j, r, 1.0f };
+		mWaves->Disturb(&impulse, 1);
 	}
 
 	// Update the wave simulation.
-	mWaves->Update(gt, mCommandList.Get(), mWavesRootSignature.Get(), mPSOs["wavesUpdate"].Get());
+	mWaves->Update(gt, mCommandList.Get(), mWavesRootSignature.Get(), mPSOs["wavesUpdate"].Get(),
+		mCurrFrameResource->WaveImpulses.get(), mCurrFrameResource->WaveImpulseTiles.get());
 }
 
 void WavesCSApp::LoadTextures()
@@ -617,16 +620,18 @@ void WavesCSApp::BuildWavesRootSignature()
 	uavTable2.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 2);
 
 	// Root parameter can be a table, root descriptor or root constants.
-	CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+	CD3DX12_ROOT_PARAMETER slotRootParameter[6];
 
 	// Perfomance TIP: Order from most frequent to least frequent.
-	slotRootParameter[0].InitAsConstants(6, 0);
+	slotRootParameter[0].InitAsConstants(4, 0);
 	slotRootParameter[1].InitAsDescriptorTable(1, &uavTable0);
 	slotRootParameter[2].InitAsDescriptorTable(1, &uavTable1);
 	slotRootParameter[3].InitAsDescriptorTable(1, &uavTable2);
+	slotRootParameter[4].InitAsShaderResourceView(0);
+	slotRootParameter[5].InitAsShaderResourceView(1);
 
 	// A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(6, slotRootParameter,
 		0, nullptr,
 		D3D12_ROOT_SIGNATURE_FLAG_NONE);
 
@@ -723,7 +728,6 @@ void WavesCSApp::BuildShadersAndInputLayout()
 	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", defines, "PS", "ps_5_0");
 	mShaders["alphaTestedPS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", alphaTestDefines, "PS", "ps_5_0");
 	mShaders["wavesUpdateCS"] = d3dUtil::CompileShader(L"Shaders\\WaveSim.hlsl", nullptr, "UpdateWavesCS", "cs_5_0");
-	mShaders["wavesDisturbCS"] = d3dUtil::CompileShader(L"Shaders\\WaveSim.hlsl", nullptr, "DisturbWavesCS", "cs_5_0");
 
     mInputLayout =
     {
@@ -963,19 +967,6 @@ void WavesCSApp::BuildPSOs()
 	};
 	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&wavesRenderPSO, IID_PPV_ARGS(&mPSOs["wavesRender"])));
 
-	//
-	// PSO for disturbing waves
-	//
-	D3D12_COMPUTE_PIPELINE_STATE_DESC wavesDisturbPSO = {};
-	wavesDisturbPSO.pRootSignature = mWavesRootSignature.Get();
-	wavesDisturbPSO.CS =
-	{
-		reinterpret_cast<BYTE*>(mShaders["wavesDisturbCS"]->GetBufferPointer()),
-		mShaders["wavesDisturbCS"]->GetBufferSize()
-	};
-	wavesDisturbPSO.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
-	ThrowIfFailed(md3dDevice->CreateComputePipelineState(&wavesDisturbPSO, IID_PPV_ARGS(&mPSOs["wavesDisturb"])));
-
 	//
 	// PSO for updating waves
 	//
@@ -995,7 +986,8 @@ void WavesCSApp::BuildFrameResources()
     for(int i = 0; i < gNumFrameResources; ++i)
     {
         mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size()));
+            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size(),
+            mWaves->ImpulseCapacity(), mWaves->TileCount()));
     }
 }
 
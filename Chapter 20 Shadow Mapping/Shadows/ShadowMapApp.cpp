@@ -6,6 +6,7 @@
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
+#include "../../Common/MeshFile.h"
 #include "../../Common/Camera.h"
 #include "FrameResource.h"
 #include "ShadowMap.h"
@@ -950,38 +951,30 @@ void ShadowMapApp::BuildShapeGeometry()
 
 void ShadowMapApp::BuildSkullGeometry()
 {
-    std::ifstream fin("Models/skull.txt");
-
-    if (!fin)
+    MeshFile mesh;
+    if (!mesh.OpenModel("Models/skull.txt"))
     {
         MessageBox(0, L"Models/skull.txt not found.", 0, 0);
         return;
     }
 
-    UINT vcount = 0;
-    UINT tcount = 0;
-    std::string ignore;
-
-    fin >> ignore >> vcount;
-    fin >> ignore >> tcount;
-    fin >> ignore >> ignore >> ignore >> ignore;
+    const float* positions = mesh.Positions();
+    const float* normals = mesh.Normals();
 
-    XMFLOAT3 vMinf3(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
-    XMFLOAT3 vMaxf3(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
+    XMFLOAT3 vMinf3(mesh.BoundsMin());
+    XMFLOAT3 vMaxf3(mesh.BoundsMax());
 
     XMVECTOR vMin = XMLoadFloat3(&vMinf3);
     XMVECTOR vMax = XMLoadFloat3(&vMaxf3);
 
-    std::vector<Vertex> vertices(vcount);
-    for (UINT i = 0; i < vcount; ++i)
+    std::vector<Vertex> vertices(mesh.VertexCount());
+    for (UINT i = 0; i < mesh.VertexCount(); ++i)
     {
-        fin >> vertices[i].Pos.x >> vertices[i].Pos.y >> vertices[i].Pos.z;
-        fin >> vertices[i].Normal.x >> vertices[i].Normal.y >> vertices[i].Normal.z;
+        vertices[i].Pos = XMFLOAT3(&positions[i * 3]);
+        vertices[i].Normal = XMFLOAT3(&normals[i * 3]);
 
         vertices[i].TexC = { 0.0f, 0.0f };
 
-        XMVECTOR P = XMLoadFloat3(&vertices[i].Pos);
-
         XMVECTOR N = XMLoadFloat3(&vertices[i].Normal);
 
         // Generate a tangent vector so normal mapping works.  We aren't applying
@@ -999,27 +992,14 @@ void ShadowMapApp::BuildSkullGeometry()
             XMVECTOR T = XMVector3Normalize(XMVector3Cross(N, up));
             XMStoreFloat3(&vertices[i].TangentU, T);
         }
-        
-
-        vMin = XMVectorMin(vMin, P);
-        vMax = XMVectorMax(vMax, P);
     }
 
     BoundingBox bounds;
     XMStoreFloat3(&bounds.Center, 0.5f*(vMin + vMax));
     XMStoreFloat3(&bounds.Extents, 0.5f*(vMax - vMin));
 
-    fin >> ignore;
-    fin >> ignore;
-    fin >> ignore;
-
-    std::vector<std::int32_t> indices(3 * tcount);
-    for (UINT i = 0; i < tcount; ++i)
-    {
-        fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
-    }
-
-    fin.close();
+    // The index stream is uploaded straight from the mapped file.
+    const std::uint32_t* indices = mesh.Indices();
 
     //
     // Pack the indices of all the meshes into one index buffer.
@@ -1027,7 +1007,7 @@ void ShadowMapApp::BuildSkullGeometry()
 
     const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
 
-    const UINT ibByteSize = (UINT)indices.size() * sizeof(std::int32_t);
+    const UINT ibByteSize = mesh.IndexCount() * sizeof(std::uint32_t);
 
     auto geo = std::make_unique<MeshGeometry>();
     geo->Name = "skullGeo";
@@ -1036,13 +1016,13 @@ void ShadowMapApp::BuildSkullGeometry()
     CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
 
     ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-    CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+    CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices, ibByteSize);
 
     geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
         mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
 
     geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-        mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+        mCommandList.Get(), indices, ibByteSize, geo->IndexBufferUploader);
 
     geo->VertexByteStride = sizeof(Vertex);
     geo->VertexBufferByteSize = vbByteSize;
@@ -1050,7 +1030,7 @@ void ShadowMapApp::BuildSkullGeometry()
     geo->IndexBufferByteSize = ibByteSize;
 
     SubmeshGeometry submesh;
-    submesh.IndexCount = (UINT)indices.size();
+    submesh.IndexCount = mesh.IndexCount();
     submesh.StartIndexLocation = 0;
     submesh.BaseVertexLocation = 0;
     submesh.Bounds = bounds;
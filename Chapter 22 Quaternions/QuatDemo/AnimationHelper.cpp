@@ -3,6 +3,8 @@
 //***************************************************************************************
 
 #include "AnimationHelper.h"
+#include <algorithm>
+#include <cmath>
 
 using namespace DirectX;
 
@@ -34,50 +36,123 @@ float BoneAnimation::GetEndTime()const
 
 void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M)const
 {
-	if( t <= Keyframes.front().TimePos )
+	UINT cursor = 0;
+	Interpolate(t, M, cursor);
+}
+
+void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M, UINT& cursor)const
+{
+	XMVECTOR S, P, Q;
+	Sample(t, cursor, S, P, Q);
+
+	XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+	XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+}
+
+void BoneAnimation::Resample(float keyInterval)
+{
+	KeyInterval = 0.0f;
+	if( Keyframes.size() < 2 || keyInterval <= 0.0f )
+		return;
+
+	float startTime = GetStartTime();
+	float endTime = GetEndTime();
+	if( endTime <= startTime )
+		return;
+
+	// The slack keeps rounding in the time stamps from adding a keyframe.  A spacing
+	// much finer than the keyframes have costs more than the search it saves.
+	float steps = std::ceil((endTime - startTime) / keyInterval - 0.01f);
+	if( steps + 1.0f > (float)(MaxResampleGrowth*Keyframes.size()) )
+		return;
+	UINT count = std::max((UINT)steps + 1, 2u);
+	float interval = (endTime - startTime) / (count - 1);
+
+	std::vector<Keyframe> keyframes(count);
+	UINT cursor = 0;
+	for(UINT i = 0; i < count; ++i)
 	{
-		XMVECTOR S = XMLoadFloat3(&Keyframes.front().Scale);
-		XMVECTOR P = XMLoadFloat3(&Keyframes.front().Translation);
-		XMVECTOR Q = XMLoadFloat4(&Keyframes.front().RotationQuat);
+		float t = i + 1 < count ? startTime + i*interval : endTime;
+
+		XMVECTOR S, P, Q;
+		Sample(t, cursor, S, P, Q);
 
-		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-		XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+		keyframes[i].TimePos = t;
+		XMStoreFloat3(&keyframes[i].Scale, S);
+		XMStoreFloat3(&keyframes[i].Translation, P);
+		XMStoreFloat4(&keyframes[i].RotationQuat, Q);
+	}
+
+	Keyframes.swap(keyframes);
+	KeyInterval = interval;
+}
+
+void BoneAnimation::Sample(float t, UINT& cursor, XMVECTOR& S, XMVECTOR& P, XMVECTOR& Q)const
+{
+	if( t <= Keyframes.front().TimePos )
+	{
+		cursor = 0;
+		S = XMLoadFloat3(&Keyframes.front().Scale);
+		P = XMLoadFloat3(&Keyframes.front().Translation);
+		Q = XMLoadFloat4(&Keyframes.front().RotationQuat);
 	}
 	else if( t >= Keyframes.back().TimePos )
 	{
-		XMVECTOR S = XMLoadFloat3(&Keyframes.back().Scale);
-		XMVECTOR P = XMLoadFloat3(&Keyframes.back().Translation);
-		XMVECTOR Q = XMLoadFloat4(&Keyframes.back().RotationQuat);
-
-		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-		XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+		cursor = (UINT)Keyframes.size() - 1;
+		S = XMLoadFloat3(&Keyframes.back().Scale);
+		P = XMLoadFloat3(&Keyframes.back().Translation);
+		Q = XMLoadFloat4(&Keyframes.back().RotationQuat);
 	}
 	else
 	{
-		for(UINT i = 0; i < Keyframes.size()-1; ++i)
-		{
-			if( t >= Keyframes[i].TimePos && t <= Keyframes[i+1].TimePos )
-			{
-				float lerpPercent = (t - Keyframes[i].TimePos) / (Keyframes[i+1].TimePos - Keyframes[i].TimePos);
+		UINT i = FindKeyframe(t, cursor);
+		cursor = i;
+
+		float lerpPercent = (t - Keyframes[i].TimePos) / (Keyframes[i+1].TimePos - Keyframes[i].TimePos);
+
+		XMVECTOR s0 = XMLoadFloat3(&Keyframes[i].Scale);
+		XMVECTOR s1 = XMLoadFloat3(&Keyframes[i+1].Scale);
 
-				XMVECTOR s0 = XMLoadFloat3(&Keyframes[i].Scale);
-				XMVECTOR s1 = XMLoadFloat3(&Keyframes[i+1].Scale);
+		XMVECTOR p0 = XMLoadFloat3(&Keyframes[i].Translation);
+		XMVECTOR p1 = XMLoadFloat3(&Keyframes[i+1].Translation);
 
-				XMVECTOR p0 = XMLoadFloat3(&Keyframes[i].Translation);
-				XMVECTOR p1 = XMLoadFloat3(&Keyframes[i+1].Translation);
+		XMVECTOR q0 = XMLoadFloat4(&Keyframes[i].RotationQuat);
+		XMVECTOR q1 = XMLoadFloat4(&Keyframes[i+1].RotationQuat);
 
-				XMVECTOR q0 = XMLoadFloat4(&Keyframes[i].RotationQuat);
-				XMVECTOR q1 = XMLoadFloat4(&Keyframes[i+1].RotationQuat);
+		S = XMVectorLerp(s0, s1, lerpPercent);
+		P = XMVectorLerp(p0, p1, lerpPercent);
+		Q = XMQuaternionSlerp(q0, q1, lerpPercent);
+	}
+}
 
-				XMVECTOR S = XMVectorLerp(s0, s1, lerpPercent);
-				XMVECTOR P = XMVectorLerp(p0, p1, lerpPercent);
-				XMVECTOR Q = XMQuaternionSlerp(q0, q1, lerpPercent);
+// Returns i with Keyframes[i].TimePos <= t < Keyframes[i+1].TimePos, for t strictly
+// between the first and last keyframes.
+UINT BoneAnimation::FindKeyframe(float t, UINT cursor)const
+{
+	UINT last = (UINT)Keyframes.size() - 1;
 
-				XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-				XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+	if( KeyInterval > 0.0f )
+	{
+		// Rounding can land one pair off, and editing the keyframes after Resample
+		// further, so the index is walked to the right pair.
+		UINT i = std::min((UINT)((t - Keyframes.front().TimePos) / KeyInterval), last - 1);
+		while( i > 0 && t < Keyframes[i].TimePos )
+			--i;
+		while( i + 1 < last && t >= Keyframes[i+1].TimePos )
+			++i;
+		return i;
+	}
 
-				break;
-			}
-		}
+	// Playing forward, t is usually still in the cursor's pair or in the next one.
+	if( cursor < last && t >= Keyframes[cursor].TimePos )
+	{
+		if( t < Keyframes[cursor+1].TimePos )
+			return cursor;
+		if( cursor + 1 < last && t < Keyframes[cursor+2].TimePos )
+			return cursor + 1;
 	}
+
+	auto next = std::upper_bound(Keyframes.begin(), Keyframes.end(), t,
+		[](float time, const Keyframe& key) { return time < key.TimePos; });
+	return (UINT)(next - Keyframes.begin()) - 1;
 }
\ No newline at end of file
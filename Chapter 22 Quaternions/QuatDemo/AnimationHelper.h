@@ -29,6 +29,11 @@ struct Keyframe
 /// two nearest keyframes that bound the time.  
 ///
 /// We assume an animation always has two keyframes.
+///
+/// The bounding keyframes are found by binary search, or directly once
+/// Resample has spaced the keyframes evenly.  A caller that plays the
+/// animation forward can keep a cursor per bone, which makes the search
+/// a check of the last pair and the one after it.
 ///</summary>
 struct BoneAnimation
 {
@@ -37,8 +42,25 @@ struct BoneAnimation
 
     void Interpolate(float t, DirectX::XMFLOAT4X4& M)const;
 
+	// cursor is the keyframe found by the last call; any value is safe.
+    void Interpolate(float t, DirectX::XMFLOAT4X4& M, UINT& cursor)const;
+
+	// Replaces the keyframes with ones keyInterval apart, or slightly closer
+	// so the last falls on the end time.  Keeps them as they are if that would
+	// take more than MaxResampleGrowth times as many.  Call again after editing
+	// Keyframes.
+	void Resample(float keyInterval);
+
 	std::vector<Keyframe> Keyframes; 	
 
+	// Spacing of the keyframes after Resample, 0 if they are not evenly spaced.
+	float KeyInterval = 0.0f;
+
+	static const UINT MaxResampleGrowth = 4;
+
+private:
+	void Sample(float t, UINT& cursor, DirectX::XMVECTOR& S, DirectX::XMVECTOR& P, DirectX::XMVECTOR& Q)const;
+	UINT FindKeyframe(float t, UINT cursor)const;
 };
 
 #endif // ANIMATION_HELPER_H
\ No newline at end of file
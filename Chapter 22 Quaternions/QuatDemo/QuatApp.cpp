@@ -6,6 +6,7 @@
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
+#include "../../Common/MeshFile.h"
 #include "../../Common/Camera.h"
 #include "FrameResource.h"
 #include "AnimationHelper.h"
@@ -126,6 +127,7 @@ private:
 
     float mAnimTimePos = 0.0f;
     BoneAnimation mSkullAnimation;
+    UINT mSkullKeyframeCursor = 0;
 
     POINT mLastMousePos;
 };
@@ -219,7 +221,7 @@ void QuatApp::Update(const GameTimer& gt)
         mAnimTimePos = 0.0f;
     }
 
-    mSkullAnimation.Interpolate(mAnimTimePos, mSkullWorld);
+    mSkullAnimation.Interpolate(mAnimTimePos, mSkullWorld, mSkullKeyframeCursor);
     mSkullRitem->World = mSkullWorld;
     mSkullRitem->NumFramesDirty = gNumFrameResources;
 
@@ -489,6 +491,10 @@ void QuatApp::DefineSkullAnimation()
     mSkullAnimation.Keyframes[4].Translation = XMFLOAT3(-7.0f, 0.0f, 0.0f);
     mSkullAnimation.Keyframes[4].Scale = XMFLOAT3(0.25f, 0.25f, 0.25f);
     XMStoreFloat4(&mSkullAnimation.Keyframes[4].RotationQuat, q0);
+
+    // The keyframes are already 2 seconds apart, so this only marks them as evenly
+    // spaced and lets Interpolate index them directly.
+    mSkullAnimation.Resample(2.0f);
 }
 
 void QuatApp::LoadTextures()
@@ -781,33 +787,27 @@ void QuatApp::BuildShapeGeometry()
 
 void QuatApp::BuildSkullGeometry()
 {
-    std::ifstream fin("Models/skull.txt");
-
-    if(!fin)
+    MeshFile mesh;
+    if(!mesh.OpenModel("Models/skull.txt"))
     {
         MessageBox(0, L"Models/skull.txt not found.", 0, 0);
         return;
     }
 
-    UINT vcount = 0;
-    UINT tcount = 0;
-    std::string ignore;
+    const float* positions = mesh.Positions();
+    const float* normals = mesh.Normals();
 
-    fin >> ignore >> vcount;
-    fin >> ignore >> tcount;
-    fin >> ignore >> ignore >> ignore >> ignore;
-
-    XMFLOAT3 vMinf3(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
-    XMFLOAT3 vMaxf3(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
+    XMFLOAT3 vMinf3(mesh.BoundsMin());
+    XMFLOAT3 vMaxf3(mesh.BoundsMax());
 
     XMVECTOR vMin = XMLoadFloat3(&vMinf3);
     XMVECTOR vMax = XMLoadFloat3(&vMaxf3);
 
-    std::vector<Vertex> vertices(vcount);
-    for(UINT i = 0; i < vcount; ++i)
+    std::vector<Vertex> vertices(mesh.VertexCount());
+    for(UINT i = 0; i < mesh.VertexCount(); ++i)
     {
-        fin >> vertices[i].Pos.x >> vertices[i].Pos.y >> vertices[i].Pos.z;
-        fin >> vertices[i].Normal.x >> vertices[i].Normal.y >> vertices[i].Normal.z;
+        vertices[i].Pos = XMFLOAT3(&positions[i * 3]);
+        vertices[i].Normal = XMFLOAT3(&normals[i * 3]);
 
         XMVECTOR P = XMLoadFloat3(&vertices[i].Pos);
 
@@ -827,26 +827,14 @@ void QuatApp::BuildSkullGeometry()
         float v = phi / XM_PI;
 
         vertices[i].TexC = { u, v };
-
-        vMin = XMVectorMin(vMin, P);
-        vMax = XMVectorMax(vMax, P);
     }
 
     BoundingBox bounds;
     XMStoreFloat3(&bounds.Center, 0.5f*(vMin + vMax));
     XMStoreFloat3(&bounds.Extents, 0.5f*(vMax - vMin));
 
-    fin >> ignore;
-    fin >> ignore;
-    fin >> ignore;
-
-    std::vector<std::int32_t> indices(3 * tcount);
-    for(UINT i = 0; i < tcount; ++i)
-    {
-        fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
-    }
-
-    fin.close();
+    // The index stream is uploaded straight from the mapped file.
+    const std::uint32_t* indices = mesh.Indices();
 
     //
     // Pack the indices of all the meshes into one index buffer.
@@ -854,7 +842,7 @@ void QuatApp::BuildSkullGeometry()
 
     const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
 
-    const UINT ibByteSize = (UINT)indices.size() * sizeof(std::int32_t);
+    const UINT ibByteSize = mesh.IndexCount() * sizeof(std::uint32_t);
 
     auto geo = std::make_unique<MeshGeometry>();
     geo->Name = "skullGeo";
@@ -863,13 +851,13 @@ void QuatApp::BuildSkullGeometry()
     CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
 
     ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-    CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+    CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices, ibByteSize);
 
     geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
         mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
 
     geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-        mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+        mCommandList.Get(), indices, ibByteSize, geo->IndexBufferUploader);
 
     geo->VertexByteStride = sizeof(Vertex);
     geo->VertexBufferByteSize = vbByteSize;
@@ -877,7 +865,7 @@ void QuatApp::BuildSkullGeometry()
     geo->IndexBufferByteSize = ibByteSize;
 
     SubmeshGeometry submesh;
-    submesh.IndexCount = (UINT)indices.size();
+    submesh.IndexCount = mesh.IndexCount();
     submesh.StartIndexLocation = 0;
     submesh.BaseVertexLocation = 0;
     submesh.Bounds = bounds;
@@ -224,6 +224,23 @@ void M3DLoader::ReadAnimationClips(std::ifstream& fin, UINT numBones, UINT numAn
         }
         fin >> ignore; // }
 
+        // Space each bone's keyframes evenly at its own closest spacing, so they can
+        // be indexed by time.  Resample leaves a bone whose spacing varies too much
+        // with the keyframes it has.
+        for(UINT boneIndex = 0; boneIndex < numBones; ++boneIndex)
+        {
+            BoneAnimation& bone = clip.BoneAnimations[boneIndex];
+            float keyInterval = MathHelper::Infinity;
+            for(size_t i = 1; i < bone.Keyframes.size(); ++i)
+            {
+                float interval = bone.Keyframes[i].TimePos - bone.Keyframes[i-1].TimePos;
+                if( interval > 0.0f )
+                    keyInterval = MathHelper::Min(keyInterval, interval);
+            }
+            if( keyInterval < MathHelper::Infinity )
+                bone.Resample(keyInterval);
+        }
+
         animations[clipName] = clip;
     }
 }
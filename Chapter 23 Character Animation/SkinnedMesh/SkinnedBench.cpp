@@ -0,0 +1,302 @@
+//***************************************************************************************
+// SkinnedBench.cpp
+//
+// Console harness that times the CPU side of the skinned mesh demo without a D3D12
+// device: SkinnedData::GetFinalTransforms for a crowd of instances playing every clip
+// at random times, and linear blend skinning of the model's vertices on the CPU, done
+// the way the Default.hlsl vertex shader does it.  Heap allocations are counted by
+// replacing the global operator new.
+//
+// Usage: SkinnedBench [instances [frames [model]]]
+//        100 instances, 20 frames and Models\soldier.m3d by default.
+//***************************************************************************************
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+#include "LoadM3d.h"
+#include "SkinnedData.h"
+
+using namespace DirectX;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Seconds(Clock::time_point start, Clock::time_point end)
+{
+	return std::chrono::duration<double>(end - start).count();
+}
+
+static std::size_t gAllocationCount = 0;
+
+void* operator new(std::size_t size)
+{
+	++gAllocationCount;
+	void* p = std::malloc(size > 0 ? size : 1);
+	if(p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+struct SkinnedOutput
+{
+	XMFLOAT3 Pos;
+	XMFLOAT3 Normal;
+	XMFLOAT3 TangentU;
+};
+
+// Same sums as the SKINNED path of Default.hlsl.  The final transforms are stored
+// transposed for the shader, so the palette transposes them back first.
+static void SkinVertices(const std::vector<M3DLoader::SkinnedVertex>& vertices,
+	const std::vector<XMFLOAT4X4>& finalTransforms, std::vector<XMMATRIX>& palette,
+	std::vector<SkinnedOutput>& output)
+{
+	for(size_t b = 0; b < finalTransforms.size(); ++b)
+		palette[b] = XMMatrixTranspose(XMLoadFloat4x4(&finalTransforms[b]));
+
+	for(size_t v = 0; v < vertices.size(); ++v)
+	{
+		const M3DLoader::SkinnedVertex& vin = vertices[v];
+		float weights[4] = { vin.BoneWeights.x, vin.BoneWeights.y, vin.BoneWeights.z,
+			1.0f - vin.BoneWeights.x - vin.BoneWeights.y - vin.BoneWeights.z };
+
+		XMVECTOR posL = XMLoadFloat3(&vin.Pos);
+		XMVECTOR normalL = XMLoadFloat3(&vin.Normal);
+		XMVECTOR tangentL = XMLoadFloat3(&vin.TangentU);
+		XMVECTOR pos = XMVectorZero();
+		XMVECTOR normal = XMVectorZero();
+		XMVECTOR tangent = XMVectorZero();
+		for(int i = 0; i < 4; ++i)
+		{
+			const XMMATRIX& M = palette[vin.BoneIndices[i]];
+			pos = XMVectorAdd(pos, XMVectorScale(XMVector3Transform(posL, M), weights[i]));
+			normal = XMVectorAdd(normal, XMVectorScale(XMVector3TransformNormal(normalL, M), weights[i]));
+			tangent = XMVectorAdd(tangent, XMVectorScale(XMVector3TransformNormal(tangentL, M), weights[i]));
+		}
+
+		XMStoreFloat3(&output[v].Pos, pos);
+		XMStoreFloat3(&output[v].Normal, normal);
+		XMStoreFloat3(&output[v].TangentU, tangent);
+	}
+}
+
+// Instance k plays clip k % clips at its own random time, redrawn every frame.
+static std::vector<float> RandomTimes(const SkinnedData& skinInfo, const std::vector<std::string>& clips,
+	int instances, int frames)
+{
+	std::mt19937 rng(instances);
+	std::vector<float> times((size_t)instances * frames);
+	for(int f = 0; f < frames; ++f)
+	{
+		for(int k = 0; k < instances; ++k)
+		{
+			const std::string& clip = clips[k % clips.size()];
+			std::uniform_real_distribution<float> time(skinInfo.GetClipStartTime(clip), skinInfo.GetClipEndTime(clip));
+			times[(size_t)f * instances + k] = time(rng);
+		}
+	}
+	return times;
+}
+
+// Once through the clip names, and once through clip handles with per-instance
+// keyframe cursors and one shared scratch space.
+static void ReportAnimation(const SkinnedData& skinInfo, const std::vector<std::string>& clips,
+	int instances, int frames)
+{
+	std::vector<float> times = RandomTimes(skinInfo, clips, instances, frames);
+	std::vector<std::vector<XMFLOAT4X4>> finalTransforms(instances,
+		std::vector<XMFLOAT4X4>(skinInfo.BoneCount()));
+	std::vector<std::vector<UINT>> keyframeCursors(instances,
+		std::vector<UINT>(skinInfo.BoneCount()));
+	std::vector<const AnimationClip*> handles;
+	for(const std::string& clip : clips)
+		handles.push_back(skinInfo.FindClip(clip));
+	AnimationScratch scratch;
+	scratch.ToRootTransforms.resize(skinInfo.BoneCount());
+
+	double seconds[2];
+	double allocations[2];
+	float checksum = 0.0f;
+	for(int handle = 0; handle < 2; ++handle)
+	{
+		std::size_t before = gAllocationCount;
+		auto start = Clock::now();
+		for(int f = 0; f < frames; ++f)
+		{
+			for(int k = 0; k < instances; ++k)
+			{
+				float t = times[(size_t)f * instances + k];
+				if(handle)
+				{
+					skinInfo.GetFinalTransforms(handles[k % handles.size()], t, finalTransforms[k],
+						keyframeCursors[k], scratch);
+				}
+				else
+					skinInfo.GetFinalTransforms(clips[k % clips.size()], t, finalTransforms[k]);
+			}
+		}
+		seconds[handle] = Seconds(start, Clock::now());
+		allocations[handle] = (double)(gAllocationCount - before);
+
+		for(int k = 0; k < instances; ++k)
+			checksum += finalTransforms[k].back()(0, 3);
+	}
+
+	double calls = (double)instances * frames;
+	double bones = calls * skinInfo.BoneCount();
+	printf("%9d %6d %12.2f %12.1f %12.2f %12.1f %12.2f %12.3f\n", instances, frames, seconds[0] / frames * 1e3,
+		seconds[0] / bones * 1e9, allocations[0] / calls, seconds[1] / bones * 1e9, allocations[1] / calls,
+		checksum);
+}
+
+// Every instance plays its clip forward at 60Hz from a random start, looping, once
+// without and once with its own keyframe cursors.
+static void ReportPlayback(const SkinnedData& skinInfo, const std::vector<std::string>& clips,
+	int instances, int frames)
+{
+	std::vector<float> startTimes = RandomTimes(skinInfo, clips, instances, 1);
+	std::vector<std::vector<XMFLOAT4X4>> finalTransforms(instances,
+		std::vector<XMFLOAT4X4>(skinInfo.BoneCount()));
+	std::vector<std::vector<UINT>> keyframeCursors(instances,
+		std::vector<UINT>(skinInfo.BoneCount()));
+
+	double seconds[2];
+	for(int cached = 0; cached < 2; ++cached)
+	{
+		std::vector<float> times = startTimes;
+		auto start = Clock::now();
+		for(int f = 0; f < frames; ++f)
+		{
+			for(int k = 0; k < instances; ++k)
+			{
+				const std::string& clip = clips[k % clips.size()];
+				times[k] += 1.0f / 60.0f;
+				if(times[k] > skinInfo.GetClipEndTime(clip))
+					times[k] = skinInfo.GetClipStartTime(clip);
+
+				if(cached)
+					skinInfo.GetFinalTransforms(clip, times[k], finalTransforms[k], keyframeCursors[k]);
+				else
+					skinInfo.GetFinalTransforms(clip, times[k], finalTransforms[k]);
+			}
+		}
+		seconds[cached] = Seconds(start, Clock::now());
+	}
+
+	double bones = (double)instances * frames * skinInfo.BoneCount();
+	printf("%9d %6d %12.1f %12.1f\n", instances, frames, seconds[0] / bones * 1e9, seconds[1] / bones * 1e9);
+}
+
+static void ReportSkinning(const SkinnedData& skinInfo, const std::vector<std::string>& clips,
+	const std::vector<M3DLoader::SkinnedVertex>& vertices, int instances, int frames)
+{
+	std::vector<float> times = RandomTimes(skinInfo, clips, instances, frames);
+	std::vector<XMFLOAT4X4> finalTransforms(skinInfo.BoneCount());
+	std::vector<XMMATRIX> palette(skinInfo.BoneCount());
+	std::vector<SkinnedOutput> output(vertices.size());
+
+	// The poses are worked out up front, so only the skinning itself is timed.
+	std::vector<std::vector<XMFLOAT4X4>> poses(instances);
+	double seconds = 0.0;
+	std::size_t allocations = 0;
+	float checksum = 0.0f;
+	for(int f = 0; f < frames; ++f)
+	{
+		for(int k = 0; k < instances; ++k)
+		{
+			poses[k].resize(skinInfo.BoneCount());
+			skinInfo.GetFinalTransforms(clips[k % clips.size()], times[(size_t)f * instances + k], poses[k]);
+		}
+
+		std::size_t before = gAllocationCount;
+		auto start = Clock::now();
+		for(int k = 0; k < instances; ++k)
+		{
+			SkinVertices(vertices, poses[k], palette, output);
+			checksum += output[k % output.size()].Pos.y;
+		}
+		seconds += Seconds(start, Clock::now());
+		allocations += gAllocationCount - before;
+	}
+
+	double calls = (double)instances * frames;
+	printf("%9d %6d %12.2f %12.2f %12.2f %12.3f\n", instances, frames, seconds / frames * 1e3,
+		seconds / calls * 1e9 / vertices.size(), allocations / calls, checksum);
+}
+
+int main(int argc, char** argv)
+{
+	int instances = argc > 1 ? atoi(argv[1]) : 100;
+	int frames = argc > 2 ? atoi(argv[2]) : 20;
+	std::string filename = argc > 3 ? argv[3] : "Models\\soldier.m3d";
+
+	std::vector<M3DLoader::SkinnedVertex> vertices;
+	std::vector<USHORT> indices;
+	std::vector<M3DLoader::Subset> subsets;
+	std::vector<M3DLoader::M3dMaterial> mats;
+	SkinnedData skinInfo;
+
+	M3DLoader loader;
+	auto start = Clock::now();
+	if(!loader.LoadM3d(filename, vertices, indices, subsets, mats, skinInfo))
+	{
+		printf("Could not open %s\n", filename.c_str());
+		return 1;
+	}
+	double loadSeconds = Seconds(start, Clock::now());
+
+	std::vector<std::string> clips = skinInfo.ClipNames();
+	if(clips.empty() || skinInfo.BoneCount() == 0)
+	{
+		printf("%s has no animation\n", filename.c_str());
+		return 1;
+	}
+	std::sort(clips.begin(), clips.end());
+
+	printf("%s: %zu vertices, %u bones, %zu clips, loaded in %.1f ms\n", filename.c_str(),
+		vertices.size(), skinInfo.BoneCount(), clips.size(), loadSeconds * 1e3);
+
+	printf("\nGetFinalTransforms, one call per instance per frame, by clip name and by clip handle\n");
+	printf("%9s %6s %12s %12s %12s %12s %12s %12s\n", "instances", "frames", "ms/frame", "ns/bone", "allocs/call",
+		"ns/bone", "allocs/call", "checksum");
+	for(int n = std::max(1, instances / 100); n <= instances; n *= 10)
+		ReportAnimation(skinInfo, clips, n, frames);
+
+	printf("\nGetFinalTransforms, forward playback: ns/bone without and with keyframe cursors\n");
+	printf("%9s %6s %12s %12s\n", "instances", "frames", "search", "cursors");
+	ReportPlayback(skinInfo, clips, instances, frames);
+
+	printf("\nCPU linear blend skinning, position + normal + tangent\n");
+	printf("%9s %6s %12s %12s %12s %12s\n", "instances", "frames", "ms/frame", "ns/vertex", "allocs/call",
+		"checksum");
+	ReportSkinning(skinInfo, clips, vertices, std::max(1, instances / 10), frames);
+	return 0;
+}
@@ -1,4 +1,6 @@
 #include "SkinnedData.h"
+#include <algorithm>
+#include <cmath>
 
 using namespace DirectX;
 
@@ -30,52 +32,125 @@ float BoneAnimation::GetEndTime()const
 
 void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M)const
 {
-	if( t <= Keyframes.front().TimePos )
+	UINT cursor = 0;
+	Interpolate(t, M, cursor);
+}
+
+void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M, UINT& cursor)const
+{
+	XMVECTOR S, P, Q;
+	Sample(t, cursor, S, P, Q);
+
+	XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+	XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+}
+
+void BoneAnimation::Resample(float keyInterval)
+{
+	KeyInterval = 0.0f;
+	if( Keyframes.size() < 2 || keyInterval <= 0.0f )
+		return;
+
+	float startTime = GetStartTime();
+	float endTime = GetEndTime();
+	if( endTime <= startTime )
+		return;
+
+	// The slack keeps rounding in the time stamps from adding a keyframe.  A spacing
+	// much finer than the keyframes have costs more than the search it saves.
+	float steps = std::ceil((endTime - startTime) / keyInterval - 0.01f);
+	if( steps + 1.0f > (float)(MaxResampleGrowth*Keyframes.size()) )
+		return;
+	UINT count = std::max((UINT)steps + 1, 2u);
+	float interval = (endTime - startTime) / (count - 1);
+
+	std::vector<Keyframe> keyframes(count);
+	UINT cursor = 0;
+	for(UINT i = 0; i < count; ++i)
 	{
-		XMVECTOR S = XMLoadFloat3(&Keyframes.front().Scale);
-		XMVECTOR P = XMLoadFloat3(&Keyframes.front().Translation);
-		XMVECTOR Q = XMLoadFloat4(&Keyframes.front().RotationQuat);
+		float t = i + 1 < count ? startTime + i*interval : endTime;
+
+		XMVECTOR S, P, Q;
+		Sample(t, cursor, S, P, Q);
 
-		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-		XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+		keyframes[i].TimePos = t;
+		XMStoreFloat3(&keyframes[i].Scale, S);
+		XMStoreFloat3(&keyframes[i].Translation, P);
+		XMStoreFloat4(&keyframes[i].RotationQuat, Q);
+	}
+
+	Keyframes.swap(keyframes);
+	KeyInterval = interval;
+}
+
+void BoneAnimation::Sample(float t, UINT& cursor, XMVECTOR& S, XMVECTOR& P, XMVECTOR& Q)const
+{
+	if( t <= Keyframes.front().TimePos )
+	{
+		cursor = 0;
+		S = XMLoadFloat3(&Keyframes.front().Scale);
+		P = XMLoadFloat3(&Keyframes.front().Translation);
+		Q = XMLoadFloat4(&Keyframes.front().RotationQuat);
 	}
 	else if( t >= Keyframes.back().TimePos )
 	{
-		XMVECTOR S = XMLoadFloat3(&Keyframes.back().Scale);
-		XMVECTOR P = XMLoadFloat3(&Keyframes.back().Translation);
-		XMVECTOR Q = XMLoadFloat4(&Keyframes.back().RotationQuat);
-
-		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-		XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+		cursor = (UINT)Keyframes.size() - 1;
+		S = XMLoadFloat3(&Keyframes.back().Scale);
+		P = XMLoadFloat3(&Keyframes.back().Translation);
+		Q = XMLoadFloat4(&Keyframes.back().RotationQuat);
 	}
 	else
 	{
-		for(UINT i = 0; i < Keyframes.size()-1; ++i)
-		{
-			if( t >= Keyframes[i].TimePos && t <= Keyframes[i+1].TimePos )
-			{
-				float lerpPercent = (t - Keyframes[i].TimePos) / (Keyframes[i+1].TimePos - Keyframes[i].TimePos);
+		UINT i = FindKeyframe(t, cursor);
+		cursor = i;
 
-				XMVECTOR s0 = XMLoadFloat3(&Keyframes[i].Scale);
-				XMVECTOR s1 = XMLoadFloat3(&Keyframes[i+1].Scale);
+		float lerpPercent = (t - Keyframes[i].TimePos) / (Keyframes[i+1].TimePos - Keyframes[i].TimePos);
 
-				XMVECTOR p0 = XMLoadFloat3(&Keyframes[i].Translation);
-				XMVECTOR p1 = XMLoadFloat3(&Keyframes[i+1].Translation);
+		XMVECTOR s0 = XMLoadFloat3(&Keyframes[i].Scale);
+		XMVECTOR s1 = XMLoadFloat3(&Keyframes[i+1].Scale);
 
-				XMVECTOR q0 = XMLoadFloat4(&Keyframes[i].RotationQuat);
-				XMVECTOR q1 = XMLoadFloat4(&Keyframes[i+1].RotationQuat);
+		XMVECTOR p0 = XMLoadFloat3(&Keyframes[i].Translation);
+		XMVECTOR p1 = XMLoadFloat3(&Keyframes[i+1].Translation);
 
-				XMVECTOR S = XMVectorLerp(s0, s1, lerpPercent);
-				XMVECTOR P = XMVectorLerp(p0, p1, lerpPercent);
-				XMVECTOR Q = XMQuaternionSlerp(q0, q1, lerpPercent);
+		XMVECTOR q0 = XMLoadFloat4(&Keyframes[i].RotationQuat);
+		XMVECTOR q1 = XMLoadFloat4(&Keyframes[i+1].RotationQuat);
 
-				XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-				XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+		S = XMVectorLerp(s0, s1, lerpPercent);
+		P = XMVectorLerp(p0, p1, lerpPercent);
+		Q = XMQuaternionSlerp(q0, q1, lerpPercent);
+	}
+}
 
-				break;
-			}
-		}
+// Returns i with Keyframes[i].TimePos <= t < Keyframes[i+1].TimePos, for t strictly
+// between the first and last keyframes.
+UINT BoneAnimation::FindKeyframe(float t, UINT cursor)const
+{
+	UINT last = (UINT)Keyframes.size() - 1;
+
+	if( KeyInterval > 0.0f )
+	{
+		// Rounding can land one pair off, and editing the keyframes after Resample
+		// further, so the index is walked to the right pair.
+		UINT i = std::min((UINT)((t - Keyframes.front().TimePos) / KeyInterval), last - 1);
+		while( i > 0 && t < Keyframes[i].TimePos )
+			--i;
+		while( i + 1 < last && t >= Keyframes[i+1].TimePos )
+			++i;
+		return i;
+	}
+
+	// Playing forward, t is usually still in the cursor's pair or in the next one.
+	if( cursor < last && t >= Keyframes[cursor].TimePos )
+	{
+		if( t < Keyframes[cursor+1].TimePos )
+			return cursor;
+		if( cursor + 1 < last && t < Keyframes[cursor+2].TimePos )
+			return cursor + 1;
 	}
+
+	auto next = std::upper_bound(Keyframes.begin(), Keyframes.end(), t,
+		[](float time, const Keyframe& key) { return time < key.TimePos; });
+	return (UINT)(next - Keyframes.begin()) - 1;
 }
 
 float AnimationClip::GetClipStartTime()const
@@ -110,6 +185,26 @@ void AnimationClip::Interpolate(float t, std::vector<XMFLOAT4X4>& boneTransforms
 	}
 }
 
+void AnimationClip::Interpolate(float t, std::vector<XMFLOAT4X4>& boneTransforms,
+								std::vector<UINT>& keyframeCursors)const
+{
+	if( keyframeCursors.size() < BoneAnimations.size() )
+		keyframeCursors.resize(BoneAnimations.size(), 0);
+
+	for(UINT i = 0; i < BoneAnimations.size(); ++i)
+	{
+		BoneAnimations[i].Interpolate(t, boneTransforms[i], keyframeCursors[i]);
+	}
+}
+
+void AnimationClip::Resample(float keyInterval)
+{
+	for(UINT i = 0; i < BoneAnimations.size(); ++i)
+	{
+		BoneAnimations[i].Resample(keyInterval);
+	}
+}
+
 float SkinnedData::GetClipStartTime(const std::string& clipName)const
 {
 	auto clip = mAnimations.find(clipName);
@@ -122,6 +217,21 @@ float SkinnedData::GetClipEndTime(const std::string& clipName)const
 	return clip->second.GetClipEndTime();
 }
 
+const AnimationClip* SkinnedData::FindClip(const std::string& clipName)const
+{
+	auto clip = mAnimations.find(clipName);
+	return clip != mAnimations.end() ? &clip->second : nullptr;
+}
+
+std::vector<std::string> SkinnedData::ClipNames()const
+{
+	std::vector<std::string> names;
+	for(auto& clip : mAnimations)
+		names.push_back(clip.first);
+
+	return names;
+}
+
 UINT SkinnedData::BoneCount()const
 {
 	return mBoneHierarchy.size();
@@ -138,42 +248,59 @@ void SkinnedData::Set(std::vector<int>& boneHierarchy,
  
 void SkinnedData::GetFinalTransforms(const std::string& clipName, float timePos,  std::vector<XMFLOAT4X4>& finalTransforms)const
 {
-	UINT numBones = mBoneOffsets.size();
+	std::vector<UINT> keyframeCursors;
+	GetFinalTransforms(clipName, timePos, finalTransforms, keyframeCursors);
+}
 
-	std::vector<XMFLOAT4X4> toParentTransforms(numBones);
+void SkinnedData::GetFinalTransforms(const std::string& clipName, float timePos,
+									 std::vector<XMFLOAT4X4>& finalTransforms,
+									 std::vector<UINT>& keyframeCursors)const
+{
+	AnimationScratch scratch;
+	GetFinalTransforms(FindClip(clipName), timePos, finalTransforms, keyframeCursors, scratch);
+}
 
-	// Interpolate all the bones of this clip at the given time instance.
-	auto clip = mAnimations.find(clipName);
-	clip->second.Interpolate(timePos, toParentTransforms);
+void SkinnedData::GetFinalTransforms(const AnimationClip* clip, float timePos,
+									 std::vector<XMFLOAT4X4>& finalTransforms,
+									 std::vector<UINT>& keyframeCursors,
+									 AnimationScratch& scratch)const
+{
+	UINT numBones = mBoneOffsets.size();
 
-	//
-	// Traverse the hierarchy and transform all the bones to the root space.
-	//
+	if( scratch.ToRootTransforms.size() < numBones )
+		scratch.ToRootTransforms.resize(numBones);
+	if( finalTransforms.size() < numBones )
+		finalTransforms.resize(numBones);
 
-	std::vector<XMFLOAT4X4> toRootTransforms(numBones);
+	// Interpolate all the bones of this clip at the given time instance.  The
+	// toParentTransforms go straight into the scratch space and are replaced by the
+	// toRootTransforms one by one below.
+	std::vector<XMFLOAT4X4>& toRootTransforms = scratch.ToRootTransforms;
+	clip->Interpolate(timePos, toRootTransforms, keyframeCursors);
 
-	// The root bone has index 0.  The root bone has no parent, so its toRootTransform
+	//
+	// Traverse the hierarchy and transform all the bones to the root space.  A parent
+	// always comes before its children, so its toRootTransform is ready by the time
+	// they need it.  The root bone has index 0 and no parent, so its toRootTransform
 	// is just its local bone transform.
-	toRootTransforms[0] = toParentTransforms[0];
+	//
+	// Premultiply by the bone offset transform to get the final transform.
+	//
 
-	// Now find the toRootTransform of the children.
-	for(UINT i = 1; i < numBones; ++i)
+	for(UINT i = 0; i < numBones; ++i)
 	{
-		XMMATRIX toParent = XMLoadFloat4x4(&toParentTransforms[i]);
-
-		int parentIndex = mBoneHierarchy[i];
-		XMMATRIX parentToRoot = XMLoadFloat4x4(&toRootTransforms[parentIndex]);
+		XMMATRIX toRoot = XMLoadFloat4x4(&toRootTransforms[i]);
+		if( i > 0 )
+		{
+			int parentIndex = mBoneHierarchy[i];
+			XMMATRIX parentToRoot = XMLoadFloat4x4(&toRootTransforms[parentIndex]);
 
-		XMMATRIX toRoot = XMMatrixMultiply(toParent, parentToRoot);
+			toRoot = XMMatrixMultiply(toRoot, parentToRoot);
 
-		XMStoreFloat4x4(&toRootTransforms[i], toRoot);
-	}
+			XMStoreFloat4x4(&toRootTransforms[i], toRoot);
+		}
 
-	// Premultiply by the bone offset transform to get the final transform.
-	for(UINT i = 0; i < numBones; ++i)
-	{
 		XMMATRIX offset = XMLoadFloat4x4(&mBoneOffsets[i]);
-		XMMATRIX toRoot = XMLoadFloat4x4(&toRootTransforms[i]);
         XMMATRIX finalTransform = XMMatrixMultiply(offset, toRoot);
 		XMStoreFloat4x4(&finalTransforms[i], XMMatrixTranspose(finalTransform));
 	}
@@ -24,6 +24,11 @@ struct Keyframe
 /// two nearest keyframes that bound the time.  
 ///
 /// We assume an animation always has two keyframes.
+///
+/// The bounding keyframes are found by binary search, or directly once
+/// Resample has spaced the keyframes evenly.  A caller that plays the
+/// animation forward can keep a cursor per bone, which makes the search
+/// a check of the last pair and the one after it.
 ///</summary>
 struct BoneAnimation
 {
@@ -32,7 +37,25 @@ struct BoneAnimation
 
     void Interpolate(float t, DirectX::XMFLOAT4X4& M)const;
 
+	// cursor is the keyframe found by the last call; any value is safe.
+    void Interpolate(float t, DirectX::XMFLOAT4X4& M, UINT& cursor)const;
+
+	// Replaces the keyframes with ones keyInterval apart, or slightly closer
+	// so the last falls on the end time.  Keeps them as they are if that would
+	// take more than MaxResampleGrowth times as many.  Call again after editing
+	// Keyframes.
+	void Resample(float keyInterval);
+
 	std::vector<Keyframe> Keyframes; 	
+
+	// Spacing of the keyframes after Resample, 0 if they are not evenly spaced.
+	float KeyInterval = 0.0f;
+
+	static const UINT MaxResampleGrowth = 4;
+
+private:
+	void Sample(float t, UINT& cursor, DirectX::XMVECTOR& S, DirectX::XMVECTOR& P, DirectX::XMVECTOR& Q)const;
+	UINT FindKeyframe(float t, UINT cursor)const;
 };
 
 ///<summary>
@@ -46,10 +69,24 @@ struct AnimationClip
 	float GetClipEndTime()const;
 
     void Interpolate(float t, std::vector<DirectX::XMFLOAT4X4>& boneTransforms)const;
+    void Interpolate(float t, std::vector<DirectX::XMFLOAT4X4>& boneTransforms,
+		std::vector<UINT>& keyframeCursors)const;
+
+	void Resample(float keyInterval);
 
     std::vector<BoneAnimation> BoneAnimations; 	
 };
 
+///<summary>
+/// Working space for SkinnedData::GetFinalTransforms.  It only grows, so once
+/// it has held the largest skeleton, calls that reuse it do not allocate.
+/// It keeps nothing between calls; one per thread can serve every instance.
+///</summary>
+struct AnimationScratch
+{
+	std::vector<DirectX::XMFLOAT4X4> ToRootTransforms;
+};
+
 class SkinnedData
 {
 public:
@@ -59,6 +96,13 @@ public:
 	float GetClipStartTime(const std::string& clipName)const;
 	float GetClipEndTime(const std::string& clipName)const;
 
+	// Handle for the GetFinalTransforms overload that skips the name lookup, or
+	// nullptr if there is no such clip.  Valid until the next Set.
+	const AnimationClip* FindClip(const std::string& clipName)const;
+
+	// Names of all the animation clips, in no particular order.
+	std::vector<std::string> ClipNames()const;
+
 	void Set(
 		std::vector<int>& boneHierarchy, 
 		std::vector<DirectX::XMFLOAT4X4>& boneOffsets,
@@ -70,6 +114,18 @@ public:
     void GetFinalTransforms(const std::string& clipName, float timePos, 
 		 std::vector<DirectX::XMFLOAT4X4>& finalTransforms)const;
 
+	// Same, for an instance that keeps its own keyframe cursors between calls.
+    void GetFinalTransforms(const std::string& clipName, float timePos, 
+		 std::vector<DirectX::XMFLOAT4X4>& finalTransforms,
+		 std::vector<UINT>& keyframeCursors)const;
+
+	// Same, for a clip from FindClip.  Does no heap allocation once
+	// finalTransforms, keyframeCursors and scratch have been sized by a call.
+    void GetFinalTransforms(const AnimationClip* clip, float timePos, 
+		 std::vector<DirectX::XMFLOAT4X4>& finalTransforms,
+		 std::vector<UINT>& keyframeCursors,
+		 AnimationScratch& scratch)const;
+
 private:
     // Gives parentIndex of ith bone.
 	std::vector<int> mBoneHierarchy;
@@ -23,23 +23,25 @@ struct SkinnedModelInstance
 {
     SkinnedData* SkinnedInfo = nullptr;
     std::vector<DirectX::XMFLOAT4X4> FinalTransforms;
+    std::vector<UINT> KeyframeCursors;
     std::string ClipName;
+    const AnimationClip* Clip = nullptr;
     float TimePos = 0.0f;
 
     // Called every frame and increments the time position, interpolates the 
     // animations for each bone based on the current animation clip, and 
     // generates the final transforms which are ultimately set to the effect
     // for processing in the vertex shader.
-    void UpdateSkinnedAnimation(float dt)
+    void UpdateSkinnedAnimation(float dt, AnimationScratch& scratch)
     {
         TimePos += dt;
 
         // Loop animation
-        if(TimePos > SkinnedInfo->GetClipEndTime(ClipName))
+        if(TimePos > Clip->GetClipEndTime())
             TimePos = 0.0f;
 
         // Compute the final transforms for this time position.
-        SkinnedInfo->GetFinalTransforms(ClipName, TimePos, FinalTransforms);
+        SkinnedInfo->GetFinalTransforms(Clip, TimePos, FinalTransforms, KeyframeCursors, scratch);
     }
 };
 
@@ -189,6 +191,7 @@ private:
     std::string mSkinnedModelFilename = "Models\\soldier.m3d";
     std::unique_ptr<SkinnedModelInstance> mSkinnedModelInst; 
     SkinnedData mSkinnedInfo;
+    AnimationScratch mAnimationScratch;
     std::vector<M3DLoader::Subset> mSkinnedSubsets;
     std::vector<M3DLoader::M3dMaterial> mSkinnedMats;
     std::vector<std::string> mSkinnedTextureNames;
@@ -593,7 +596,7 @@ void SkinnedMeshApp::UpdateSkinnedCBs(const GameTimer& gt)
     auto currSkinnedCB = mCurrFrameResource->SkinnedCB.get();
    
     // We only have one skinned model being animated.
-    mSkinnedModelInst->UpdateSkinnedAnimation(gt.DeltaTime());
+    mSkinnedModelInst->UpdateSkinnedAnimation(gt.DeltaTime(), mAnimationScratch);
         
     SkinnedConstants skinnedConstants;
     std::copy(
@@ -1287,6 +1290,7 @@ void SkinnedMeshApp::LoadSkinnedModel()
     mSkinnedModelInst->SkinnedInfo = &mSkinnedInfo;
     mSkinnedModelInst->FinalTransforms.resize(mSkinnedInfo.BoneCount());
     mSkinnedModelInst->ClipName = "Take1";
+    mSkinnedModelInst->Clip = mSkinnedInfo.FindClip(mSkinnedModelInst->ClipName);
     mSkinnedModelInst->TimePos = 0.0f;
  
 	const UINT vbByteSize = (UINT)vertices.size() * sizeof(SkinnedVertex);
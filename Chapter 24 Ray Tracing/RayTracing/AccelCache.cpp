@@ -0,0 +1,117 @@
+#include "AccelCache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+struct CacheHeader
+{
+	char magic[4];
+	uint version;
+	uint64_t key;
+	uint sectionCount;
+	uint pad;
+};
+
+struct CacheSectionEntry
+{
+	uint elementSize;
+	uint pad;
+	uint64_t count;
+	uint64_t offset;
+};
+
+static const char CacheMagic[4] = { 'R', 'T', 'A', 'C' };
+
+static uint64_t AlignSection(uint64_t offset)
+{
+	return (offset + 15) & ~(uint64_t)15;
+}
+
+bool AccelCache::Open(const char* filename, uint64_t key)
+{
+	mSections.clear();
+	if (key == 0 || !mFile.Open(filename))
+		return false;
+	const uint8_t* data = mFile.Data();
+	size_t size = mFile.Size();
+	CacheHeader header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, CacheMagic, 4) != 0 || header.version != ACCEL_CACHE_VERSION || header.key != key ||
+		sizeof(header) + (uint64_t)header.sectionCount * sizeof(CacheSectionEntry) > size)
+	{
+		mFile.Close();
+		return false;
+	}
+	const CacheSectionEntry* entries = (const CacheSectionEntry*)(data + sizeof(header));
+	for (uint i = 0; i < header.sectionCount; i++)
+	{
+		const CacheSectionEntry& entry = entries[i];
+		// Checked as divisions so a damaged count cannot wrap the byte size around.
+		if (entry.elementSize == 0 || entry.offset > size || entry.count > (size - entry.offset) / entry.elementSize)
+		{
+			mFile.Close();
+			mSections.clear();
+			return false;
+		}
+		mSections.push_back({ entry.elementSize, entry.count, data + entry.offset });
+	}
+	return true;
+}
+
+bool AccelCache::Write(const char* filename, uint64_t key, const std::vector<CacheSection>& sections)
+{
+	if (key == 0)
+		return false;
+	std::ofstream fout(filename, std::ios::binary);
+	if (!fout)
+		return false;
+	CacheHeader header;
+	memcpy(header.magic, CacheMagic, 4);
+	header.version = ACCEL_CACHE_VERSION;
+	header.key = key;
+	header.sectionCount = (uint)sections.size();
+	header.pad = 0;
+	std::vector<CacheSectionEntry> entries(sections.size());
+	uint64_t offset = AlignSection(sizeof(header) + entries.size() * sizeof(CacheSectionEntry));
+	for (size_t i = 0; i < sections.size(); i++)
+	{
+		entries[i].elementSize = sections[i].elementSize;
+		entries[i].pad = 0;
+		entries[i].count = sections[i].count;
+		entries[i].offset = offset;
+		offset = AlignSection(offset + sections[i].count * sections[i].elementSize);
+	}
+	fout.write((const char*)&header, sizeof(header));
+	fout.write((const char*)entries.data(), entries.size() * sizeof(CacheSectionEntry));
+	static const char zeros[16] = {};
+	uint64_t written = sizeof(header) + entries.size() * sizeof(CacheSectionEntry);
+	for (size_t i = 0; i < sections.size(); i++)
+	{
+		fout.write(zeros, (std::streamsize)(entries[i].offset - written));
+		uint64_t bytes = sections[i].count * sections[i].elementSize;
+		fout.write((const char*)sections[i].data, (std::streamsize)bytes);
+		written = entries[i].offset + bytes;
+	}
+	fout.close();
+	// Never leave a truncated cache behind.
+	if (!fout)
+	{
+		remove(filename);
+		return false;
+	}
+	return true;
+}
+
+uint64_t AccelCache::HashFile(const char* filename, const char* tag, const std::vector<float>& settings)
+{
+	MappedFile file;
+	if (!file.Open(filename))
+		return 0;
+	uint version = ACCEL_CACHE_VERSION;
+	uint64_t hash = HashBytes(&version, sizeof(version));
+	hash = HashBytes(tag, strlen(tag), hash);
+	hash = HashBytes(settings.data(), settings.size() * sizeof(float), hash);
+	return HashBytes(file.Data(), file.Size(), hash);
+}
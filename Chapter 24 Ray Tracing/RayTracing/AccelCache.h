@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "../../Common/MappedFile.h"
+
+typedef unsigned int uint;
+
+// Versioned binary cache of built acceleration structures.  A cache file holds a
+// list of typed sections (vertices, triangles, nodes, indices, ...) and is keyed by
+// a hash of the source model file, the format version and the builder settings, so
+// a hit skips both parsing and building.  The file is memory-mapped and sections
+// are read in place.  Bump the version when a cached struct or the builders change
+// in a way sizeof does not catch.
+#define ACCEL_CACHE_VERSION 2
+
+struct CacheSection
+{
+	uint elementSize;
+	uint64_t count;
+	const void* data;
+};
+
+template<typename T>
+CacheSection MakeCacheSection(const std::vector<T>& elements)
+{
+	return { (uint)sizeof(T), elements.size(), elements.data() };
+}
+
+// Read-only elements of a section, in place in the mapping or in a vector; valid
+// while the AccelCache or the vector lives.
+template<typename T>
+struct CacheView
+{
+	CacheView() = default;
+	CacheView(const T* elements, size_t n) : data(elements), count(n) {}
+	CacheView(const std::vector<T>& elements) : data(elements.data()), count(elements.size()) {}
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T* begin() const { return data; }
+	const T* end() const { return data + count; }
+	const T& operator[](size_t i) const { return data[i]; }
+
+	const T* data = nullptr;
+	size_t count = 0;
+};
+
+class AccelCache
+{
+public:
+	// Fails when the file is missing, damaged, from another version or for another key.
+	bool Open(const char* filename, uint64_t key);
+	// Elements of section i in place, or nullptr when the section does not hold Ts.
+	template<typename T>
+	const T* Get(uint section, size_t& count) const
+	{
+		if (section >= mSections.size() || mSections[section].elementSize != sizeof(T))
+			return nullptr;
+		count = (size_t)mSections[section].count;
+		return (const T*)mSections[section].data;
+	}
+	template<typename T>
+	bool Get(uint section, CacheView<T>& view) const
+	{
+		size_t count = 0;
+		const T* data = Get<T>(section, count);
+		if (data == nullptr)
+			return false;
+		view = CacheView<T>(data, count);
+		return true;
+	}
+	static bool Write(const char* filename, uint64_t key, const std::vector<CacheSection>& sections);
+	// Key for a model file: its contents hashed together with the format version, a
+	// tag naming the structure built from it and the builder settings that shape it
+	// (BVH::CacheSettings, KDTree::CacheSettings).  Returns 0 when the file cannot
+	// be read.
+	static uint64_t HashFile(const char* filename, const char* tag, const std::vector<float>& settings);
+
+private:
+	MappedFile mFile;
+	std::vector<CacheSection> mSections;
+};
@@ -0,0 +1,323 @@
+#include "BVH.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+BVH::BVH(size_t numTriangles)
+{
+	triangleBoxes.resize(numTriangles);
+}
+
+void BVH::AddTriangle(int index, float* v0, float* v1, float* v2)
+{
+	triangleBoxes[index] = BBox(v0, v1, v2);
+}
+
+// Every triangle is referenced by exactly one leaf, so a tree over N triangles
+// never has more than 2N-1 nodes and N indices.
+void BVH::Build(std::vector<BVHNode_GPU>& nodes, std::vector<uint>& indices)
+{
+	size_t count = triangleBoxes.size();
+	centroids.resize(count * 3);
+	references.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		triangleBoxes[i].GetCenter(&centroids[i * 3]);
+		references[i] = (uint)i;
+	}
+	nodes.clear();
+	nodes.reserve(count > 0 ? count * 2 - 1 : 0);
+	if (count > 0)
+		BuildRecursive(0, (uint)count, 0, nodes);
+	indices.swap(references);
+	references.clear();
+	centroids.clear();
+	buildCost = refitCost = GetStats(nodes).sahCost;
+	assert(StackSize(nodes.data(), nodes.size()) <= BVH_MAX_STACK_SIZE);
+}
+
+// Children always come after their parent in the depth-first order, so a single
+// backwards sweep sees both children before the node itself.
+bool BVH::Refit(std::vector<BVHNode_GPU>& nodes, const std::vector<uint>& indices)
+{
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		BVHNode_GPU& node = nodes[i];
+		if (node.count > 0)
+		{
+			node.box = triangleBoxes[indices[node.offset]];
+			for (uint j = 1; j < node.count; j++)
+				node.box.Join(triangleBoxes[indices[node.offset + j]]);
+		}
+		else
+		{
+			node.box = nodes[i + 1].box;
+			node.box.Join(nodes[node.offset].box);
+		}
+	}
+	refitCost = GetStats(nodes).sahCost;
+	return refitCost <= buildCost * rebuildThreshold;
+}
+
+bool BVH::Update(std::vector<BVHNode_GPU>& nodes, std::vector<uint>& indices)
+{
+	if (!nodes.empty() && Refit(nodes, indices))
+		return false;
+	Build(nodes, indices);
+	return true;
+}
+
+// Binned SAH over the triangle centroids; the references are partitioned in place.
+// Deep down, where SAH splits could run past the traversal stack, median splits take
+// over, and a node at the deepest level the stack allows is a leaf whatever its size.
+void BVH::BuildRecursive(uint start, uint count, uint depth, std::vector<BVHNode_GPU>& nodes)
+{
+	uint index = (uint)nodes.size();
+	nodes.push_back(BVHNode_GPU());
+	BBox box = triangleBoxes[references[start]];
+	BBox centerBox;
+	float* c = &centroids[references[start] * 3];
+	for (int d = 0; d < 3; d++)
+		centerBox.min[d] = centerBox.max[d] = c[d];
+	for (uint i = start + 1; i < start + count; i++)
+	{
+		box.Join(triangleBoxes[references[i]]);
+		c = &centroids[references[i] * 3];
+		for (int d = 0; d < 3; d++)
+		{
+			centerBox.min[d] = std::min(centerBox.min[d], c[d]);
+			centerBox.max[d] = std::max(centerBox.max[d], c[d]);
+		}
+	}
+	nodes[index].box = box;
+
+	uint levelsLeft = BVH_MAX_STACK_SIZE - 1 - depth;
+	if (levelsLeft == 0)
+	{
+		nodes[index].offset = start;
+		nodes[index].count = count;
+		return;
+	}
+	bool tooDeep = levelsLeft < 32 && count > ((uint64_t)maxLeafSize << levelsLeft);
+
+	int bestAxis = -1;
+	int bestBin = 0;
+	float bestCost = intersectionCost * count;
+	float area = box.SurfaceArea();
+	if (count > 1 && area > 0.0f && !tooDeep)
+	{
+		std::vector<BBox> binBoxes(binCount);
+		std::vector<uint> binCounts(binCount);
+		std::vector<float> rightAreas(binCount);
+		for (int d = 0; d < 3; d++)
+		{
+			float extent = centerBox.max[d] - centerBox.min[d];
+			if (extent <= 0.0f)
+				continue;
+			float scale = binCount / extent;
+			std::fill(binCounts.begin(), binCounts.end(), 0);
+			for (uint i = start; i < start + count; i++)
+			{
+				uint t = references[i];
+				int b = std::min((int)((centroids[t * 3 + d] - centerBox.min[d]) * scale), binCount - 1);
+				if (binCounts[b]++ == 0)
+					binBoxes[b] = triangleBoxes[t];
+				else
+					binBoxes[b].Join(triangleBoxes[t]);
+			}
+			// Sweep from the right to get the area of every right-hand side, then
+			// from the left to evaluate each bin boundary.
+			BBox accum;
+			uint accumCount = 0;
+			for (int b = binCount - 1; b > 0; b--)
+			{
+				if (binCounts[b] > 0)
+				{
+					if (accumCount == 0)
+						accum = binBoxes[b];
+					else
+						accum.Join(binBoxes[b]);
+					accumCount += binCounts[b];
+				}
+				rightAreas[b] = accumCount > 0 ? accum.SurfaceArea() : 0.0f;
+			}
+			accumCount = 0;
+			for (int b = 0; b < binCount - 1; b++)
+			{
+				if (binCounts[b] > 0)
+				{
+					if (accumCount == 0)
+						accum = binBoxes[b];
+					else
+						accum.Join(binBoxes[b]);
+					accumCount += binCounts[b];
+				}
+				uint rightCount = count - accumCount;
+				if (accumCount == 0 || rightCount == 0)
+					continue;
+				float cost = traversalCost + intersectionCost *
+					(accum.SurfaceArea() * accumCount + rightAreas[b + 1] * rightCount) / area;
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = d;
+					bestBin = b;
+				}
+			}
+		}
+	}
+
+	uint mid = start;
+	if (bestAxis >= 0)
+	{
+		float scale = binCount / (centerBox.max[bestAxis] - centerBox.min[bestAxis]);
+		float minCenter = centerBox.min[bestAxis];
+		const float* cents = centroids.data();
+		uint* first = references.data() + start;
+		uint* middle = std::partition(first, first + count, [&](uint t)
+		{
+			return std::min((int)((cents[t * 3 + bestAxis] - minCenter) * scale), binCount - 1) <= bestBin;
+		});
+		mid = start + (uint)(middle - first);
+	}
+	else if (count > maxLeafSize)
+	{
+		// No split pays off but the leaf is too big (e.g. coincident centroids), or
+		// the tree is running out of depth; fall back to a median split along the
+		// widest axis.
+		int axis = 0;
+		for (int d = 1; d < 3; d++)
+		{
+			if (box.max[d] - box.min[d] > box.max[axis] - box.min[axis])
+				axis = d;
+		}
+		const float* cents = centroids.data();
+		uint* first = references.data() + start;
+		std::nth_element(first, first + count / 2, first + count, [&](uint a, uint b)
+		{
+			return cents[a * 3 + axis] < cents[b * 3 + axis];
+		});
+		mid = start + count / 2;
+	}
+
+	if (mid == start || mid == start + count)
+	{
+		nodes[index].offset = start;
+		nodes[index].count = count;
+		return;
+	}
+	nodes[index].count = 0;
+	BuildRecursive(start, mid - start, depth + 1, nodes);
+	nodes[index].offset = (uint)nodes.size();
+	BuildRecursive(mid, start + count - mid, depth + 1, nodes);
+}
+
+bool BVH::Build(std::vector<BVHNode_GPU>& nodes, std::vector<uint>& indices,
+	std::vector<BVHNodeCompact>& compact, BVHQuantization& quantization)
+{
+	Build(nodes, indices);
+	return Compact(nodes, compact, quantization);
+}
+
+bool BVH::Compact(const std::vector<BVHNode_GPU>& nodes, std::vector<BVHNodeCompact>& compact, BVHQuantization& quantization)
+{
+	compact.resize(nodes.size());
+	if (nodes.empty())
+		return true;
+	const BBox& root = nodes[0].box;
+	for (int i = 0; i < 3; i++)
+	{
+		float extent = std::max(root.max[i] - root.min[i], 1e-6f * std::max(fabsf(root.min[i]), 1.0f));
+		quantization.origin[i] = root.min[i];
+		quantization.scale[i] = extent / BVH_QUANTIZATION_STEPS;
+	}
+	for (size_t n = 0; n < nodes.size(); n++)
+	{
+		const BVHNode_GPU& node = nodes[n];
+		BVHNodeCompact& c = compact[n];
+		for (int i = 0; i < 3; i++)
+		{
+			float inv = 1.0f / quantization.scale[i];
+			// Step outwards until the decoded planes strictly enclose the box; the
+			// margin absorbs fused multiply-adds when the shader decodes.
+			int lo = std::max((int)floorf((node.box.min[i] - quantization.origin[i]) * inv), 0);
+			while (lo > 0 && quantization.Decode((unsigned short)lo, i) >= node.box.min[i])
+				lo--;
+			int hi = std::min((int)ceilf((node.box.max[i] - quantization.origin[i]) * inv), 65535);
+			while (hi < 65535 && quantization.Decode((unsigned short)hi, i) <= node.box.max[i])
+				hi++;
+			c.min[i] = (unsigned short)lo;
+			c.max[i] = (unsigned short)hi;
+		}
+		if (node.count > 0)
+		{
+			if (node.count > 127 || node.offset >= (1u << 24))
+				return false;
+			c.link = node.offset << 8 | node.count << 1 | 1;
+		}
+		else
+		{
+			if (node.offset >= (1u << 31))
+				return false;
+			c.link = node.offset << 1;
+		}
+	}
+	return true;
+}
+
+BVHStats BVH::GetStats(const std::vector<BVHNode_GPU>& nodes) const
+{
+	BVHStats stats;
+	if (nodes.empty())
+		return stats;
+	float rootArea = nodes[0].box.SurfaceArea();
+	uint references = 0;
+	std::vector<std::pair<uint, uint>> stack;
+	stack.push_back(std::make_pair(0u, 0u));
+	while (!stack.empty())
+	{
+		uint index = stack.back().first;
+		uint depth = stack.back().second;
+		stack.pop_back();
+		const BVHNode_GPU& node = nodes[index];
+		float area = rootArea > 0.0f ? node.box.SurfaceArea() / rootArea : 1.0f;
+		stats.nodeCount++;
+		stats.maxDepth = std::max(stats.maxDepth, depth);
+		if (node.count > 0)
+		{
+			stats.leafCount++;
+			stats.maxLeafSize = std::max(stats.maxLeafSize, node.count);
+			stats.sahCost += intersectionCost * node.count * area;
+			references += node.count;
+		}
+		else
+		{
+			stats.sahCost += traversalCost * area;
+			stack.push_back(std::make_pair(index + 1, depth + 1));
+			stack.push_back(std::make_pair(node.offset, depth + 1));
+		}
+	}
+	stats.averageLeafSize = (float)references / stats.leafCount;
+	return stats;
+}
+
+// Children come after their parent, so one forward sweep sees every depth.
+uint BVH::StackSize(const BVHNode_GPU* nodes, size_t count)
+{
+	std::vector<uint> depth(count);
+	uint maxDepth = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		maxDepth = std::max(maxDepth, depth[i]);
+		if (nodes[i].count == 0)
+			depth[i + 1] = depth[nodes[i].offset] = depth[i] + 1;
+	}
+	return maxDepth + 1;
+}
+
+std::vector<float> BVH::CacheSettings() const
+{
+	return { traversalCost, intersectionCost, (float)binCount, (float)maxLeafSize, BVH_QUANTIZATION_STEPS,
+		(float)BVH_MAX_STACK_SIZE };
+}
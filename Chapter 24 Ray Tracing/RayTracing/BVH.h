@@ -0,0 +1,96 @@
+#pragma once
+#include "KDTree.h"
+
+// Depth-first flattened BVH node.  The left child of an interior node always
+// follows it directly; offset holds the index of the right child.  For leaves
+// offset is the first entry in the index buffer.
+struct BVHNode_GPU
+{
+	BBox box;
+	uint offset;
+	uint count;		// 0 for interior nodes
+};
+
+// 16 byte node of the same tree with its box quantized to a 16 bit grid over the
+// root box.  Quantization rounds outwards so decoded boxes contain the exact ones.
+// link holds the right child << 1 for interior nodes and start << 8 | count << 1 | 1
+// for leaves.
+struct BVHNodeCompact
+{
+	unsigned short min[3];
+	unsigned short max[3];
+	uint link;
+};
+
+// Grid steps across the root box; a few short of 65535 so rounding outwards never clamps.
+static const float BVH_QUANTIZATION_STEPS = 65520.0f;
+
+struct BVHQuantization
+{
+	float origin[3];
+	float scale[3];
+	float Decode(unsigned short q, int axis) const { return origin[axis] + q * scale[axis]; }
+	void Decode(const BVHNodeCompact& node, BBox& box) const
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			box.min[i] = Decode(node.min[i], i);
+			box.max[i] = Decode(node.max[i], i);
+		}
+	}
+};
+
+// Stack the CPU traversals are compiled with.  BVH::Build keeps every tree within it
+// by limiting the depth, and the shaders get a stack sized from the trees actually
+// built (BVH::StackSize).
+static const uint BVH_MAX_STACK_SIZE = 64;
+
+struct BVHStats
+{
+	uint nodeCount = 0;
+	uint leafCount = 0;
+	uint maxDepth = 0;
+	uint maxLeafSize = 0;
+	float averageLeafSize = 0;
+	float sahCost = 0;
+};
+
+struct BVH
+{
+	BVH(size_t numTriangles);
+	void AddTriangle(int index, float* v0, float* v1, float* v2);
+	void Build(std::vector<BVHNode_GPU>& nodes, std::vector<uint>& indices);
+	// Also emits the compact encoding; fails if a leaf or index does not fit in it.
+	bool Build(std::vector<BVHNode_GPU>& nodes, std::vector<uint>& indices,
+		std::vector<BVHNodeCompact>& compact, BVHQuantization& quantization);
+	static bool Compact(const std::vector<BVHNode_GPU>& nodes, std::vector<BVHNodeCompact>& compact, BVHQuantization& quantization);
+	// For animated geometry: after the moved triangles were passed to AddTriangle
+	// again, recomputes every box bottom-up in O(N) keeping the topology.  Returns
+	// false once the SAH cost exceeds rebuildThreshold times that of the last full
+	// build; the refitted tree is still valid, just slower to trace.
+	bool Refit(std::vector<BVHNode_GPU>& nodes, const std::vector<uint>& indices);
+	// Refits, or rebuilds when the refitted tree has degraded too far.  Returns
+	// true when it rebuilt.
+	bool Update(std::vector<BVHNode_GPU>& nodes, std::vector<uint>& indices);
+	BVHStats GetStats(const std::vector<BVHNode_GPU>& nodes) const;
+	// Entries an ordered depth-first traversal (pop a node, push its far then its
+	// near child) can hold at once: maxDepth + 1, one waiting sibling per level
+	// below the root plus the two children of the deepest interior node.
+	static uint StackSize(const BVHNode_GPU* nodes, size_t count);
+	// Everything above that changes the tree Build produces, for AccelCache keys.
+	std::vector<float> CacheSettings() const;
+	std::vector<BBox> triangleBoxes;
+
+	float traversalCost = 1.0f;
+	float intersectionCost = 1.0f;
+	int binCount = 16;
+	uint maxLeafSize = 8;
+	float rebuildThreshold = 1.5f;
+	float buildCost = 0.0f;		// SAH cost right after the last full build
+	float refitCost = 0.0f;		// SAH cost after the last refit
+
+private:
+	void BuildRecursive(uint start, uint count, uint depth, std::vector<BVHNode_GPU>& nodes);
+	std::vector<float> centroids;
+	std::vector<uint> references;
+};
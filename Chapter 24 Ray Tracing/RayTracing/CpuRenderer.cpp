@@ -0,0 +1,639 @@
+#include "CpuRenderer.h"
+#include "Sampler.h"
+#include "../../Common/ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+
+static const float PI = 3.14159265358979f;
+
+struct Float3
+{
+	float x, y, z;
+	Float3() {}
+	Float3(float a, float b, float c) : x(a), y(b), z(c) {}
+	explicit Float3(const float* v) : x(v[0]), y(v[1]), z(v[2]) {}
+	Float3 operator+(const Float3& b) const { return Float3(x + b.x, y + b.y, z + b.z); }
+	Float3 operator-(const Float3& b) const { return Float3(x - b.x, y - b.y, z - b.z); }
+	Float3 operator*(const Float3& b) const { return Float3(x * b.x, y * b.y, z * b.z); }
+	Float3 operator*(float s) const { return Float3(x * s, y * s, z * s); }
+};
+
+static inline float Dot(const Float3& a, const Float3& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline Float3 Cross(const Float3& a, const Float3& b)
+{
+	return Float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static inline Float3 Normalize(const Float3& a)
+{
+	return a * (1.0f / sqrtf(Dot(a, a)));
+}
+
+static inline float Saturate(float x)
+{
+	return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+// Row vector times row-major matrix, like mul(M, v) on the column-major shader side.
+static inline void Transform(const float m[4][4], const float* v, float* out)
+{
+	for (int c = 0; c < 4; c++)
+		out[c] = v[0] * m[0][c] + v[1] * m[1][c] + v[2] * m[2][c] + v[3] * m[3][c];
+}
+
+struct PathRay
+{
+	CpuRay ray;
+	Float3 energy;
+};
+
+struct PathHit
+{
+	Float3 position;
+	float distance;
+	Float3 normal;
+	Float3 albedo;
+	Float3 specular;
+};
+
+// Per-pixel state of the shader's Sample2D(): either rand(), whose seed advances on
+// every call, or the scrambled Sobol sequence with a seed per dimension pair.
+struct PixelSampler
+{
+	CpuSampler type;
+	float pixel[2];
+	float seed;
+	uint index;
+	uint pixelSeed;
+	uint dimension;
+	float Next()
+	{
+		float x = sinf(seed / 100.0f * (pixel[0] * 12.9898f + pixel[1] * 78.233f)) * 43758.5453f;
+		seed += 1.0f;
+		return x - floorf(x);
+	}
+	void Next2D(float* u)
+	{
+		if (type == CpuSampler::Sobol)
+			SobolOwen2D(index, HashCombine(pixelSeed, dimension++), u);
+		else
+		{
+			u[0] = Next();
+			u[1] = Next();
+		}
+	}
+};
+
+void CpuCamera::LookAt(const float* eye, const float* target, const float* up, float fovY, float aspect)
+{
+	Float3 forward = Normalize(Float3(target) - Float3(eye));
+	Float3 right = Normalize(Cross(Float3(up), forward));
+	Float3 trueUp = Cross(forward, right);
+	float rows[4][4] =
+	{
+		{ right.x, right.y, right.z, 0.0f },
+		{ trueUp.x, trueUp.y, trueUp.z, 0.0f },
+		{ forward.x, forward.y, forward.z, 0.0f },
+		{ eye[0], eye[1], eye[2], 1.0f }
+	};
+	memcpy(invView, rows, sizeof(rows));
+	// Inverse of XMMatrixPerspectiveFovLH restricted to the terms CreateCameraRay uses.
+	float yScale = 1.0f / tanf(0.5f * fovY);
+	float xScale = yScale / aspect;
+	memset(invProj, 0, sizeof(invProj));
+	invProj[0][0] = 1.0f / xScale;
+	invProj[1][1] = 1.0f / yScale;
+	invProj[2][3] = -1.0f;
+	invProj[3][2] = 1.0f;
+	invProj[3][3] = 1.0f;
+}
+
+void CpuScene::BuildAccel()
+{
+	if (!mesh)
+		return;
+	kdNodes.clear();
+	bvhNodes.clear();
+	indices.clear();
+	if (accel == CpuAccel::KDTree)
+	{
+		KDTree tree(mesh->TriangleCount());
+		for (uint i = 0; i < mesh->TriangleCount(); i++)
+			tree.AddTriangle(i, const_cast<float*>(mesh->Position(i, 0)), const_cast<float*>(mesh->Position(i, 1)), const_cast<float*>(mesh->Position(i, 2)));
+		tree.Build(kdNodes, indices);
+	}
+	else
+	{
+		BVH bvh(mesh->TriangleCount());
+		for (uint i = 0; i < mesh->TriangleCount(); i++)
+			bvh.AddTriangle(i, const_cast<float*>(mesh->Position(i, 0)), const_cast<float*>(mesh->Position(i, 1)), const_cast<float*>(mesh->Position(i, 2)));
+		bvh.Build(bvhNodes, indices);
+	}
+}
+
+// Same layout as RayTracingApp::BuildConstantBuffers.
+void CpuScene::AddRandomSpheres(int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		int x = i % 8;
+		int y = i / 8;
+		CpuSphere sphere;
+		sphere.radius = 1.0f + 3.0f * rand() / (float)RAND_MAX;
+		sphere.position[0] = x * 8.0f;
+		sphere.position[1] = sphere.radius;
+		sphere.position[2] = y * 8.0f;
+		for (int c = 0; c < 3; c++)
+			sphere.albedo[c] = rand() / (float)RAND_MAX;
+		for (int c = 0; c < 3; c++)
+			sphere.specular[c] = rand() / (float)RAND_MAX;
+		spheres.push_back(sphere);
+	}
+	groundPlane = true;
+}
+
+void CpuImage::Resize(int w, int h)
+{
+	width = w;
+	height = h;
+	pixels.assign(w * h * 3, 0.0f);
+}
+
+bool CpuImage::WritePFM(const char* file) const
+{
+	std::ofstream fout(file, std::ios::binary);
+	if (!fout)
+		return false;
+	// Little-endian PFM stores the bottom row first.
+	fout << "PF\n" << width << " " << height << "\n-1.0\n";
+	for (int y = height - 1; y >= 0; y--)
+		fout.write((const char*)Pixel(0, y), sizeof(float) * width * 3);
+	return (bool)fout;
+}
+
+bool CpuImage::WritePPM(const char* file) const
+{
+	std::ofstream fout(file, std::ios::binary);
+	if (!fout)
+		return false;
+	// The GPU writes straight into an R8G8B8A8_UNORM target, so no tone mapping here either.
+	fout << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<unsigned char> row(width * 3);
+	for (int y = 0; y < height; y++)
+	{
+		const float* p = Pixel(0, y);
+		for (int i = 0; i < width * 3; i++)
+			row[i] = (unsigned char)(Saturate(p[i]) * 255.0f + 0.5f);
+		fout.write((const char*)row.data(), row.size());
+	}
+	return (bool)fout;
+}
+
+// Keeps black pixels from never converging; matches ERROR_FLOOR in the shader.
+static const float ErrorFloor = 0.01f;
+
+void PixelEstimator::Add(const float* rgb)
+{
+	count++;
+	float alpha = 1.0f / count;
+	mean[0] += (rgb[0] - mean[0]) * alpha;
+	mean[1] += (rgb[1] - mean[1]) * alpha;
+	mean[2] += (rgb[2] - mean[2]) * alpha;
+	float lum = 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+	float delta = lum - lumMean;
+	lumMean += delta * alpha;
+	lumM2 += delta * (lum - lumMean);
+}
+
+float PixelEstimator::RelativeError() const
+{
+	if (count < 2)
+		return FLT_MAX;
+	float variance = lumM2 / (count - 1);
+	return sqrtf(variance / count) / std::max(lumMean, ErrorFloor);
+}
+
+bool PixelEstimator::Converged(float targetError, uint minSamples, uint maxSamples) const
+{
+	if (count >= maxSamples)
+		return true;
+	return count >= minSamples && RelativeError() <= targetError;
+}
+
+static Float3 SampleHemisphere(const Float3& normal, PixelSampler& sampler)
+{
+	// Uniformly sample hemisphere direction
+	float u[2];
+	sampler.Next2D(u);
+	float cosTheta = u[0];
+	float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2 * PI * u[1];
+	// Tangent space of GetTangentSpace()
+	Float3 helper(1, 0, 0);
+	if (fabsf(normal.x) > 0.99f)
+		helper = Float3(0, 0, 1);
+	Float3 tangent = Normalize(Cross(normal, helper));
+	Float3 binormal = Normalize(Cross(normal, tangent));
+	return tangent * (cosf(phi) * sinTheta) + binormal * (sinf(phi) * sinTheta) + normal * cosTheta;
+}
+
+static void IntersectGroundPlane(const CpuRay& ray, PathHit& bestHit)
+{
+	float t = -ray.origin[1] / ray.direction[1];
+	if (t > 0 && t < bestHit.distance)
+	{
+		bestHit.distance = t;
+		bestHit.position = Float3(ray.origin) + Float3(ray.direction) * t;
+		bestHit.normal = Float3(0.0f, 1.0f, 0.0f);
+	}
+}
+
+static void IntersectSphere(const CpuRay& ray, PathHit& bestHit, const CpuSphere& sphere)
+{
+	Float3 d = Float3(ray.origin) - Float3(sphere.position);
+	float p1 = -Dot(Float3(ray.direction), d);
+	float p2sqr = p1 * p1 - Dot(d, d) + sphere.radius * sphere.radius;
+	if (p2sqr < 0)
+		return;
+	float p2 = sqrtf(p2sqr);
+	float t = p1 - p2 > 0 ? p1 - p2 : p1 + p2;
+	if (t > 0 && t < bestHit.distance)
+	{
+		bestHit.distance = t;
+		bestHit.position = Float3(ray.origin) + Float3(ray.direction) * t;
+		bestHit.normal = Normalize(bestHit.position - Float3(sphere.position));
+		bestHit.albedo = Float3(sphere.albedo);
+		bestHit.specular = Float3(sphere.specular);
+	}
+}
+
+static PathHit Trace(const CpuScene& scene, const CpuRay& ray)
+{
+	PathHit bestHit;
+	bestHit.position = Float3(0.0f, 0.0f, 0.0f);
+	bestHit.distance = std::numeric_limits<float>::infinity();
+	bestHit.normal = Float3(0.0f, 0.0f, 0.0f);
+	bestHit.specular = Float3(0.6f, 0.6f, 0.6f);
+	bestHit.albedo = Float3(0.8f, 0.8f, 0.8f);
+	if (scene.mesh)
+	{
+		CpuHit hit;
+		if (scene.accel == CpuAccel::KDTree)
+			TraceKDTree(*scene.mesh, scene.kdNodes, scene.indices, ray, hit);
+		else
+			TraceBVH(*scene.mesh, scene.bvhNodes, scene.indices, ray, hit);
+		if (hit.triangle != 0xFFFFFFFF)
+		{
+			const TraceMesh& mesh = *scene.mesh;
+			Float3 n0(&mesh.normals[mesh.indices[hit.triangle * 3 + 0] * 3]);
+			Float3 n1(&mesh.normals[mesh.indices[hit.triangle * 3 + 1] * 3]);
+			Float3 n2(&mesh.normals[mesh.indices[hit.triangle * 3 + 2] * 3]);
+			float w = 1 - hit.u - hit.v;
+			bestHit.distance = hit.distance;
+			bestHit.position = Float3(ray.origin) + Float3(ray.direction) * hit.distance;
+			// Same weights as IntersectLeaf in the shader.
+			bestHit.normal = Normalize(n0 * hit.u + n1 * hit.v + n2 * w);
+		}
+	}
+	for (const CpuSphere& sphere : scene.spheres)
+		IntersectSphere(ray, bestHit, sphere);
+	if (scene.groundPlane)
+		IntersectGroundPlane(ray, bestHit);
+	return bestHit;
+}
+
+static Float3 Shade(const CpuScene& scene, PathRay& path, const PathHit& hit, PixelSampler& sampler)
+{
+	if (hit.distance < std::numeric_limits<float>::infinity())
+	{
+		// Diffuse shading
+		Float3 origin = hit.position + hit.normal * 0.001f;
+		Float3 direction = SampleHemisphere(hit.normal, sampler);
+		memcpy(path.ray.origin, &origin, sizeof(float) * 3);
+		memcpy(path.ray.direction, &direction, sizeof(float) * 3);
+		path.energy = path.energy * hit.albedo * (2.0f * Saturate(Dot(hit.normal, direction)));
+		return Float3(0.0f, 0.0f, 0.0f);
+	}
+	// Erase the ray's energy - the sky doesn't reflect anything
+	path.energy = Float3(0.0f, 0.0f, 0.0f);
+	float t = Saturate(path.ray.direction[1]);
+	return Float3(scene.skyHorizon) + (Float3(scene.skyZenith) - Float3(scene.skyHorizon)) * t;
+}
+
+// Camera ray of a pixel sample, the start of BeginPixel() in the shader.
+static PathRay CameraRay(const CpuCamera& camera, int x, int y, int width, int height, PixelSampler& sampler)
+{
+	float uv[2];
+	sampler.Next2D(uv);
+	uv[0] = (x + uv[0]) / width * 2.0f - 1.0f;
+	uv[1] = (y + uv[1]) / height * 2.0f - 1.0f;
+
+	PathRay path;
+	float origin[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	float eye[4];
+	Transform(camera.invView, origin, eye);
+	float ndc[4] = { uv[0], -uv[1], 0.0f, 1.0f };
+	float viewDir[4];
+	Transform(camera.invProj, ndc, viewDir);
+	viewDir[3] = 0.0f;
+	float worldDir[4];
+	Transform(camera.invView, viewDir, worldDir);
+	Float3 direction = Normalize(Float3(worldDir));
+	memcpy(path.ray.origin, eye, sizeof(float) * 3);
+	memcpy(path.ray.direction, &direction, sizeof(float) * 3);
+	path.energy = Float3(1, 1, 1);
+	return path;
+}
+
+static bool Terminated(const PathRay& path)
+{
+	return path.energy.x == 0.0f && path.energy.y == 0.0f && path.energy.z == 0.0f;
+}
+
+// One invocation of CS() for pixel (x, y); returns the number of rays traced.
+static uint ShadePixel(const CpuScene& scene, const CpuCamera& camera, int maxBounces, int x, int y,
+	int width, int height, PixelSampler& sampler, Float3& result)
+{
+	PathRay path = CameraRay(camera, x, y, width, height, sampler);
+	result = Float3(0, 0, 0);
+	uint rays = 0;
+	for (int i = 0; i < maxBounces; i++)
+	{
+		PathHit hit = Trace(scene, path.ray);
+		rays++;
+		Float3 energy = path.energy;
+		result = result + energy * Shade(scene, path, hit, sampler);
+		if (Terminated(path))
+			break;
+	}
+	return rays;
+}
+
+// ThreadPool::Default(), or a pool of settings.numThreads threads kept for the
+// renders after this one.
+static ThreadPool& RenderPool(const CpuRenderSettings& settings)
+{
+	if (settings.numThreads <= 0 || settings.numThreads == ThreadPool::Default().ThreadCount())
+		return ThreadPool::Default();
+	static std::mutex poolsLock;
+	static std::map<int, std::unique_ptr<ThreadPool>> pools;
+	std::lock_guard<std::mutex> lock(poolsLock);
+	std::unique_ptr<ThreadPool>& pool = pools[settings.numThreads];
+	if (!pool)
+		pool = std::make_unique<ThreadPool>(settings.numThreads);
+	return *pool;
+}
+
+// Every accumulated frame gets a fresh seed in [1000, 2000) like RayTracingApp::Update.
+static std::vector<float> FrameSeeds(const CpuRenderSettings& settings)
+{
+	std::mt19937 seedRng(settings.seed);
+	std::uniform_real_distribution<float> seedDist(1000.0f, 2000.0f);
+	std::vector<float> seeds(settings.samples);
+	for (float& s : seeds)
+		s = seedDist(seedRng);
+	return seeds;
+}
+
+// Frame s draws point s of every pixel's Sobol sequence, or rand() from seeds[s].
+static PixelSampler MakeSampler(const CpuRenderSettings& settings, const std::vector<float>& seeds, int x, int y, int s)
+{
+	PixelSampler sampler = { settings.sampler, { (float)x, (float)y }, seeds[s], (uint)s, PixelSeed(x, y, settings.seed), 0 };
+	return sampler;
+}
+
+CpuRenderStats RenderCpu(const CpuScene& scene, const CpuCamera& camera, const CpuRenderSettings& settings, CpuImage& image)
+{
+	if (settings.wavefront)
+		return RenderCpuWavefront(scene, camera, settings, image);
+
+	int width = image.width;
+	int height = image.height;
+	std::fill(image.pixels.begin(), image.pixels.end(), 0.0f);
+	int tilesX = (width + settings.tileSize - 1) / settings.tileSize;
+	int tilesY = (height + settings.tileSize - 1) / settings.tileSize;
+	int numTiles = tilesX * tilesY;
+	std::vector<float> seeds = FrameSeeds(settings);
+
+	bool adaptive = settings.targetError > 0.0f;
+	uint minSamples = (uint)std::max(settings.minSamples, 2);
+
+	std::atomic<uint64_t> totalRays(0);
+	std::atomic<uint64_t> totalSamples(0);
+	std::atomic<uint64_t> convergedPixels(0);
+	auto renderTiles = [&](int firstTile, int endTile)
+	{
+		uint64_t rays = 0;
+		uint64_t samples = 0;
+		uint64_t converged = 0;
+		for (int tile = firstTile; tile < endTile; tile++)
+		{
+			int x0 = (tile % tilesX) * settings.tileSize;
+			int y0 = (tile / tilesX) * settings.tileSize;
+			int x1 = std::min(x0 + settings.tileSize, width);
+			int y1 = std::min(y0 + settings.tileSize, height);
+			for (int y = y0; y < y1; y++)
+			{
+				for (int x = x0; x < x1; x++)
+				{
+					float* pixel = image.Pixel(x, y);
+					if (adaptive)
+					{
+						PixelEstimator estimator;
+						while (!estimator.Converged(settings.targetError, minSamples, settings.samples))
+						{
+							Float3 result;
+							PixelSampler sampler = MakeSampler(settings, seeds, x, y, estimator.count);
+							rays += ShadePixel(scene, camera, settings.maxBounces, x, y, width, height, sampler, result);
+							estimator.Add(&result.x);
+						}
+						memcpy(pixel, estimator.mean, sizeof(float) * 3);
+						samples += estimator.count;
+						if (estimator.count < (uint)settings.samples)
+							converged++;
+						continue;
+					}
+					for (int s = 0; s < settings.samples; s++)
+					{
+						Float3 result;
+						PixelSampler sampler = MakeSampler(settings, seeds, x, y, s);
+						rays += ShadePixel(scene, camera, settings.maxBounces, x, y, width, height, sampler, result);
+						// Running mean, the accPass blend with alpha 1/NumSamples.
+						float alpha = 1.0f / (s + 1);
+						pixel[0] += (result.x - pixel[0]) * alpha;
+						pixel[1] += (result.y - pixel[1]) * alpha;
+						pixel[2] += (result.z - pixel[2]) * alpha;
+					}
+					samples += settings.samples;
+				}
+			}
+		}
+		totalRays += rays;
+		totalSamples += samples;
+		convergedPixels += converged;
+	};
+
+	auto start = std::chrono::high_resolution_clock::now();
+	RenderPool(settings).ParallelFor(0, numTiles, 1, renderTiles);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	CpuRenderStats stats;
+	stats.rays = totalRays;
+	stats.samples = totalSamples;
+	stats.convergedPixels = convergedPixels;
+	stats.seconds = std::chrono::duration<double>(end - start).count();
+	return stats;
+}
+
+// A path in flight between the stages of the wavefront renderer.
+struct WavefrontPath
+{
+	PathRay path;
+	PixelSampler sampler;
+	Float3 radiance;
+	int x, y;
+	int bounce;
+};
+
+static double SecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+CpuRenderStats RenderCpuWavefront(const CpuScene& scene, const CpuCamera& camera, const CpuRenderSettings& settings, CpuImage& image)
+{
+	int width = image.width;
+	int height = image.height;
+	int numPixels = width * height;
+	std::fill(image.pixels.begin(), image.pixels.end(), 0.0f);
+	ThreadPool& pool = RenderPool(settings);
+	const int grain = 256;		// paths per task of each stage
+	std::vector<float> seeds = FrameSeeds(settings);
+
+	bool adaptive = settings.targetError > 0.0f;
+	uint minSamples = (uint)std::max(settings.minSamples, 2);
+	std::vector<PixelEstimator> estimators(adaptive ? numPixels : 0);
+
+	CpuRenderStats stats;
+	stats.bouncePaths.assign(settings.maxBounces, 0);
+	std::vector<WavefrontPath> queue, next;
+	queue.reserve(numPixels);
+	next.reserve(numPixels);
+	std::vector<PathHit> hits(numPixels);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int s = 0; s < settings.samples; s++)
+	{
+		// Generate: one camera path per pixel that still needs samples.
+		// Converged pixels get a path with bounce -1 that the queue skips.
+		auto stageStart = std::chrono::high_resolution_clock::now();
+		next.resize(numPixels);
+		pool.ParallelFor(0, numPixels, grain, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				WavefrontPath& path = next[i];
+				path.x = i % width;
+				path.y = i / width;
+				path.bounce = -1;
+				if (adaptive && estimators[i].Converged(settings.targetError, minSamples, settings.samples))
+					continue;
+				path.sampler = MakeSampler(settings, seeds, path.x, path.y, s);
+				path.path = CameraRay(camera, path.x, path.y, width, height, path.sampler);
+				path.radiance = Float3(0, 0, 0);
+				path.bounce = 0;
+			}
+		});
+		queue.clear();
+		for (const WavefrontPath& path : next)
+		{
+			if (path.bounce == 0)
+				queue.push_back(path);
+		}
+		stats.generateSeconds += SecondsSince(stageStart);
+		if (queue.empty())
+			break;
+		stats.samples += queue.size();
+
+		for (int bounce = 0; bounce < settings.maxBounces && !queue.empty(); bounce++)
+		{
+			int count = (int)queue.size();
+			stats.bouncePaths[bounce] += count;
+			stats.rays += count;
+
+			// Extend: closest hit of every queued path.
+			stageStart = std::chrono::high_resolution_clock::now();
+			pool.ParallelFor(0, count, grain, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+					hits[i] = Trace(scene, queue[i].path.ray);
+			});
+			stats.extendSeconds += SecondsSince(stageStart);
+
+			// Shade: scatter the paths and retire the ones that are done into their pixel.
+			stageStart = std::chrono::high_resolution_clock::now();
+			pool.ParallelFor(0, count, grain, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					WavefrontPath& p = queue[i];
+					Float3 energy = p.path.energy;
+					p.radiance = p.radiance + energy * Shade(scene, p.path, hits[i], p.sampler);
+					p.bounce++;
+					if (!Terminated(p.path) && p.bounce < settings.maxBounces)
+						continue;
+					if (adaptive)
+						estimators[p.y * width + p.x].Add(&p.radiance.x);
+					else
+					{
+						// Running mean, the accPass blend with alpha 1/NumSamples.
+						float* pixel = image.Pixel(p.x, p.y);
+						float alpha = 1.0f / (s + 1);
+						pixel[0] += (p.radiance.x - pixel[0]) * alpha;
+						pixel[1] += (p.radiance.y - pixel[1]) * alpha;
+						pixel[2] += (p.radiance.z - pixel[2]) * alpha;
+					}
+				}
+			});
+			stats.shadeSeconds += SecondsSince(stageStart);
+
+			// Compact: the surviving paths, in order, form the next bounce's queue.
+			stageStart = std::chrono::high_resolution_clock::now();
+			next.clear();
+			for (const WavefrontPath& p : queue)
+			{
+				if (!Terminated(p.path) && p.bounce < settings.maxBounces)
+					next.push_back(p);
+			}
+			std::swap(queue, next);
+			stats.compactSeconds += SecondsSince(stageStart);
+		}
+	}
+	stats.seconds = SecondsSince(start);
+
+	if (adaptive)
+	{
+		for (int i = 0; i < numPixels; i++)
+		{
+			memcpy(&image.pixels[i * 3], estimators[i].mean, sizeof(float) * 3);
+			if (estimators[i].count < (uint)settings.samples)
+				stats.convergedPixels++;
+		}
+	}
+	return stats;
+}
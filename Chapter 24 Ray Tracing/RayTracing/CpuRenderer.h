@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "CpuTracer.h"
+
+// Multithreaded CPU port of the integrator in Shaders/RayTracing.hlsl (CS, Trace,
+// Shade and their helpers).  It renders into a float image so reference frames
+// can be produced and compared on machines without a D3D12 device.
+
+struct CpuSphere
+{
+	float position[3];
+	float radius;
+	float albedo[3];
+	float specular[3];
+};
+
+// Row-major matrices used with row vectors, i.e. the XMMATRIX values the app
+// copies into RTPassConstants.
+struct CpuCamera
+{
+	float invView[4][4];
+	float invProj[4][4];
+	void LookAt(const float* eye, const float* target, const float* up, float fovY, float aspect);
+};
+
+enum class CpuAccel
+{
+	KDTree,
+	BVH
+};
+
+enum class CpuSampler
+{
+	Hash,	// the shader's rand()
+	Sobol	// USE_SOBOL: Owen-scrambled Sobol points, see Sampler.h
+};
+
+struct CpuScene
+{
+	// KDTREE_TESTING path: a triangle mesh traced through one of the trees.
+	const TraceMesh* mesh = nullptr;
+	CpuAccel accel = CpuAccel::BVH;
+	std::vector<KDNode_GPU> kdNodes;
+	std::vector<BVHNode_GPU> bvhNodes;
+	std::vector<uint> indices;
+	// Default path: spheres over a ground plane.
+	std::vector<CpuSphere> spheres;
+	bool groundPlane = false;
+	// Stand-in for the sky cube map: a vertical gradient.
+	float skyHorizon[3] = { 0.85f, 0.9f, 1.0f };
+	float skyZenith[3] = { 0.3f, 0.5f, 0.9f };
+
+	void BuildAccel();
+	void AddRandomSpheres(int count);
+};
+
+struct CpuImage
+{
+	int width = 0;
+	int height = 0;
+	std::vector<float> pixels;	// rgb, top row first
+	void Resize(int w, int h);
+	float* Pixel(int x, int y) { return &pixels[(y * width + x) * 3]; }
+	const float* Pixel(int x, int y) const { return &pixels[(y * width + x) * 3]; }
+	bool WritePFM(const char* file) const;
+	bool WritePPM(const char* file) const;
+};
+
+// Running mean of a pixel plus the variance of its luminance (Welford), the same
+// estimator the CS keeps in gAccumulation/gMoments under ADAPTIVE_SAMPLING.
+struct PixelEstimator
+{
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	float lumMean = 0.0f;
+	float lumM2 = 0.0f;
+	uint count = 0;
+
+	void Add(const float* rgb);
+	// Standard error of the mean luminance relative to the mean itself.
+	float RelativeError() const;
+	bool Converged(float targetError, uint minSamples, uint maxSamples) const;
+};
+
+struct CpuRenderSettings
+{
+	int samples = 1;		// frames accumulated like the accPass blend
+	int maxBounces = 8;
+	int tileSize = 16;
+	int numThreads = 0;		// 0 uses every hardware thread
+	uint seed = 1;
+	CpuSampler sampler = CpuSampler::Sobol;
+	// Adaptive sampling: with targetError > 0 a pixel stops once its relative error
+	// drops below it, after at least minSamples and at most samples frames.
+	float targetError = 0.0f;
+	int minSamples = 16;
+	// Render frame by frame through generate/extend/shade/compact stages like the
+	// app's wavefront mode instead of running every path to completion per pixel.
+	bool wavefront = false;
+};
+
+struct CpuRenderStats
+{
+	uint64_t rays = 0;
+	uint64_t samples = 0;
+	uint64_t convergedPixels = 0;
+	double seconds = 0.0;
+	// Wavefront mode only: time per stage and the paths traced at every bounce.
+	double generateSeconds = 0.0;
+	double extendSeconds = 0.0;
+	double shadeSeconds = 0.0;
+	double compactSeconds = 0.0;
+	std::vector<uint64_t> bouncePaths;
+	double RaysPerSecond() const { return seconds > 0.0 ? rays / seconds : 0.0; }
+};
+
+CpuRenderStats RenderCpu(const CpuScene& scene, const CpuCamera& camera, const CpuRenderSettings& settings, CpuImage& image);
+CpuRenderStats RenderCpuWavefront(const CpuScene& scene, const CpuCamera& camera, const CpuRenderSettings& settings, CpuImage& image);
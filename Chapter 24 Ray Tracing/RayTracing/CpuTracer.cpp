@@ -0,0 +1,400 @@
+#include "CpuTracer.h"
+#include "../../Common/MeshFile.h"
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+static const float EPSILON = 1e-8f;
+
+static inline float Dot(const float* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline void Cross(const float* a, const float* b, float* out)
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+bool LoadTraceMesh(const char* file, TraceMesh& mesh)
+{
+	MeshFile meshFile;
+	if (!meshFile.OpenModel(file))
+		return false;
+	mesh.positions.assign(meshFile.Positions(), meshFile.Positions() + meshFile.VertexCount() * 3);
+	mesh.normals.assign(meshFile.Normals(), meshFile.Normals() + meshFile.VertexCount() * 3);
+	mesh.indices.assign(meshFile.Indices(), meshFile.Indices() + meshFile.IndexCount());
+	return true;
+}
+
+bool LoadTraceMeshText(const char* file, TraceMesh& mesh)
+{
+	TextMeshData text;
+	if (!LoadTextMesh(file, text))
+		return false;
+	mesh.positions = std::move(text.Positions);
+	mesh.normals = std::move(text.Normals);
+	mesh.indices = std::move(text.Indices32);
+	return true;
+}
+
+BBox TraceMesh::Bounds() const
+{
+	BBox box;
+	for (int d = 0; d < 3; d++)
+	{
+		box.min[d] = positions.empty() ? 0.0f : std::numeric_limits<float>::max();
+		box.max[d] = positions.empty() ? 0.0f : -std::numeric_limits<float>::max();
+	}
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		box.min[i % 3] = std::min(box.min[i % 3], positions[i]);
+		box.max[i % 3] = std::max(box.max[i % 3], positions[i]);
+	}
+	return box;
+}
+
+bool IntersectTriangle_MT97(const CpuRay& ray, const float* vert0, const float* vert1, const float* vert2, float& t, float& u, float& v)
+{
+	float edge1[3] = { vert1[0] - vert0[0], vert1[1] - vert0[1], vert1[2] - vert0[2] };
+	float edge2[3] = { vert2[0] - vert0[0], vert2[1] - vert0[1], vert2[2] - vert0[2] };
+	float pvec[3];
+	Cross(ray.direction, edge2, pvec);
+	float det = Dot(edge1, pvec);
+	// use backface culling
+	if (det < EPSILON)
+		return false;
+	float inv_det = 1.0f / det;
+	float tvec[3] = { ray.origin[0] - vert0[0], ray.origin[1] - vert0[1], ray.origin[2] - vert0[2] };
+	u = Dot(tvec, pvec) * inv_det;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	float qvec[3];
+	Cross(tvec, edge1, qvec);
+	v = Dot(ray.direction, qvec) * inv_det;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	t = Dot(edge2, qvec) * inv_det;
+	return true;
+}
+
+bool IntersectBox(const BBox& box, const CpuRay& ray, float& tmin, float& tmax)
+{
+	tmin = -std::numeric_limits<float>::infinity();
+	tmax = std::numeric_limits<float>::infinity();
+	for (int i = 0; i < 3; i++)
+	{
+		float invDir = 1.0f / ray.direction[i];
+		float t0 = (box.min[i] - ray.origin[i]) * invDir;
+		float t1 = (box.max[i] - ray.origin[i]) * invDir;
+		if (t0 > t1)
+			std::swap(t0, t1);
+		tmin = std::max(tmin, t0);
+		tmax = std::min(tmax, t1);
+	}
+	return tmin <= tmax;
+}
+
+static inline void IntersectLeaf(const TraceMesh& mesh, const std::vector<uint>& indices, uint start, uint count,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+{
+	for (uint j = 0; j < count; j++)
+	{
+		uint tri = indices[start + j];
+		float t, u, v;
+		if (IntersectTriangle_MT97(ray, mesh.Position(tri, 0), mesh.Position(tri, 1), mesh.Position(tri, 2), t, u, v) && t > 0 && t < hit.distance)
+		{
+			hit.distance = t;
+			hit.triangle = tri;
+			hit.u = u;
+			hit.v = v;
+		}
+	}
+	if (counters)
+		counters->trianglesTested += count;
+}
+
+void TraceKDTree(const TraceMesh& mesh, const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+{
+	uint visited = 0;
+	float entry, exit;
+	if (!nodes.empty() && IntersectBox(nodes[0].box, ray, entry, exit) && exit > 0)
+	{
+		entry = std::max(entry, 0.0f);
+		uint index = 0;
+		// Every step moves to a leaf further along the ray; the bound only guards
+		// against precision problems on degenerate boxes.
+		for (size_t steps = 0; index != KD_NO_ROPE && steps < nodes.size(); steps++)
+		{
+			float p[3];
+			for (int i = 0; i < 3; i++)
+				p[i] = ray.origin[i] + ray.direction[i] * entry;
+			while (nodes[index].axis < 3)
+			{
+				const KDNode_GPU& node = nodes[index];
+				float pos = p[node.axis];
+				bool goLeft = pos < node.split || (pos == node.split && ray.direction[node.axis] <= 0.0f);
+				index = goLeft ? node.left : node.right;
+				visited++;
+			}
+			const KDNode_GPU& leaf = nodes[index];
+			visited++;
+			IntersectLeaf(mesh, indices, leaf.start, leaf.count, ray, hit, counters);
+			float leafExit = std::numeric_limits<float>::infinity();
+			int face = 0;
+			for (int i = 0; i < 3; i++)
+			{
+				if (ray.direction[i] == 0.0f)
+					continue;
+				bool positive = ray.direction[i] > 0.0f;
+				float t = ((positive ? leaf.box.max[i] : leaf.box.min[i]) - ray.origin[i]) / ray.direction[i];
+				if (t < leafExit)
+				{
+					leafExit = t;
+					face = i * 2 + (positive ? 1 : 0);
+				}
+			}
+			if (hit.distance <= leafExit)
+				break;
+			index = leaf.ropes[face];
+			entry = std::max(entry, leafExit);
+		}
+	}
+	if (counters)
+	{
+		counters->rays++;
+		counters->nodesVisited += visited;
+	}
+}
+
+void TraceKDTreeBreadthFirst(const TraceMesh& mesh, const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+{
+	uint NumNodes = 0;
+	uint Nodes[256];
+	Nodes[NumNodes++] = 0;
+	for (uint i = 0; i < NumNodes; i++)
+	{
+		const KDNode_GPU& node = nodes[Nodes[i]];
+		if (node.axis == 3)
+			IntersectLeaf(mesh, indices, node.start, node.count, ray, hit, counters);
+		else
+		{
+			float tmin, tmax;
+			uint children[2] = { node.left, node.right };
+			for (uint child : children)
+			{
+				if (!IntersectBox(nodes[child].box, ray, tmin, tmax))
+					continue;
+				if (NumNodes < 256)
+					Nodes[NumNodes++] = child;
+				else if (counters)
+					counters->stackOverflows++;
+			}
+		}
+	}
+	if (counters)
+	{
+		counters->rays++;
+		counters->nodesVisited += NumNodes;
+	}
+}
+
+// Shared by both BVH encodings and the top level of TraceInstances; Access decodes
+// a node into its box and link, Leaf intersects the primitives of a leaf.
+template<typename Node, typename Access, typename Leaf>
+static void TraceBVHNodes(const std::vector<Node>& nodes, const CpuRay& ray, CpuHit& hit, TraceCounters* counters,
+	const Access& access, const Leaf& leaf)
+{
+	uint stack[BVH_MAX_STACK_SIZE];
+	float stackEntry[BVH_MAX_STACK_SIZE];
+	uint stackSize = 0;
+	uint visited = 0;
+	float tmin, tmax;
+	BBox box;
+	if (!nodes.empty() && (access.GetBox(nodes[0], box), IntersectBox(box, ray, tmin, tmax)) && tmax > 0)
+	{
+		stack[stackSize] = 0;
+		stackEntry[stackSize++] = tmin;
+	}
+	while (stackSize > 0)
+	{
+		stackSize--;
+		// Skip nodes that were pushed before a closer hit was found.
+		if (stackEntry[stackSize] >= hit.distance)
+			continue;
+		uint index = stack[stackSize];
+		const Node& node = nodes[index];
+		visited++;
+		uint offset, count;
+		access.GetLink(node, offset, count);
+		if (count > 0)
+		{
+			leaf(offset, count);
+			continue;
+		}
+		uint children[2] = { index + 1, offset };
+		float entry[2];
+		bool hits[2];
+		for (int c = 0; c < 2; c++)
+		{
+			access.GetBox(nodes[children[c]], box);
+			hits[c] = IntersectBox(box, ray, entry[c], tmax) && tmax > 0 && entry[c] < hit.distance;
+		}
+		// Push the far child first so the near one is visited next.
+		int nearChild = (hits[0] && hits[1] && entry[1] < entry[0]) ? 1 : 0;
+		for (int c = 0; c < 2; c++)
+		{
+			int k = c == 0 ? 1 - nearChild : nearChild;
+			if (!hits[k])
+				continue;
+			// BVH::Build limits the depth so this cannot fill, and cached trees are
+			// checked with BVH::StackSize before use.
+			assert(stackSize < BVH_MAX_STACK_SIZE);
+			stack[stackSize] = children[k];
+			stackEntry[stackSize++] = entry[k];
+		}
+	}
+	if (counters)
+	{
+		counters->rays++;
+		counters->nodesVisited += visited;
+	}
+}
+
+struct BVHAccess
+{
+	void GetBox(const BVHNode_GPU& node, BBox& box) const { box = node.box; }
+	void GetLink(const BVHNode_GPU& node, uint& offset, uint& count) const
+	{
+		offset = node.offset;
+		count = node.count;
+	}
+};
+
+struct BVHCompactAccess
+{
+	const BVHQuantization& quantization;
+	void GetBox(const BVHNodeCompact& node, BBox& box) const { quantization.Decode(node, box); }
+	void GetLink(const BVHNodeCompact& node, uint& offset, uint& count) const
+	{
+		bool leaf = (node.link & 1) != 0;
+		offset = leaf ? node.link >> 8 : node.link >> 1;
+		count = leaf ? (node.link >> 1) & 127 : 0;
+	}
+};
+
+void TraceBVH(const TraceMesh& mesh, const std::vector<BVHNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+{
+	TraceBVHNodes(nodes, ray, hit, counters, BVHAccess(),
+		[&](uint offset, uint count) { IntersectLeaf(mesh, indices, offset, count, ray, hit, counters); });
+}
+
+void TraceBVHCompact(const TraceMesh& mesh, const std::vector<BVHNodeCompact>& nodes, const BVHQuantization& quantization,
+	const std::vector<uint>& indices, const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+{
+	TraceBVHNodes(nodes, ray, hit, counters, BVHCompactAccess{ quantization },
+		[&](uint offset, uint count) { IntersectLeaf(mesh, indices, offset, count, ray, hit, counters); });
+}
+
+void TraceBLAS::Build()
+{
+	BVH bvh(mesh->TriangleCount());
+	for (uint i = 0; i < mesh->TriangleCount(); i++)
+		bvh.AddTriangle((int)i, const_cast<float*>(mesh->Position(i, 0)), const_cast<float*>(mesh->Position(i, 1)), const_cast<float*>(mesh->Position(i, 2)));
+	bvh.Build(nodes, indices);
+}
+
+void TraceInstances(const InstanceBVH& top, const std::vector<TraceBLAS>& blases,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+{
+	uint64_t rays = counters ? counters->rays : 0;
+	TraceBVHNodes(top.nodes, ray, hit, counters, BVHAccess(), [&](uint offset, uint count)
+	{
+		for (uint k = offset; k < offset + count; k++)
+		{
+			const TraceInstance& instance = top.instances[k];
+			const float (*m)[4] = instance.invWorld;
+			CpuRay local;
+			for (int j = 0; j < 3; j++)
+			{
+				local.origin[j] = ray.origin[0] * m[0][j] + ray.origin[1] * m[1][j] + ray.origin[2] * m[2][j] + m[3][j];
+				local.direction[j] = ray.direction[0] * m[0][j] + ray.direction[1] * m[1][j] + ray.direction[2] * m[2][j];
+			}
+			const TraceBLAS& blas = blases[instance.blas];
+			float closest = hit.distance;
+			TraceBVH(*blas.mesh, blas.nodes, blas.indices, local, hit, counters);
+			if (hit.distance < closest)
+				hit.instance = instance.id;
+		}
+	});
+	// Count the bottom-level walks as part of this ray.
+	if (counters)
+		counters->rays = rays + 1;
+}
+
+void TraceKDTreeCompact(const TraceMesh& mesh, const std::vector<KDNodeCompact>& nodes, const BBox& bounds,
+	const std::vector<uint>& indices, const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+{
+	struct Entry
+	{
+		uint node;
+		float tmin, tmax;
+	};
+	Entry stack[KD_MAX_STACK_SIZE];
+	uint stackSize = 0;
+	uint visited = 0;
+	float tmin, tmax;
+	if (!nodes.empty() && IntersectBox(bounds, ray, tmin, tmax) && tmax > 0)
+	{
+		tmin = std::max(tmin, 0.0f);
+		uint index = 0;
+		for (;;)
+		{
+			// Descend towards the near side, deferring the far child when the
+			// ray crosses the split plane inside [tmin, tmax].
+			while ((nodes[index].data & 3) != 3)
+			{
+				const KDNodeCompact& node = nodes[index];
+				int axis = node.data & 3;
+				visited++;
+				float o = ray.origin[axis];
+				float d = ray.direction[axis];
+				bool leftFirst = o < node.split || (o == node.split && d <= 0.0f);
+				uint nearChild = leftFirst ? index + 1 : node.data >> 2;
+				uint farChild = leftFirst ? node.data >> 2 : index + 1;
+				float t = d != 0.0f ? (node.split - o) / d : -1.0f;
+				if (t > tmax || t <= 0.0f)
+					index = nearChild;
+				else if (t < tmin)
+					index = farChild;
+				else
+				{
+					// At most one entry per level, and KDTree::Build limits the depth.
+					assert(stackSize < KD_MAX_STACK_SIZE);
+					stack[stackSize++] = { farChild, t, tmax };
+					index = nearChild;
+					tmax = t;
+				}
+			}
+			visited++;
+			uint range = nodes[index].range;
+			IntersectLeaf(mesh, indices, range >> 8, range & 255, ray, hit, counters);
+			if (hit.distance <= tmax || stackSize == 0)
+				break;
+			Entry& entry = stack[--stackSize];
+			index = entry.node;
+			tmin = entry.tmin;
+			tmax = entry.tmax;
+		}
+	}
+	if (counters)
+	{
+		counters->rays++;
+		counters->nodesVisited += visited;
+	}
+}
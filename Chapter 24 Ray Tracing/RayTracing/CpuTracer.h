@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include "KDTree.h"
+#include "BVH.h"
+#include "InstanceBVH.h"
+
+// CPU versions of the scene queries in Shaders/RayTracing.hlsl, used to validate
+// and benchmark the acceleration structures without a D3D12 device.
+
+struct TraceMesh
+{
+	std::vector<float> positions;	// xyz per vertex
+	std::vector<float> normals;		// xyz per vertex
+	std::vector<uint> indices;		// three per triangle
+	uint TriangleCount() const { return (uint)indices.size() / 3; }
+	const float* Position(uint triangle, int corner) const { return &positions[indices[triangle * 3 + corner] * 3]; }
+	BBox Bounds() const;
+};
+
+struct CpuRay
+{
+	float origin[3];
+	float direction[3];
+};
+
+struct CpuHit
+{
+	float distance = std::numeric_limits<float>::infinity();
+	uint triangle = 0xFFFFFFFF;
+	float u = 0.0f;
+	float v = 0.0f;
+	uint instance = 0xFFFFFFFF;	// TraceInstance::id of two-level traces
+};
+
+struct TraceCounters
+{
+	uint64_t rays = 0;
+	uint64_t nodesVisited = 0;
+	uint64_t trianglesTested = 0;
+	uint64_t stackOverflows = 0;
+	uint64_t packetFallbacks = 0;	// lanes finished with single-ray traversal
+};
+
+// Loads a Models/*.txt model through its converted .mesh file (see MeshFile.h).
+bool LoadTraceMesh(const char* file, TraceMesh& mesh);
+// Parses the "VertexCount:/TriangleCount:" text format directly.
+bool LoadTraceMeshText(const char* file, TraceMesh& mesh);
+
+bool IntersectTriangle_MT97(const CpuRay& ray, const float* vert0, const float* vert1, const float* vert2, float& t, float& u, float& v);
+// Slab test; returns the parametric interval of the ray inside the box.
+bool IntersectBox(const BBox& box, const CpuRay& ray, float& tmin, float& tmax);
+
+// Stackless rope traversal over KDNode_GPU, the same walk as TraceKDTree() in
+// RayTracing.hlsl: descend to the leaf holding the current entry point, test it,
+// and leave through the exit face's rope until a hit lies inside the leaf.
+void TraceKDTree(const TraceMesh& mesh, const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters = nullptr);
+// The breadth-first walk the shader used before ropes, with its 256 entry node
+// list (overflowing entries are dropped and counted).  Kept for comparison.
+void TraceKDTreeBreadthFirst(const TraceMesh& mesh, const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters = nullptr);
+// Ordered depth-first walk over BVHNode_GPU that culls nodes behind the closest hit.
+void TraceBVH(const TraceMesh& mesh, const std::vector<BVHNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters = nullptr);
+// Traversals of the compact encodings, expected to return the same hits as the
+// full-size ones.  The kd-tree walk is a front-to-back stack traversal that needs
+// only the split planes and the scene bounds.
+void TraceKDTreeCompact(const TraceMesh& mesh, const std::vector<KDNodeCompact>& nodes, const BBox& bounds,
+	const std::vector<uint>& indices, const CpuRay& ray, CpuHit& hit, TraceCounters* counters = nullptr);
+void TraceBVHCompact(const TraceMesh& mesh, const std::vector<BVHNodeCompact>& nodes, const BVHQuantization& quantization,
+	const std::vector<uint>& indices, const CpuRay& ray, CpuHit& hit, TraceCounters* counters = nullptr);
+
+// A mesh and its bottom-level tree for TraceInstances.
+struct TraceBLAS
+{
+	const TraceMesh* mesh = nullptr;
+	std::vector<BVHNode_GPU> nodes;
+	std::vector<uint> indices;
+	void Build();
+};
+
+// Walks the top-level tree and traces each instance it reaches in object space,
+// transforming the ray like PickingApp::Pick but without renormalizing it, so hit
+// distances stay in world units and compare across instances.
+void TraceInstances(const InstanceBVH& top, const std::vector<TraceBLAS>& blases,
+	const CpuRay& ray, CpuHit& hit, TraceCounters* counters = nullptr);
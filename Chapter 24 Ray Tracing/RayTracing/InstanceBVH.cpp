@@ -0,0 +1,64 @@
+#include "InstanceBVH.h"
+#include <algorithm>
+#include <cstring>
+
+// Inverse of a matrix with (0,0,0,1) as its last column.
+static void InvertAffine(const float m[4][4], float inv[4][4])
+{
+	float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+		- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+		+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+	inv[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+	inv[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+	inv[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+	inv[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * invDet;
+	inv[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+	inv[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+	inv[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+	inv[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+	inv[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+	for (int j = 0; j < 3; j++)
+	{
+		inv[3][j] = -(m[3][0] * inv[0][j] + m[3][1] * inv[1][j] + m[3][2] * inv[2][j]);
+		inv[j][3] = 0.0f;
+	}
+	inv[3][3] = 1.0f;
+}
+
+void InstanceBVH::AddInstance(const float* world, uint blas, const BBox& objectBounds)
+{
+	TraceInstance instance;
+	memcpy(instance.world, world, sizeof(instance.world));
+	InvertAffine(instance.world, instance.invWorld);
+	instance.blas = blas;
+	instance.id = (uint)instances.size();
+	// Transformed box extents, one matrix entry at a time (Arvo).
+	for (int j = 0; j < 3; j++)
+	{
+		instance.bounds.min[j] = instance.bounds.max[j] = instance.world[3][j];
+		for (int i = 0; i < 3; i++)
+		{
+			float a = instance.world[i][j] * objectBounds.min[i];
+			float b = instance.world[i][j] * objectBounds.max[i];
+			instance.bounds.min[j] += std::min(a, b);
+			instance.bounds.max[j] += std::max(a, b);
+		}
+	}
+	instances.push_back(instance);
+}
+
+void InstanceBVH::Build()
+{
+	BVH top(instances.size());
+	for (size_t i = 0; i < instances.size(); i++)
+		top.triangleBoxes[i] = instances[i].bounds;
+	top.intersectionCost = instanceCost;
+	top.maxLeafSize = maxLeafSize;
+	std::vector<uint> order;
+	top.Build(nodes, order);
+	std::vector<TraceInstance> sorted(instances.size());
+	for (size_t i = 0; i < order.size(); i++)
+		sorted[i] = instances[order[i]];
+	instances.swap(sorted);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "BVH.h"
+
+// Placement of a bottom-level tree in the world.  Matrices are row-major and act
+// on row vectors like XMFLOAT4X4: a world point is the object point times world.
+struct TraceInstance
+{
+	float world[4][4];
+	float invWorld[4][4];
+	uint blas;		// bottom-level tree, shared by every instance of the same mesh
+	uint id;		// order of AddInstance; Build reorders the instances
+	BBox bounds;	// world space
+};
+
+// Top level of a two-level structure: a BVH over the world boxes of the instances.
+// Rays reaching a leaf are moved into object space and traced through the
+// instance's bottom-level tree, so the geometry of a mesh is stored only once.
+struct InstanceBVH
+{
+	void AddInstance(const float* world, uint blas, const BBox& objectBounds);
+	// Sorts the instances so every leaf covers a contiguous range of them.
+	void Build();
+	std::vector<TraceInstance> instances;
+	std::vector<BVHNode_GPU> nodes;
+
+	float instanceCost = 4.0f;	// a bottom-level traversal relative to a box test
+	uint maxLeafSize = 4;
+};
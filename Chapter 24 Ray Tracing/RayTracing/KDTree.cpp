@@ -1,55 +1,174 @@
 #include "KDTree.h"
+#include <algorithm>
+#include <future>
+#include <thread>
 
-void KDNode::Split()
+void KDNode::Split(int depth)
 {
-	if (triangles.size() <= 64)
+	int axis;
+	float split;
+	if (numTriangles == 0 || depth >= tree->depthLimit)
 		return;
-	std::vector<uint> leftTris[3];
-	std::vector<uint> rightTris[3];
-	int MinSum = 0x7FFFFFFF;
-	int Best = -1;
-	for (int i = 0; i < 3; i++)
+	bool found = tree->splitMethod == KDSplitMethod::SAH ? FindSAHSplit(axis, split) : FindMidpointSplit(axis, split);
+	if (!found)
+		return;
+	Partition(axis, split);
+	// Subtrees are independent, so large ones are handed to another thread while
+	// this one carries on with the left child.
+	if (right->numTriangles >= tree->parallelThreshold && tree->AcquireThread())
 	{
-		SplitForDimension(i, leftTris[i], rightTris[i]);
-		int Sum = leftTris[i].size() + rightTris[i].size();
-		if (MinSum > Sum)
-		{
-			MinSum = Sum;
-			Best = i;
-		}
+		auto task = std::async(std::launch::async, [this, depth]() { right->Split(depth + 1); });
+		left->Split(depth + 1);
+		task.get();
+		tree->ReleaseThread();
 	}
-	if (leftTris[Best].size() < triangles.size() && rightTris[Best].size() < triangles.size())
+	else
 	{
-		float center[3];
-		bbox.GetCenter(center);
-		left = std::make_unique<KDNode>(tree);
-		left->bbox = bbox;
-		left->bbox.max[Best] = center[Best];
-		left->triangles = leftTris[Best];
-		left->Split();
-
-		right = std::make_unique<KDNode>(tree);
-		right->bbox = bbox;
-		right->bbox.min[Best] = center[Best];
-		right->triangles = rightTris[Best];
-		right->Split();
+		left->Split(depth + 1);
+		right->Split(depth + 1);
 	}
 }
 
-void KDNode::SplitForDimension(int d, std::vector<uint>& left, std::vector<uint>& right)
+// Returns 1 if the part of the triangle inside the node reaches the left side of
+// the plane, 2 for the right side and 3 for both.
+int KDNode::Classify(uint triangle, int axis, float split) const
+{
+	const BBox& box = tree->triangleBoxes[triangle];
+	float lo = std::max(box.min[axis], bbox.min[axis]);
+	float hi = std::min(box.max[axis], bbox.max[axis]);
+	// Triangles lying in the split plane go to the left side only.
+	int side = 0;
+	if (lo < split || (lo == split && hi == split))
+		side |= 1;
+	if (hi > split)
+		side |= 2;
+	return side;
+}
+
+bool KDNode::FindMidpointSplit(int& axis, float& position)
 {
+	if (numTriangles <= tree->maxLeafSize)
+		return false;
 	float center[3];
 	bbox.GetCenter(center);
-	BBox leftBox = bbox;
-	BBox rightBox = bbox;
-	leftBox.max[d] = rightBox.min[d] = center[d];
-	for (int i = 0; i < triangles.size(); i++)
+	uint MinSum = 0xFFFFFFFF;
+	axis = -1;
+	for (int d = 0; d < 3; d++)
 	{
-		BBox& box = tree->triangleBoxes[triangles[i]];
-		if (leftBox.Intersect(box))
-			left.push_back(triangles[i]);
-		if (rightBox.Intersect(box))
-			right.push_back(triangles[i]);
+		uint numLeft = 0;
+		uint numRight = 0;
+		for (uint i = 0; i < numTriangles; i++)
+		{
+			int side = Classify(triangles[i], d, center[d]);
+			numLeft += side & 1;
+			numRight += side >> 1;
+		}
+		if (numLeft < numTriangles && numRight < numTriangles && numLeft + numRight < MinSum)
+		{
+			MinSum = numLeft + numRight;
+			axis = d;
+			position = center[d];
+		}
+	}
+	return axis >= 0;
+}
+
+// Bins the triangle extents (clipped to the node) along every axis and evaluates
+// the SAH at each bin boundary.  Returns false when no split beats making a leaf.
+bool KDNode::FindSAHSplit(int& axis, float& position)
+{
+	const int numBins = tree->binCount;
+	const float count = (float)numTriangles;
+	const float area = bbox.SurfaceArea();
+	if (area <= 0.0f)
+		return false;
+	float bestCost = tree->intersectionCost * count;
+	axis = -1;
+	std::vector<uint> minBins(numBins);
+	std::vector<uint> maxBins(numBins);
+	for (int d = 0; d < 3; d++)
+	{
+		float extent = bbox.max[d] - bbox.min[d];
+		if (extent <= 0.0f)
+			continue;
+		std::fill(minBins.begin(), minBins.end(), 0);
+		std::fill(maxBins.begin(), maxBins.end(), 0);
+		float scale = numBins / extent;
+		for (uint i = 0; i < numTriangles; i++)
+		{
+			const BBox& box = tree->triangleBoxes[triangles[i]];
+			float lo = std::max(box.min[d], bbox.min[d]);
+			float hi = std::min(box.max[d], bbox.max[d]);
+			int b0 = std::min(std::max((int)((lo - bbox.min[d]) * scale), 0), numBins - 1);
+			int b1 = std::min(std::max((int)((hi - bbox.min[d]) * scale), 0), numBins - 1);
+			minBins[b0]++;
+			maxBins[b1]++;
+		}
+		uint numLeft = 0;
+		uint numRight = numTriangles;
+		for (int b = 1; b < numBins; b++)
+		{
+			numLeft += minBins[b - 1];
+			numRight -= maxBins[b - 1];
+			float split = bbox.min[d] + extent * b / numBins;
+			BBox leftBox = bbox;
+			BBox rightBox = bbox;
+			leftBox.max[d] = rightBox.min[d] = split;
+			float cost = tree->traversalCost + tree->intersectionCost *
+				(leftBox.SurfaceArea() * numLeft + rightBox.SurfaceArea() * numRight) / area;
+			if (numLeft == 0 || numRight == 0)
+				cost *= 1.0f - tree->emptyBonus;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				axis = d;
+				position = split;
+			}
+		}
+	}
+	return axis >= 0;
+}
+
+// Reorders the node's references into [left only | both | right only] and hands
+// the children overlapping ranges.  When references are duplicated the smaller
+// child copies its range so the two subtrees can be split independently.
+void KDNode::Partition(int axis, float split)
+{
+	uint lo = 0;
+	uint mid = 0;
+	uint hi = numTriangles;
+	while (mid < hi)
+	{
+		int side = Classify(triangles[mid], axis, split);
+		if (side == 1)
+			std::swap(triangles[lo++], triangles[mid++]);
+		else if (side == 3)
+			mid++;
+		else
+			std::swap(triangles[mid], triangles[--hi]);
+	}
+	uint numLeft = hi;
+	uint numRight = numTriangles - lo;
+	this->axis = axis;
+	this->split = split;
+
+	left = std::make_unique<KDNode>(tree);
+	left->bbox = bbox;
+	left->bbox.max[axis] = split;
+	left->triangles = triangles;
+	left->numTriangles = numLeft;
+
+	right = std::make_unique<KDNode>(tree);
+	right->bbox = bbox;
+	right->bbox.min[axis] = split;
+	right->triangles = triangles + lo;
+	right->numTriangles = numRight;
+
+	if (hi > lo)
+	{
+		KDNode* child = numLeft < numRight ? left.get() : right.get();
+		child->storage.assign(child->triangles, child->triangles + child->numTriangles);
+		child->triangles = child->storage.data();
 	}
 }
 
@@ -65,44 +184,190 @@ void KDTree::AddTriangle(int index, float* v0, float* v1, float* v2)
 
 void KDTree::Build(std::vector<KDNode_GPU>& nodes, std::vector<uint>& indices)
 {
+	depthLimit = maxDepth > 0 ? maxDepth : (int)(8 + 1.3f * std::log2((float)std::max<size_t>(triangleBoxes.size(), 1)));
+	depthLimit = std::min(depthLimit, (int)KD_MAX_STACK_SIZE - 1);
+	int threads = numThreads > 0 ? numThreads : (int)std::thread::hardware_concurrency();
+	freeThreads = std::max(threads, 1) - 1;
 	root = std::make_unique<KDNode>(this);
-	root->triangles.push_back(0);
+	root->storage.resize(triangleBoxes.size());
 	root->bbox = triangleBoxes[0];
-	for (int i = 1; i < triangleBoxes.size(); i++)
+	for (uint i = 0; i < triangleBoxes.size(); i++)
 	{
-		root->triangles.push_back(i);
+		root->storage[i] = i;
 		root->bbox.Join(triangleBoxes[i]);
 	}
-	root->Split();
-	std::vector<KDNode*> tmpNodes;
-	tmpNodes.push_back(root.get());
-	for (int i = 0; i < tmpNodes.size(); i++)
+	root->triangles = root->storage.data();
+	root->numTriangles = (uint)root->storage.size();
+	root->Split(0);
+	std::vector<std::pair<KDNode*, uint>> stack;
+	stack.push_back(std::make_pair(root.get(), KD_NO_ROPE));
+	while (!stack.empty())
 	{
+		KDNode* node = stack.back().first;
+		uint parent = stack.back().second;
+		stack.pop_back();
+		uint index = (uint)nodes.size();
+		if (parent != KD_NO_ROPE)
+		{
+			if (nodes[parent].left == 0)
+				nodes[parent].left = index;
+			else
+				nodes[parent].right = index;
+		}
 		KDNode_GPU gpu;
-		KDNode* node = tmpNodes[i];
 		gpu.box = node->bbox;
+		gpu.left = 0;
+		gpu.right = 0;
+		std::fill(gpu.ropes, gpu.ropes + 6, KD_NO_ROPE);
 		if (node->left.get() || node->right.get())
 		{
-			BBox leftBox = node->left->bbox;
-			BBox rightBox = node->right->bbox;
-
-
 			gpu.start = 0;
 			gpu.count = 0;
-			gpu.left = tmpNodes.size();
-			tmpNodes.push_back(node->left.get());
-			gpu.right = tmpNodes.size();
-			tmpNodes.push_back(node->right.get());
+			gpu.axis = node->axis;
+			gpu.split = node->split;
+			stack.push_back(std::make_pair(node->right.get(), index));
+			stack.push_back(std::make_pair(node->left.get(), index));
 		}
 		else
 		{
 			gpu.start = indices.size();
-			gpu.count = node->triangles.size();
-			gpu.left = 0;
-			gpu.right = 0;
-			for (int j = 0; j < node->triangles.size(); j++)
-				indices.push_back(node->triangles[j]);
+			gpu.count = node->numTriangles;
+			gpu.axis = 3;
+			gpu.split = 0.0f;
+			indices.insert(indices.end(), node->triangles, node->triangles + node->numTriangles);
 		}
 		nodes.push_back(gpu);
 	}
-}
\ No newline at end of file
+	uint ropes[6] = { KD_NO_ROPE, KD_NO_ROPE, KD_NO_ROPE, KD_NO_ROPE, KD_NO_ROPE, KD_NO_ROPE };
+	BuildRopes(nodes, 0, ropes);
+}
+
+bool KDTree::Build(std::vector<KDNode_GPU>& nodes, std::vector<uint>& indices, std::vector<KDNodeCompact>& compact)
+{
+	Build(nodes, indices);
+	return Compact(nodes, compact);
+}
+
+bool KDTree::Compact(const std::vector<KDNode_GPU>& nodes, std::vector<KDNodeCompact>& compact)
+{
+	compact.resize(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		const KDNode_GPU& node = nodes[i];
+		if (node.axis == 3)
+		{
+			if (node.count > KD_COMPACT_MAX_LEAF || node.start >= (1u << 24))
+				return false;
+			compact[i].data = 3;
+			compact[i].range = node.start << 8 | node.count;
+		}
+		else
+		{
+			if (node.left != i + 1 || node.right >= (1u << 30))
+				return false;
+			compact[i].data = node.right << 2 | node.axis;
+			compact[i].split = node.split;
+		}
+	}
+	return true;
+}
+
+// Walks a rope down the neighbouring subtree as long as a single child still covers
+// the face of the leaf, so traversal has less to descend after following it.
+static uint OptimizeRope(const std::vector<KDNode_GPU>& nodes, uint rope, int face, const BBox& box)
+{
+	uint faceAxis = face / 2;
+	while (rope != KD_NO_ROPE && nodes[rope].axis < 3)
+	{
+		const KDNode_GPU& node = nodes[rope];
+		if (node.axis == faceAxis)
+			rope = (face & 1) ? node.left : node.right;
+		else if (node.split <= box.min[node.axis])
+			rope = node.right;
+		else if (node.split >= box.max[node.axis])
+			rope = node.left;
+		else
+			break;
+	}
+	return rope;
+}
+
+void KDTree::BuildRopes(std::vector<KDNode_GPU>& nodes, uint index, const uint* ropes) const
+{
+	KDNode_GPU& node = nodes[index];
+	if (node.axis == 3)
+	{
+		for (int face = 0; face < 6; face++)
+			node.ropes[face] = OptimizeRope(nodes, ropes[face], face, node.box);
+		return;
+	}
+	uint left = node.left;
+	uint right = node.right;
+	uint childRopes[6];
+	std::copy(ropes, ropes + 6, childRopes);
+	childRopes[node.axis * 2 + 1] = right;
+	BuildRopes(nodes, left, childRopes);
+	std::copy(ropes, ropes + 6, childRopes);
+	childRopes[node.axis * 2] = left;
+	BuildRopes(nodes, right, childRopes);
+}
+
+bool KDTree::AcquireThread()
+{
+	int n = freeThreads.load();
+	while (n > 0)
+	{
+		if (freeThreads.compare_exchange_weak(n, n - 1))
+			return true;
+	}
+	return false;
+}
+
+void KDTree::ReleaseThread()
+{
+	freeThreads++;
+}
+
+// The thread settings only change how the work is split, not the tree.
+std::vector<float> KDTree::CacheSettings() const
+{
+	return { (float)splitMethod, traversalCost, intersectionCost, emptyBonus, (float)binCount, (float)maxDepth,
+		(float)maxLeafSize, (float)KD_MAX_STACK_SIZE };
+}
+
+KDTreeStats KDTree::GetStats(const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices) const
+{
+	KDTreeStats stats;
+	if (nodes.empty())
+		return stats;
+	float rootArea = nodes[0].box.SurfaceArea();
+	std::vector<std::pair<uint, uint>> stack;
+	stack.push_back(std::make_pair(0u, 0u));
+	while (!stack.empty())
+	{
+		uint index = stack.back().first;
+		uint depth = stack.back().second;
+		stack.pop_back();
+		const KDNode_GPU& node = nodes[index];
+		float area = rootArea > 0.0f ? node.box.SurfaceArea() / rootArea : 1.0f;
+		stats.nodeCount++;
+		stats.maxDepth = std::max(stats.maxDepth, depth);
+		if (node.left == 0 && node.right == 0)
+		{
+			stats.leafCount++;
+			if (node.count == 0)
+				stats.emptyLeafCount++;
+			stats.maxLeafSize = std::max(stats.maxLeafSize, node.count);
+			stats.sahCost += intersectionCost * node.count * area;
+		}
+		else
+		{
+			stats.sahCost += traversalCost * area;
+			stack.push_back(std::make_pair(node.left, depth + 1));
+			stack.push_back(std::make_pair(node.right, depth + 1));
+		}
+	}
+	stats.averageLeafSize = (float)indices.size() / stats.leafCount;
+	stats.duplication = triangleBoxes.empty() ? 0.0f : (float)indices.size() / triangleBoxes.size();
+	return stats;
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <vector>
 #include <memory>
+#include <cmath>
+#include <atomic>
 
 typedef unsigned int uint;
 struct BBox
@@ -38,23 +40,53 @@ struct BBox
 		}
 		return true;
 	}
+	float SurfaceArea() const
+	{
+		float dx = max[0] - min[0];
+		float dy = max[1] - min[1];
+		float dz = max[2] - min[2];
+		return 2 * (dx * dy + dy * dz + dz * dx);
+	}
 	float min[3];
 	float max[3];
 };
 
+enum class KDSplitMethod
+{
+	Midpoint,	// split at the node center, axis with the fewest references
+	SAH			// binned surface area heuristic
+};
+
 struct KDNode
 {
 	KDNode() :tree(nullptr) {}
 	KDNode(struct KDTree* t) :tree(t) {}
-	void SplitForDimension(int d, std::vector<uint>& left, std::vector<uint>& right);
-	void Split();
+	int Classify(uint triangle, int axis, float split) const;
+	void Split(int depth);
+	bool FindMidpointSplit(int& axis, float& position);
+	bool FindSAHSplit(int& axis, float& position);
+	void Partition(int axis, float split);
 	std::unique_ptr<KDNode> left = nullptr;
 	std::unique_ptr<KDNode> right = nullptr;
 	BBox bbox;
-	std::vector<uint> triangles;
+	// The triangle references of a node live in the storage of the nearest ancestor
+	// that owns one.  Splits partition that range in place; a node only allocates
+	// its own storage when a split duplicates references into both children.
+	uint* triangles = nullptr;
+	uint numTriangles = 0;
+	std::vector<uint> storage;
+	int axis = 3;
+	float split = 0.0f;
 	struct KDTree* tree;
 };
 
+#define KD_NO_ROPE 0xFFFFFFFF
+
+// Nodes are flattened depth first.  Interior nodes keep their split plane so a
+// traversal can descend to the leaf containing a point, and every leaf links to
+// the deepest node beyond each of its faces (-x,+x,-y,+y,-z,+z) that still covers
+// the whole face.  Following these ropes walks the leaves along a ray in order
+// without a stack.
 struct KDNode_GPU
 {
 	BBox box;
@@ -62,6 +94,40 @@ struct KDNode_GPU
 	uint right;
 	uint start;
 	uint count;
+	uint axis;		// 3 for leaves
+	float split;
+	uint ropes[6];	// KD_NO_ROPE on the scene boundary
+};
+
+// Stack the CPU traversals are compiled with.  KDTree::Build never goes deeper than
+// KD_MAX_STACK_SIZE - 1 levels, whatever maxDepth asks for, so every tree fits.
+static const uint KD_MAX_STACK_SIZE = 64;
+
+// 8 byte encoding of the same depth-first tree for stack based traversal.  Interior
+// nodes keep only their split plane; the left child follows its parent and data
+// holds the right child.  Leaves pack their index range into one word.
+#define KD_COMPACT_MAX_LEAF 255
+struct KDNodeCompact
+{
+	uint data;		// axis in the low two bits (3 for leaves), right child index above
+	union
+	{
+		float split;
+		uint range;	// leaves: start << 8 | count
+	};
+};
+
+// Quality metrics of a flattened tree, computed with the tree's SAH cost model.
+struct KDTreeStats
+{
+	uint nodeCount = 0;
+	uint leafCount = 0;
+	uint emptyLeafCount = 0;
+	uint maxDepth = 0;
+	uint maxLeafSize = 0;
+	float averageLeafSize = 0;
+	float duplication = 0;	// triangle references per input triangle
+	float sahCost = 0;		// expected cost of a random ray hitting the root box
 };
 
 struct KDTree
@@ -69,6 +135,27 @@ struct KDTree
 	KDTree(size_t numTriangles);
 	void AddTriangle(int index, float* v0, float* v1, float* v2);
 	void Build(std::vector<KDNode_GPU>& nodes, std::vector<uint>& indices);
+	// Also emits the compact encoding; fails if a leaf or index does not fit in it.
+	bool Build(std::vector<KDNode_GPU>& nodes, std::vector<uint>& indices, std::vector<KDNodeCompact>& compact);
+	static bool Compact(const std::vector<KDNode_GPU>& nodes, std::vector<KDNodeCompact>& compact);
+	KDTreeStats GetStats(const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices) const;
+	// Everything below that changes the tree Build produces, for AccelCache keys.
+	std::vector<float> CacheSettings() const;
+	bool AcquireThread();
+	void ReleaseThread();
+	void BuildRopes(std::vector<KDNode_GPU>& nodes, uint index, const uint* ropes) const;
 	std::vector<BBox> triangleBoxes;
 	std::unique_ptr<KDNode> root;
+
+	KDSplitMethod splitMethod = KDSplitMethod::SAH;
+	float traversalCost = 2.0f;	// two child box tests per interior node on the GPU
+	float intersectionCost = 1.0f;
+	float emptyBonus = 0.2f;	// cost reduction for splits that cut off empty space
+	int binCount = 32;
+	int maxDepth = 0;			// 0 picks 8 + 1.3 * log2(N) at build time; at most KD_MAX_STACK_SIZE - 1
+	uint maxLeafSize = 64;		// leaf size of the midpoint builder
+	int numThreads = 0;			// 0 uses every hardware thread
+	uint parallelThreshold = 4096;	// smallest subtree built as a separate task
+	int depthLimit = 0;
+	std::atomic<int> freeThreads;
 };
\ No newline at end of file
@@ -0,0 +1,363 @@
+#include "PacketTracer.h"
+#include <algorithm>
+#include <cassert>
+#include <immintrin.h>
+
+static const float EPSILON = 1e-8f;
+
+// Thin wrappers so the traversal can be written once for SSE and AVX.
+struct Simd4
+{
+	static const int Width = 4;
+	__m128 v;
+	Simd4() {}
+	Simd4(__m128 x) : v(x) {}
+	static Simd4 Set1(float x) { return _mm_set1_ps(x); }
+	static Simd4 Load(const float* p) { return _mm_loadu_ps(p); }
+	static Simd4 Bits(int x) { return _mm_castsi128_ps(_mm_set1_epi32(x)); }
+	static Simd4 MaskFromBits(int bits)
+	{
+		return _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(bits), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128()));
+	}
+	void Store(float* p) const { _mm_storeu_ps(p, v); }
+	int MoveMask() const { return _mm_movemask_ps(v); }
+	friend Simd4 operator+(Simd4 a, Simd4 b) { return _mm_add_ps(a.v, b.v); }
+	friend Simd4 operator-(Simd4 a, Simd4 b) { return _mm_sub_ps(a.v, b.v); }
+	friend Simd4 operator*(Simd4 a, Simd4 b) { return _mm_mul_ps(a.v, b.v); }
+	friend Simd4 operator/(Simd4 a, Simd4 b) { return _mm_div_ps(a.v, b.v); }
+	friend Simd4 operator&(Simd4 a, Simd4 b) { return _mm_and_ps(a.v, b.v); }
+	friend Simd4 Min(Simd4 a, Simd4 b) { return _mm_min_ps(a.v, b.v); }
+	friend Simd4 Max(Simd4 a, Simd4 b) { return _mm_max_ps(a.v, b.v); }
+	friend Simd4 Less(Simd4 a, Simd4 b) { return _mm_cmplt_ps(a.v, b.v); }
+	friend Simd4 LessEqual(Simd4 a, Simd4 b) { return _mm_cmple_ps(a.v, b.v); }
+	friend Simd4 Select(Simd4 mask, Simd4 a, Simd4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+};
+
+#if PACKET_TRACER_AVX
+struct Simd8
+{
+	static const int Width = 8;
+	__m256 v;
+	Simd8() {}
+	Simd8(__m256 x) : v(x) {}
+	static Simd8 Set1(float x) { return _mm256_set1_ps(x); }
+	static Simd8 Load(const float* p) { return _mm256_loadu_ps(p); }
+	static Simd8 Bits(int x) { return _mm256_castsi256_ps(_mm256_set1_epi32(x)); }
+	static Simd8 MaskFromBits(int bits)
+	{
+		__m128i lo = _mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(bits), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128());
+		__m128i hi = _mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(bits), _mm_setr_epi32(16, 32, 64, 128)), _mm_setzero_si128());
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_castsi128_ps(lo)), _mm_castsi128_ps(hi), 1);
+	}
+	void Store(float* p) const { _mm256_storeu_ps(p, v); }
+	int MoveMask() const { return _mm256_movemask_ps(v); }
+	friend Simd8 operator+(Simd8 a, Simd8 b) { return _mm256_add_ps(a.v, b.v); }
+	friend Simd8 operator-(Simd8 a, Simd8 b) { return _mm256_sub_ps(a.v, b.v); }
+	friend Simd8 operator*(Simd8 a, Simd8 b) { return _mm256_mul_ps(a.v, b.v); }
+	friend Simd8 operator/(Simd8 a, Simd8 b) { return _mm256_div_ps(a.v, b.v); }
+	friend Simd8 operator&(Simd8 a, Simd8 b) { return _mm256_and_ps(a.v, b.v); }
+	friend Simd8 Min(Simd8 a, Simd8 b) { return _mm256_min_ps(a.v, b.v); }
+	friend Simd8 Max(Simd8 a, Simd8 b) { return _mm256_max_ps(a.v, b.v); }
+	friend Simd8 Less(Simd8 a, Simd8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	friend Simd8 LessEqual(Simd8 a, Simd8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+	friend Simd8 Select(Simd8 mask, Simd8 a, Simd8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+};
+#endif
+
+// Uniform access to the two node layouts.
+struct KDNodeAccess
+{
+	typedef KDNode_GPU Node;
+	static bool IsLeaf(const Node& n) { return n.axis == 3; }
+	static uint Start(const Node& n) { return n.start; }
+	static uint Left(const Node& n, uint) { return n.left; }
+	static uint Right(const Node& n, uint) { return n.right; }
+};
+
+struct BVHNodeAccess
+{
+	typedef BVHNode_GPU Node;
+	static bool IsLeaf(const Node& n) { return n.count > 0; }
+	static uint Start(const Node& n) { return n.offset; }
+	static uint Left(const Node&, uint index) { return index + 1; }
+	static uint Right(const Node& n, uint) { return n.offset; }
+};
+
+template<typename Simd>
+struct RayPacket
+{
+	float origin[3][Simd::Width];
+	float direction[3][Simd::Width];
+	float invDirection[3][Simd::Width];
+	float distance[Simd::Width];
+	float u[Simd::Width];
+	float v[Simd::Width];
+	int triangle[Simd::Width];
+};
+
+// Both builders keep their trees within 64 levels and an ordered walk holds at most
+// depth + 1 entries, so the traversal stacks below cannot fill.
+static const uint PACKET_STACK_SIZE = 128;
+static_assert(PACKET_STACK_SIZE >= BVH_MAX_STACK_SIZE && PACKET_STACK_SIZE >= KD_MAX_STACK_SIZE, "packet stacks must hold any built tree");
+
+// Ordered depth-first walk of one ray below 'root', continuing from its current hit.
+template<typename Access>
+static void TraceSubtree(const TraceMesh& mesh, const std::vector<typename Access::Node>& nodes, const std::vector<uint>& indices,
+	uint root, const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+{
+	uint stack[PACKET_STACK_SIZE];
+	float stackEntry[PACKET_STACK_SIZE];
+	uint stackSize = 0;
+	stack[stackSize] = root;
+	stackEntry[stackSize++] = -std::numeric_limits<float>::infinity();
+	while (stackSize > 0)
+	{
+		stackSize--;
+		if (stackEntry[stackSize] >= hit.distance)
+			continue;
+		uint index = stack[stackSize];
+		const typename Access::Node& node = nodes[index];
+		if (counters)
+			counters->nodesVisited++;
+		if (Access::IsLeaf(node))
+		{
+			for (uint j = 0; j < node.count; j++)
+			{
+				uint tri = indices[Access::Start(node) + j];
+				float t, u, v;
+				if (IntersectTriangle_MT97(ray, mesh.Position(tri, 0), mesh.Position(tri, 1), mesh.Position(tri, 2), t, u, v) && t > 0 && t < hit.distance)
+				{
+					hit.distance = t;
+					hit.triangle = tri;
+					hit.u = u;
+					hit.v = v;
+				}
+			}
+			if (counters)
+				counters->trianglesTested += node.count;
+			continue;
+		}
+		uint children[2] = { Access::Left(node, index), Access::Right(node, index) };
+		float entry[2], exit;
+		bool hits[2];
+		for (int c = 0; c < 2; c++)
+			hits[c] = IntersectBox(nodes[children[c]].box, ray, entry[c], exit) && exit > 0 && entry[c] < hit.distance;
+		int nearChild = (hits[0] && hits[1] && entry[1] < entry[0]) ? 1 : 0;
+		for (int c = 0; c < 2; c++)
+		{
+			int k = c == 0 ? 1 - nearChild : nearChild;
+			if (!hits[k])
+				continue;
+			assert(stackSize < PACKET_STACK_SIZE);
+			stack[stackSize] = children[k];
+			stackEntry[stackSize++] = entry[k];
+		}
+	}
+}
+
+template<typename Simd, typename Access>
+static void TracePacket(const TraceMesh& mesh, const std::vector<typename Access::Node>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters)
+{
+	const int W = Simd::Width;
+	const int fullMask = (1 << W) - 1;
+	const int divergedLanes = std::max(W / 4, 1);
+	if (nodes.empty() || count <= 0)
+		return;
+	count = std::min(count, W);
+
+	RayPacket<Simd> packet;
+	for (int i = 0; i < W; i++)
+	{
+		// Unused lanes replicate the first ray and are masked out.
+		const CpuRay& ray = rays[i < count ? i : 0];
+		for (int d = 0; d < 3; d++)
+		{
+			packet.origin[d][i] = ray.origin[d];
+			packet.direction[d][i] = ray.direction[d];
+			packet.invDirection[d][i] = 1.0f / ray.direction[d];
+		}
+		packet.distance[i] = i < count ? hits[i].distance : 0.0f;
+		packet.u[i] = i < count ? hits[i].u : 0.0f;
+		packet.v[i] = i < count ? hits[i].v : 0.0f;
+		packet.triangle[i] = i < count ? (int)hits[i].triangle : -1;
+	}
+	Simd origin[3], direction[3], invDirection[3];
+	for (int d = 0; d < 3; d++)
+	{
+		origin[d] = Simd::Load(packet.origin[d]);
+		direction[d] = Simd::Load(packet.direction[d]);
+		invDirection[d] = Simd::Load(packet.invDirection[d]);
+	}
+	Simd zero = Simd::Set1(0.0f);
+	Simd one = Simd::Set1(1.0f);
+	Simd epsilon = Simd::Set1(EPSILON);
+
+	// Finishes the subtree below 'root' one ray at a time for the lanes in 'mask'.
+	auto traceLanes = [&](uint root, int mask)
+	{
+		for (int i = 0; i < W; i++)
+		{
+			if (!((mask >> i) & 1))
+				continue;
+			CpuHit hit;
+			hit.distance = packet.distance[i];
+			hit.triangle = (uint)packet.triangle[i];
+			hit.u = packet.u[i];
+			hit.v = packet.v[i];
+			TraceSubtree<Access>(mesh, nodes, indices, root, rays[i], hit, counters);
+			packet.distance[i] = hit.distance;
+			packet.triangle[i] = (int)hit.triangle;
+			packet.u[i] = hit.u;
+			packet.v[i] = hit.v;
+			if (counters)
+				counters->packetFallbacks++;
+		}
+	};
+
+	struct Entry
+	{
+		uint node;
+		int mask;
+	};
+	Entry stack[PACKET_STACK_SIZE];
+	uint stackSize = 0;
+	stack[stackSize++] = { 0, fullMask >> (W - count) };
+	while (stackSize > 0)
+	{
+		Entry entry = stack[--stackSize];
+		const typename Access::Node& node = nodes[entry.node];
+		Simd distance = Simd::Load(packet.distance);
+
+		// Box test for every lane, clipped to each lane's closest hit.
+		Simd tmin = Simd::Set1(-std::numeric_limits<float>::infinity());
+		Simd tmax = distance;
+		for (int d = 0; d < 3; d++)
+		{
+			Simd t0 = (Simd::Set1(node.box.min[d]) - origin[d]) * invDirection[d];
+			Simd t1 = (Simd::Set1(node.box.max[d]) - origin[d]) * invDirection[d];
+			tmin = Max(tmin, Min(t0, t1));
+			tmax = Min(tmax, Max(t0, t1));
+		}
+		int mask = entry.mask & (LessEqual(tmin, tmax) & Less(zero, tmax)).MoveMask();
+		if (counters)
+			counters->nodesVisited++;
+		if (mask == 0)
+			continue;
+
+		int active = 0;
+		for (int i = 0; i < W; i++)
+			active += (mask >> i) & 1;
+		if (active <= divergedLanes)
+		{
+			// Diverged: finish this subtree one ray at a time.
+			traceLanes(entry.node, mask);
+			continue;
+		}
+
+		if (Access::IsLeaf(node))
+		{
+			Simd activeMask = Simd::MaskFromBits(mask);
+			Simd u = Simd::Load(packet.u);
+			Simd v = Simd::Load(packet.v);
+			Simd triangle = Simd::Load((const float*)packet.triangle);
+			for (uint j = 0; j < node.count; j++)
+			{
+				uint tri = indices[Access::Start(node) + j];
+				const float* p0 = mesh.Position(tri, 0);
+				const float* p1 = mesh.Position(tri, 1);
+				const float* p2 = mesh.Position(tri, 2);
+				Simd edge1[3], edge2[3], tvec[3];
+				for (int d = 0; d < 3; d++)
+				{
+					edge1[d] = Simd::Set1(p1[d] - p0[d]);
+					edge2[d] = Simd::Set1(p2[d] - p0[d]);
+					tvec[d] = origin[d] - Simd::Set1(p0[d]);
+				}
+				Simd pvec[3] =
+				{
+					direction[1] * edge2[2] - direction[2] * edge2[1],
+					direction[2] * edge2[0] - direction[0] * edge2[2],
+					direction[0] * edge2[1] - direction[1] * edge2[0]
+				};
+				Simd det = edge1[0] * pvec[0] + edge1[1] * pvec[1] + edge1[2] * pvec[2];
+				Simd invDet = one / det;
+				Simd tu = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) * invDet;
+				Simd qvec[3] =
+				{
+					tvec[1] * edge1[2] - tvec[2] * edge1[1],
+					tvec[2] * edge1[0] - tvec[0] * edge1[2],
+					tvec[0] * edge1[1] - tvec[1] * edge1[0]
+				};
+				Simd tv = (direction[0] * qvec[0] + direction[1] * qvec[1] + direction[2] * qvec[2]) * invDet;
+				Simd t = (edge2[0] * qvec[0] + edge2[1] * qvec[1] + edge2[2] * qvec[2]) * invDet;
+				// Same conditions as IntersectTriangle_MT97 with backface culling and t > 0.
+				Simd valid = activeMask & LessEqual(epsilon, det) & LessEqual(zero, tu) & LessEqual(tu, one) &
+					LessEqual(zero, tv) & LessEqual(tu + tv, one) & Less(zero, t) & Less(t, distance);
+				distance = Select(valid, t, distance);
+				u = Select(valid, tu, u);
+				v = Select(valid, tv, v);
+				triangle = Select(valid, Simd::Bits((int)tri), triangle);
+			}
+			distance.Store(packet.distance);
+			u.Store(packet.u);
+			v.Store(packet.v);
+			triangle.Store((float*)packet.triangle);
+			if (counters)
+				counters->trianglesTested += node.count;
+			continue;
+		}
+
+		// Visit the child whose center is nearer along the first active ray first.
+		uint children[2] = { Access::Left(node, entry.node), Access::Right(node, entry.node) };
+		int lane = 0;
+		while (!((mask >> lane) & 1))
+			lane++;
+		float c0[3], c1[3];
+		BBox box0 = nodes[children[0]].box;
+		BBox box1 = nodes[children[1]].box;
+		box0.GetCenter(c0);
+		box1.GetCenter(c1);
+		float order = (c0[0] - c1[0]) * packet.direction[0][lane] + (c0[1] - c1[1]) * packet.direction[1][lane] + (c0[2] - c1[2]) * packet.direction[2][lane];
+		int nearChild = order > 0.0f ? 1 : 0;
+		assert(stackSize + 2 <= PACKET_STACK_SIZE);
+		stack[stackSize++] = { children[1 - nearChild], mask };
+		stack[stackSize++] = { children[nearChild], mask };
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		hits[i].distance = packet.distance[i];
+		hits[i].triangle = (uint)packet.triangle[i];
+		hits[i].u = packet.u[i];
+		hits[i].v = packet.v[i];
+	}
+	if (counters)
+		counters->rays += count;
+}
+
+void TraceKDTreePacket4(const TraceMesh& mesh, const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters)
+{
+	TracePacket<Simd4, KDNodeAccess>(mesh, nodes, indices, rays, hits, count, counters);
+}
+
+void TraceBVHPacket4(const TraceMesh& mesh, const std::vector<BVHNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters)
+{
+	TracePacket<Simd4, BVHNodeAccess>(mesh, nodes, indices, rays, hits, count, counters);
+}
+
+#if PACKET_TRACER_AVX
+void TraceKDTreePacket8(const TraceMesh& mesh, const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters)
+{
+	TracePacket<Simd8, KDNodeAccess>(mesh, nodes, indices, rays, hits, count, counters);
+}
+
+void TraceBVHPacket8(const TraceMesh& mesh, const std::vector<BVHNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters)
+{
+	TracePacket<Simd8, BVHNodeAccess>(mesh, nodes, indices, rays, hits, count, counters);
+}
+#endif
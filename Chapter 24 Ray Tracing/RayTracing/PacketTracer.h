@@ -0,0 +1,20 @@
+#pragma once
+#include "CpuTracer.h"
+
+// Packet traversal: up to 4 (SSE) or 8 (AVX) coherent rays walk the tree together,
+// sharing node fetches and testing each box and triangle for all lanes at once.
+// When no more than a quarter of the lanes are still active in a subtree the packet
+// has diverged, and those lanes finish that subtree with single-ray traversal.
+
+void TraceKDTreePacket4(const TraceMesh& mesh, const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters = nullptr);
+void TraceBVHPacket4(const TraceMesh& mesh, const std::vector<BVHNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters = nullptr);
+
+#if defined(__AVX__)
+#define PACKET_TRACER_AVX 1
+void TraceKDTreePacket8(const TraceMesh& mesh, const std::vector<KDNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters = nullptr);
+void TraceBVHPacket8(const TraceMesh& mesh, const std::vector<BVHNode_GPU>& nodes, const std::vector<uint>& indices,
+	const CpuRay* rays, CpuHit* hits, int count, TraceCounters* counters = nullptr);
+#endif
@@ -1,7 +1,11 @@
 #include "../../Common/d3dApp.h"
 #include "../../Common/Camera.h"
 #include "../../Common/UploadBuffer.h"
+#include "../../Common/MeshFile.h"
 #include "KDTree.h"
+#include "BVH.h"
+#include "InstanceBVH.h"
+#include "AccelCache.h"
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
 
@@ -17,6 +21,15 @@ struct RTPassConstants
 	float Seed;
 	int NumSpheres;
 	int NumTriangles;
+	int Pad0;
+	XMFLOAT3 NodeOrigin;
+	float Pad1;
+	XMFLOAT3 NodeScale;
+	int ResetAccumulation;
+	float TargetError;
+	int MinSamples;
+	int MaxSamples;
+	int SampleIndex;
 };
 
 struct AccPassConstants
@@ -42,6 +55,31 @@ struct Triangle
 	UINT indices[3];
 	UINT material;
 };
+struct InstanceData
+{
+	XMFLOAT4X4 InvWorld;
+};
+// PathState and RayHit in the shader; only their sizes are used here.
+struct PathState
+{
+	XMFLOAT3 Origin;
+	UINT Pixel;
+	XMFLOAT3 Direction;
+	UINT Bounce;
+	XMFLOAT3 Energy;
+	float Seed;
+	XMFLOAT3 Radiance;
+	UINT SampleIndex;
+};
+struct PathHit
+{
+	XMFLOAT3 Position;
+	float Distance;
+	XMFLOAT3 Normal;
+	XMFLOAT3 Albedo;
+	XMFLOAT3 Specular;
+};
+static const UINT MaxBounces = 8;
 class RayTracingApp : public D3DApp
 {
 public:
@@ -61,8 +99,11 @@ private:
 	void BuildRootSignature();
 	void BuildDescriptorHeaps();
 	void BuildConstantBuffers();
+	void BuildInstances(const BBox& meshBounds);
 	void BuildShadersAndInputLayout();
 	void BuildPSOs();
+	void ClearCounters(ID3D12Resource* counters, UINT count);
+	void DispatchWavefront();
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
@@ -75,10 +116,30 @@ private:
 	std::unique_ptr<UploadBuffer<Vertex>> mVertices = nullptr;
 	std::unique_ptr<UploadBuffer<Triangle>> mTriangles = nullptr;
 	std::unique_ptr<UploadBuffer<KDNode_GPU>> mNodes = nullptr;
+	std::unique_ptr<UploadBuffer<BVHNode_GPU>> mBVHNodes = nullptr;
+	std::unique_ptr<UploadBuffer<BVHNodeCompact>> mCompactBVHNodes = nullptr;
+	BVHQuantization mQuantization = {};
+	std::unique_ptr<UploadBuffer<InstanceData>> mInstances = nullptr;
+	std::unique_ptr<UploadBuffer<BVHNode_GPU>> mTLASNodes = nullptr;
+	InstanceBVH mInstanceBVH;
+	// Traversal stacks the shaders are compiled with, from the depth of the trees.
+	UINT mBVHStackSize = BVH_MAX_STACK_SIZE;
+	UINT mTLASStackSize = BVH_MAX_STACK_SIZE;
 	std::unique_ptr<UploadBuffer<uint>> mIndices = nullptr;
 
 	std::unique_ptr<KDTree> mKDTree = nullptr;
+	std::unique_ptr<BVH> mBVH = nullptr;
 	ComPtr<ID3D12Resource> mOutputBuffer = nullptr;
+	ComPtr<ID3D12Resource> mAccumulation = nullptr;
+	ComPtr<ID3D12Resource> mMoments = nullptr;
+	ComPtr<ID3D12Resource> mActivePixels = nullptr;
+	ComPtr<ID3D12Resource> mActivePixelsReadBack = nullptr;
+	std::unique_ptr<UploadBuffer<UINT>> mZeroCounters = nullptr;
+	ComPtr<ID3D12Resource> mPaths = nullptr;
+	ComPtr<ID3D12Resource> mPathHits = nullptr;
+	ComPtr<ID3D12Resource> mQueueCounts = nullptr;
+	// Pixels still sampling after the last dispatch, 0 once the frame has converged.
+	UINT mActivePixelCount = UINT_MAX;
 	ComPtr<ID3D12RootSignature> mRootSignature = nullptr;
 
 	ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
@@ -87,6 +148,25 @@ private:
 	AccPassConstants mAcc;
 
 	const bool KDTree_Testing = false;
+	// Trace the model through a BVH instead of the kd-tree.
+	const bool UseBVH = true;
+	// Upload the 16 byte quantized BVH nodes instead of the 32 byte ones.
+	const bool UseCompactNodes = true;
+	// Trace a grid of skull instances through a top-level BVH over the skull's BVH.
+	const bool UseInstances = true;
+	// Keep a per-pixel mean and variance and stop tracing pixels once the standard
+	// error of their mean is below TargetError (relative to the mean); dispatching
+	// stops altogether when every pixel has converged.
+	const bool AdaptiveSampling = true;
+	const float TargetError = 0.02f;
+	const int MinSamples = 16;
+	const int MaxSamples = 4096;
+	// Draw pixel jitter and bounce directions from Owen-scrambled Sobol points instead
+	// of the per-pixel hash rand().
+	const bool UseSobol = true;
+	// Split the path tracer into generate/extend/shade/compact dispatches that pass
+	// paths through queues, instead of one thread running all bounces of its pixel.
+	const bool UseWavefront = true;
 	UINT mCbvSrvDescriptorSize = 0;
 	UINT NumTriangles;
 	Camera mCamera;
@@ -163,6 +243,72 @@ void RayTracingApp::BuildBuffers()
 		D3D12_RESOURCE_STATE_COMMON,
 		nullptr,
 		IID_PPV_ARGS(&mOutputBuffer)));
+
+	// Zeros copied over the per-frame counters.
+	mZeroCounters = std::make_unique<UploadBuffer<UINT>>(md3dDevice.Get(), MaxBounces + 1, false);
+	for (UINT i = 0; i <= MaxBounces; i++)
+		mZeroCounters->CopyData(i, 0);
+
+	if (UseWavefront)
+	{
+		UINT64 numPixels = (UINT64)mClientWidth * mClientHeight;
+		ThrowIfFailed(md3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(2 * numPixels * sizeof(PathState), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+			nullptr,
+			IID_PPV_ARGS(&mPaths)));
+		ThrowIfFailed(md3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(numPixels * sizeof(PathHit), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+			nullptr,
+			IID_PPV_ARGS(&mPathHits)));
+		ThrowIfFailed(md3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer((MaxBounces + 1) * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+			nullptr,
+			IID_PPV_ARGS(&mQueueCounts)));
+	}
+
+	if (!AdaptiveSampling)
+		return;
+
+	texDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&mAccumulation)));
+	texDesc.Format = DXGI_FORMAT_R32G32_FLOAT;
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&mMoments)));
+
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		nullptr,
+		IID_PPV_ARGS(&mActivePixels)));
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT)),
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(&mActivePixelsReadBack)));
 }
 void RayTracingApp::BuildRootSignature()
 {
@@ -170,10 +316,11 @@ void RayTracingApp::BuildRootSignature()
 	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 0);
 
 	CD3DX12_DESCRIPTOR_RANGE uavTable;
-	uavTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+	// gOutput, plus gAccumulation and gMoments when sampling adaptively.
+	uavTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, AdaptiveSampling ? 3 : 1, 0);
 
 	// Root parameter can be a table, root descriptor or root constants.
-	CD3DX12_ROOT_PARAMETER slotRootParameter[8];
+	CD3DX12_ROOT_PARAMETER slotRootParameter[15];
 
 	// Perfomance TIP: Order from most frequent to least frequent.
 	slotRootParameter[0].InitAsConstantBufferView(0);
@@ -184,12 +331,20 @@ void RayTracingApp::BuildRootSignature()
 	slotRootParameter[5].InitAsShaderResourceView(5);
 	slotRootParameter[6].InitAsDescriptorTable(1, &texTable );
 	slotRootParameter[7].InitAsDescriptorTable(1, &uavTable	);
+	slotRootParameter[8].InitAsShaderResourceView(6);
+	slotRootParameter[9].InitAsShaderResourceView(7);
+	slotRootParameter[10].InitAsUnorderedAccessView(3);
+	// Wavefront path queues, hit records, queue counters and the current bounce.
+	slotRootParameter[11].InitAsUnorderedAccessView(4);
+	slotRootParameter[12].InitAsUnorderedAccessView(5);
+	slotRootParameter[13].InitAsUnorderedAccessView(6);
+	slotRootParameter[14].InitAsConstants(1, 1);
 
 
 	auto staticSamplers = GetStaticSamplers();
 
 	// A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(8, slotRootParameter,
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(15, slotRootParameter,
 		(UINT)staticSamplers.size(), staticSamplers.data(),
 		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -215,7 +370,7 @@ void RayTracingApp::BuildDescriptorHeaps()
 {
 	{
 		D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-		srvHeapDesc.NumDescriptors = 2;
+		srvHeapDesc.NumDescriptors = AdaptiveSampling ? 4 : 2;
 		srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 		srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 		ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
@@ -241,6 +396,15 @@ void RayTracingApp::BuildDescriptorHeaps()
 		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
 		uavDesc.Texture2D.MipSlice = 0;
 		md3dDevice->CreateUnorderedAccessView(mOutputBuffer.Get(), nullptr, &uavDesc, hDescriptor);
+		if (AdaptiveSampling)
+		{
+			hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+			uavDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+			md3dDevice->CreateUnorderedAccessView(mAccumulation.Get(), nullptr, &uavDesc, hDescriptor);
+			hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+			uavDesc.Format = DXGI_FORMAT_R32G32_FLOAT;
+			md3dDevice->CreateUnorderedAccessView(mMoments.Get(), nullptr, &uavDesc, hDescriptor);
+		}
 	}
 	{
 		D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
@@ -255,47 +419,42 @@ void RayTracingApp::BuildDescriptorHeaps()
 
 		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-		srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		srvDesc.Format = AdaptiveSampling ? DXGI_FORMAT_R32G32B32A32_FLOAT : DXGI_FORMAT_R8G8B8A8_UNORM;
 		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
 		srvDesc.Texture2D.MostDetailedMip = 0;
 		srvDesc.Texture2D.MipLevels = 1;
 		srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
-		md3dDevice->CreateShaderResourceView(mOutputBuffer.Get(), &srvDesc, hDescriptor);
+		md3dDevice->CreateShaderResourceView(AdaptiveSampling ? mAccumulation.Get() : mOutputBuffer.Get(), &srvDesc, hDescriptor);
 	}
 }
 void RayTracingApp::LoadModel(const char* file, std::vector<Vertex>& Vertices, std::vector<Triangle>& Triangles)
 {
-	std::ifstream fin(file);
-	if (!fin)
+	MeshFile mesh;
+	if (!mesh.OpenModel(file))
 	{
 		MessageBox(0, L"Models/skull.txt not found.", 0, 0);
 		return;
 	}
-	UINT vcount = 0;
-	UINT tcount = 0;
-	std::string ignore;
-	fin >> ignore >> vcount;
-	fin >> ignore >> tcount;
-	fin >> ignore >> ignore >> ignore >> ignore;
-	Vertices.resize(vcount);
-	for (UINT i = 0; i < vcount; ++i)
+	const float* positions = mesh.Positions();
+	const float* normals = mesh.Normals();
+	Vertices.resize(mesh.VertexCount());
+	for (UINT i = 0; i < mesh.VertexCount(); ++i)
 	{
 		Vertex& vertex = Vertices[i];
-		fin >> vertex.position.x >> vertex.position.y >> vertex.position.z;
-		fin >> vertex.normal.x >> vertex.normal.y >> vertex.normal.z;
+		vertex.position = XMFLOAT3(&positions[i * 3]);
+		vertex.normal = XMFLOAT3(&normals[i * 3]);
 		// Model does not have texture coordinates, so just zero them out.
 		vertex.uv = { 0.0f, 0.0f };
 	}
-	fin >> ignore;
-	fin >> ignore;
-	fin >> ignore;
-	Triangles.resize(tcount);
-	for (UINT i = 0; i < tcount; ++i)
+	const uint32_t* indices = mesh.Indices();
+	Triangles.resize(mesh.IndexCount() / 3);
+	for (UINT i = 0; i < Triangles.size(); ++i)
 	{
 		Triangle& triangle = Triangles[i];
-		fin >> triangle.indices[0] >> triangle.indices[1] >> triangle.indices[2];
+		triangle.indices[0] = indices[i * 3 + 0];
+		triangle.indices[1] = indices[i * 3 + 1];
+		triangle.indices[2] = indices[i * 3 + 2];
 	}
-	fin.close();
 }
 void RayTracingApp::BuildConstantBuffers()
 {
@@ -318,9 +477,84 @@ void RayTracingApp::BuildConstantBuffers()
 	}
 	else
 	{
-		std::vector<Vertex> Vertices;
-		std::vector<Triangle> Triangles;
-		LoadModel("Models/skull.txt", Vertices, Triangles);
+		const char* modelFile = "Models/skull.txt";
+		std::string cacheFile = std::string(modelFile) + (UseBVH ? ".bvh.cache" : ".kd.cache");
+		// The builders exist before the model is loaded so their settings can go into
+		// the cache key; a changed setting then misses instead of loading a stale tree.
+		if (UseBVH)
+			mBVH = std::make_unique<BVH>(0);
+		else
+			mKDTree = std::make_unique<KDTree>(0);
+		uint64_t cacheKey = AccelCache::HashFile(modelFile, UseBVH ? "bvh" : "kd",
+			UseBVH ? mBVH->CacheSettings() : mKDTree->CacheSettings());
+		std::vector<Vertex> vertexData;
+		std::vector<Triangle> triangleData;
+		std::vector<uint> indexData;
+		std::vector<BVHNode_GPU> bvhNodeData;
+		std::vector<BVHNodeCompact> compactNodeData;
+		std::vector<BVHQuantization> quantizationData(1);
+		std::vector<KDNode_GPU> kdNodeData;
+		// A valid cache holds the parsed model and the flattened tree, so both the
+		// text parsing and the build are skipped and the views below point straight
+		// into the mapped file. A cached BVH deeper than the traversal stacks is
+		// rebuilt rather than used.
+		AccelCache cache;
+		CacheView<Vertex> Vertices;
+		CacheView<Triangle> Triangles;
+		CacheView<uint> indices;
+		CacheView<BVHNode_GPU> bvhNodes;
+		CacheView<BVHNodeCompact> compactNodes;
+		CacheView<BVHQuantization> quantization;
+		CacheView<KDNode_GPU> kdNodes;
+		bool cached = cache.Open(cacheFile.c_str(), cacheKey) && cache.Get(0, Vertices) && cache.Get(1, Triangles) &&
+			cache.Get(2, indices) && (UseBVH ? cache.Get(3, bvhNodes) && cache.Get(4, compactNodes) &&
+			cache.Get(5, quantization) && quantization.size() == 1 &&
+			BVH::StackSize(bvhNodes.data, bvhNodes.size()) <= BVH_MAX_STACK_SIZE : cache.Get(3, kdNodes));
+		if (!cached)
+		{
+			LoadModel(modelFile, vertexData, triangleData);
+			if (UseBVH)
+			{
+				mBVH->triangleBoxes.resize(triangleData.size());
+				for (int i = 0; i < triangleData.size(); i++)
+				{
+					Triangle& tri = triangleData[i];
+					mBVH->AddTriangle(i, &vertexData[tri.indices[0]].position.x, &vertexData[tri.indices[1]].position.x, &vertexData[tri.indices[2]].position.x);
+				}
+				mBVH->Build(bvhNodeData, indexData);
+				// Cached empty when the tree does not fit the compact encoding.
+				if (!BVH::Compact(bvhNodeData, compactNodeData, quantizationData[0]))
+					compactNodeData.clear();
+			}
+			else
+			{
+				mKDTree->triangleBoxes.resize(triangleData.size());
+				for (int i = 0; i < triangleData.size(); i++)
+				{
+					Triangle& tri = triangleData[i];
+					mKDTree->AddTriangle(i, &vertexData[tri.indices[0]].position.x, &vertexData[tri.indices[1]].position.x, &vertexData[tri.indices[2]].position.x);
+				}
+				mKDTree->Build(kdNodeData, indexData);
+			}
+			if (UseBVH)
+			{
+				AccelCache::Write(cacheFile.c_str(), cacheKey, { MakeCacheSection(vertexData), MakeCacheSection(triangleData),
+					MakeCacheSection(indexData), MakeCacheSection(bvhNodeData), MakeCacheSection(compactNodeData),
+					MakeCacheSection(quantizationData) });
+			}
+			else
+			{
+				AccelCache::Write(cacheFile.c_str(), cacheKey, { MakeCacheSection(vertexData), MakeCacheSection(triangleData),
+					MakeCacheSection(indexData), MakeCacheSection(kdNodeData) });
+			}
+			Vertices = vertexData;
+			Triangles = triangleData;
+			indices = indexData;
+			bvhNodes = bvhNodeData;
+			compactNodes = compactNodeData;
+			quantization = quantizationData;
+			kdNodes = kdNodeData;
+		}
 		mVertices = std::make_unique<UploadBuffer<Vertex>>(md3dDevice.Get(), (UINT)Vertices.size(), false);
 		for (UINT i = 0; i < Vertices.size(); ++i)
 			mVertices->CopyData(i, Vertices[i]);
@@ -328,32 +562,107 @@ void RayTracingApp::BuildConstantBuffers()
 		for (UINT i = 0; i < Triangles.size(); ++i)
 			mTriangles->CopyData(i, Triangles[i]);
 
-		mKDTree = std::make_unique<KDTree>(Triangles.size());
-		for (int i = 0; i < Triangles.size(); i++)
+		if (UseBVH)
+		{
+			mBVHStackSize = BVH::StackSize(bvhNodes.data, bvhNodes.size());
+			if (UseCompactNodes && compactNodes.empty())
+			{
+				MessageBox(0, L"BVH does not fit the compact node encoding.", 0, 0);
+				return;
+			}
+			if (UseCompactNodes)
+			{
+				mQuantization = quantization[0];
+				mCompactBVHNodes = std::make_unique<UploadBuffer<BVHNodeCompact>>(md3dDevice.Get(), (UINT)compactNodes.size(), false);
+				for (UINT i = 0; i < compactNodes.size(); ++i)
+					mCompactBVHNodes->CopyData(i, compactNodes[i]);
+			}
+			else
+			{
+				mBVHNodes = std::make_unique<UploadBuffer<BVHNode_GPU>>(md3dDevice.Get(), (UINT)bvhNodes.size(), false);
+				for (UINT i = 0; i < bvhNodes.size(); ++i)
+					mBVHNodes->CopyData(i, bvhNodes[i]);
+			}
+			if (UseInstances)
+				BuildInstances(bvhNodes[0].box);
+		}
+		else
 		{
-			Triangle& tri = Triangles[i];
-			mKDTree->AddTriangle(i, &Vertices[tri.indices[0]].position.x, &Vertices[tri.indices[1]].position.x, &Vertices[tri.indices[2]].position.x);
+			mNodes = std::make_unique<UploadBuffer<KDNode_GPU>>(md3dDevice.Get(), (UINT)kdNodes.size(), false);
+			for (UINT i = 0; i < kdNodes.size(); ++i)
+				mNodes->CopyData(i, kdNodes[i]);
 		}
-		std::vector<KDNode_GPU> nodes;
-		std::vector<uint> indices;
-		mKDTree->Build(nodes, indices);
-		mNodes = std::make_unique<UploadBuffer<KDNode_GPU>>(md3dDevice.Get(), (UINT)nodes.size(), false);
-		for (UINT i = 0; i < nodes.size(); ++i)
-			mNodes->CopyData(i, nodes[i]);
 		mIndices = std::make_unique<UploadBuffer<uint>>(md3dDevice.Get(), (UINT)indices.size(), false);
 		for (UINT i = 0; i < indices.size(); ++i)
 			mIndices->CopyData(i, indices[i]);
 		NumTriangles = (UINT)Triangles.size();
 	}
 }
+void RayTracingApp::BuildInstances(const BBox& meshBounds)
+{
+	// Same layout as the skulls of InstancingAndCulling, on a denser grid.
+	const int n = 10;
+	float width = 400.0f;
+	float height = 400.0f;
+	float depth = 400.0f;
+
+	float x = -0.5f*width;
+	float y = -0.5f*height;
+	float z = -0.5f*depth;
+	float dx = width / (n - 1);
+	float dy = height / (n - 1);
+	float dz = depth / (n - 1);
+	for (int k = 0; k < n; ++k)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			for (int j = 0; j < n; ++j)
+			{
+				XMFLOAT4X4 world;
+				XMStoreFloat4x4(&world, XMMatrixRotationY(MathHelper::RandF(0.0f, XM_2PI)) *
+					XMMatrixTranslation(x + j*dx, y + i*dy, z + k*dz));
+				mInstanceBVH.AddInstance(&world.m[0][0], 0, meshBounds);
+			}
+		}
+	}
+	mInstanceBVH.Build();
+	mTLASStackSize = BVH::StackSize(mInstanceBVH.nodes.data(), mInstanceBVH.nodes.size());
+
+	mInstances = std::make_unique<UploadBuffer<InstanceData>>(md3dDevice.Get(), (UINT)mInstanceBVH.instances.size(), false);
+	for (UINT i = 0; i < mInstanceBVH.instances.size(); ++i)
+	{
+		InstanceData data;
+		memcpy(&data.InvWorld, mInstanceBVH.instances[i].invWorld, sizeof(data.InvWorld));
+		mInstances->CopyData(i, data);
+	}
+	mTLASNodes = std::make_unique<UploadBuffer<BVHNode_GPU>>(md3dDevice.Get(), (UINT)mInstanceBVH.nodes.size(), false);
+	for (UINT i = 0; i < mInstanceBVH.nodes.size(); ++i)
+		mTLASNodes->CopyData(i, mInstanceBVH.nodes[i]);
+}
 void RayTracingApp::BuildShadersAndInputLayout()
 {
+	std::string bvhStackSize = std::to_string(mBVHStackSize);
+	std::string tlasStackSize = std::to_string(mTLASStackSize);
 	const D3D_SHADER_MACRO defines[] =
 	{
 		"KDTREE_TESTING", KDTree_Testing ? "1" : "0",
+		"USE_BVH", UseBVH ? "1" : "0",
+		"USE_COMPACT_NODES", UseCompactNodes ? "1" : "0",
+		"USE_INSTANCES", UseInstances ? "1" : "0",
+		"ADAPTIVE_SAMPLING", AdaptiveSampling ? "1" : "0",
+		"USE_SOBOL", UseSobol ? "1" : "0",
+		"BVH_STACK_SIZE", bvhStackSize.c_str(),
+		"TLAS_STACK_SIZE", tlasStackSize.c_str(),
 		NULL, NULL
 	};
 	mShaders["RayTracing"] = d3dUtil::CompileShader(L"Shaders\\RayTracing.hlsl", defines, "CS", "cs_5_0");
+	if (UseWavefront)
+	{
+		mShaders["Generate"] = d3dUtil::CompileShader(L"Shaders\\RayTracing.hlsl", defines, "GenerateCS", "cs_5_0");
+		mShaders["Extend"] = d3dUtil::CompileShader(L"Shaders\\RayTracing.hlsl", defines, "ExtendCS", "cs_5_0");
+		mShaders["Shade"] = d3dUtil::CompileShader(L"Shaders\\RayTracing.hlsl", defines, "ShadeCS", "cs_5_0");
+		mShaders["Compact"] = d3dUtil::CompileShader(L"Shaders\\RayTracing.hlsl", defines, "CompactCS", "cs_5_0");
+	}
 	mShaders["accVS"] = d3dUtil::CompileShader(L"Shaders\\RayTracing.hlsl", defines, "VS", "vs_5_0");
 	mShaders["accPS"] = d3dUtil::CompileShader(L"Shaders\\RayTracing.hlsl", defines, "PS", "ps_5_0");
 }
@@ -368,6 +677,18 @@ void RayTracingApp::BuildPSOs()
 	};
 	computePsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
 	ThrowIfFailed(md3dDevice->CreateComputePipelineState(&computePsoDesc, IID_PPV_ARGS(&mPSOs["RayTracing"])));
+	if (UseWavefront)
+	{
+		for (const char* stage : { "Generate", "Extend", "Shade", "Compact" })
+		{
+			computePsoDesc.CS =
+			{
+				reinterpret_cast<BYTE*>(mShaders[stage]->GetBufferPointer()),
+				mShaders[stage]->GetBufferSize()
+			};
+			ThrowIfFailed(md3dDevice->CreateComputePipelineState(&computePsoDesc, IID_PPV_ARGS(&mPSOs[stage])));
+		}
+	}
 
 	D3D12_RENDER_TARGET_BLEND_DESC transparencyBlendDesc;
 	transparencyBlendDesc.BlendEnable = true;
@@ -412,6 +733,44 @@ void RayTracingApp::BuildPSOs()
 	accPsoDesc.BlendState.RenderTarget[0] = transparencyBlendDesc;
 	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&accPsoDesc, IID_PPV_ARGS(&mPSOs["Accumulated"])));
 }
+void RayTracingApp::ClearCounters(ID3D12Resource* counters, UINT count)
+{
+	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(counters, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+	mCommandList->CopyBufferRegion(counters, 0, mZeroCounters->Resource(), 0, count * sizeof(UINT));
+	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(counters, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+}
+void RayTracingApp::DispatchWavefront()
+{
+	ClearCounters(mQueueCounts.Get(), MaxBounces + 1);
+	mCommandList->SetComputeRootUnorderedAccessView(11, mPaths->GetGPUVirtualAddress());
+	mCommandList->SetComputeRootUnorderedAccessView(12, mPathHits->GetGPUVirtualAddress());
+	mCommandList->SetComputeRootUnorderedAccessView(13, mQueueCounts->GetGPUVirtualAddress());
+
+	mCommandList->SetPipelineState(mPSOs["Generate"].Get());
+	mCommandList->Dispatch((UINT)ceilf(mClientWidth / 8.f), (UINT)ceilf(mClientHeight / 8.f), 1);
+	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(nullptr));
+
+	// Queues are sized for every pixel; threads past the queue's count exit at once.
+	UINT numGroups = (mClientWidth * mClientHeight + 63) / 64;
+	for (UINT bounce = 0; bounce < MaxBounces; bounce++)
+	{
+		mCommandList->SetComputeRoot32BitConstant(14, bounce, 0);
+
+		mCommandList->SetPipelineState(mPSOs["Extend"].Get());
+		mCommandList->Dispatch(numGroups, 1, 1);
+		mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(nullptr));
+
+		mCommandList->SetPipelineState(mPSOs["Shade"].Get());
+		mCommandList->Dispatch(numGroups, 1, 1);
+		mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(nullptr));
+
+		if (bounce + 1 == MaxBounces)
+			break;
+		mCommandList->SetPipelineState(mPSOs["Compact"].Get());
+		mCommandList->Dispatch(numGroups, 1, 1);
+		mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(nullptr));
+	}
+}
 void RayTracingApp::OnResize()
 {
 	D3DApp::OnResize();
@@ -470,6 +829,14 @@ void RayTracingApp::Update(const GameTimer& gt)
 		mAcc.NumSamples = 1;
 	else
 		mAcc.NumSamples++;
+	if (AdaptiveSampling)
+	{
+		// The last frame has been flushed, so its count of unconverged pixels is ready.
+		UINT* activePixels = nullptr;
+		ThrowIfFailed(mActivePixelsReadBack->Map(0, nullptr, reinterpret_cast<void**>(&activePixels)));
+		mActivePixelCount = mAcc.NumSamples == 1 ? UINT_MAX : *activePixels;
+		mActivePixelsReadBack->Unmap(0, nullptr);
+	}
 	mCamera.UpdateViewMatrix();
 
 	mAccPassCB->CopyData(0, mAcc);
@@ -493,6 +860,13 @@ void RayTracingApp::Update(const GameTimer& gt)
 	passConstants.Seed = 1000.f + MathHelper::RandF() * 1000.f;
 	passConstants.NumSpheres = 64;
 	passConstants.NumTriangles = NumTriangles;
+	passConstants.NodeOrigin = XMFLOAT3(mQuantization.origin);
+	passConstants.NodeScale = XMFLOAT3(mQuantization.scale);
+	passConstants.ResetAccumulation = mAcc.NumSamples == 1;
+	passConstants.TargetError = TargetError;
+	passConstants.MinSamples = MinSamples;
+	passConstants.MaxSamples = MaxSamples;
+	passConstants.SampleIndex = mAcc.NumSamples - 1;
 	mPassCB->CopyData(0, passConstants);
 }
 void RayTracingApp::Draw(const GameTimer& gt)
@@ -516,8 +890,18 @@ void RayTracingApp::Draw(const GameTimer& gt)
 	{
 		mCommandList->SetComputeRootShaderResourceView(2, mVertices->Resource()->GetGPUVirtualAddress());
 		mCommandList->SetComputeRootShaderResourceView(3, mTriangles->Resource()->GetGPUVirtualAddress());
-		mCommandList->SetComputeRootShaderResourceView(4, mNodes->Resource()->GetGPUVirtualAddress());
+		if (UseBVH && UseCompactNodes)
+			mCommandList->SetComputeRootShaderResourceView(4, mCompactBVHNodes->Resource()->GetGPUVirtualAddress());
+		else if (UseBVH)
+			mCommandList->SetComputeRootShaderResourceView(4, mBVHNodes->Resource()->GetGPUVirtualAddress());
+		else
+			mCommandList->SetComputeRootShaderResourceView(4, mNodes->Resource()->GetGPUVirtualAddress());
 		mCommandList->SetComputeRootShaderResourceView(5, mIndices->Resource()->GetGPUVirtualAddress());
+		if (UseBVH && UseInstances)
+		{
+			mCommandList->SetComputeRootShaderResourceView(8, mInstances->Resource()->GetGPUVirtualAddress());
+			mCommandList->SetComputeRootShaderResourceView(9, mTLASNodes->Resource()->GetGPUVirtualAddress());
+		}
 	}
 	CD3DX12_GPU_DESCRIPTOR_HANDLE hGpuDescriptor(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
 	
@@ -525,7 +909,27 @@ void RayTracingApp::Draw(const GameTimer& gt)
 	hGpuDescriptor.Offset(1, mCbvSrvDescriptorSize);
 	mCommandList->SetComputeRootDescriptorTable(7, hGpuDescriptor);
 
-	mCommandList->Dispatch((UINT)ceilf(mClientWidth / 8.f), (UINT)ceilf(mClientHeight / 8.f), 1);
+	// With adaptive sampling nothing is traced once every pixel has converged.
+	if (!AdaptiveSampling || mActivePixelCount > 0)
+	{
+		if (AdaptiveSampling)
+		{
+			ClearCounters(mActivePixels.Get(), 1);
+			mCommandList->SetComputeRootUnorderedAccessView(10, mActivePixels->GetGPUVirtualAddress());
+		}
+
+		if (UseWavefront)
+			DispatchWavefront();
+		else
+			mCommandList->Dispatch((UINT)ceilf(mClientWidth / 8.f), (UINT)ceilf(mClientHeight / 8.f), 1);
+
+		if (AdaptiveSampling)
+		{
+			mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mActivePixels.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+			mCommandList->CopyResource(mActivePixelsReadBack.Get(), mActivePixels.Get());
+			mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mActivePixels.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+		}
+	}
 
 	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(), D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
 
@@ -0,0 +1,1065 @@
+//***************************************************************************************
+// RayTracingBench.cpp
+//
+// Console harness that exercises the CPU side of the ray tracer (acceleration structure
+// builders and traversal) without a D3D12 device.
+//
+// Usage: RayTracingBench [model.txt ...]   (defaults to Models/car.txt and Models/skull.txt)
+//        RayTracingBench render <model.txt|spheres> <output> [width height samples kd|bvh targetError]
+//        RayTracingBench convert <model.txt> <model.mesh>
+//
+// Besides the models, build scaling is measured on large GeometryGenerator meshes.
+// The render mode runs the CPU port of RayTracing.hlsl and writes <output>.pfm/.ppm.
+//***************************************************************************************
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../../Common/GeometryGenerator.h"
+#include "../../Common/MeshFile.h"
+#include "CpuRenderer.h"
+#include "PacketTracer.h"
+#include "AccelCache.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start, Clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static TraceMesh ToTraceMesh(const GeometryGenerator::MeshData& data)
+{
+	TraceMesh mesh;
+	mesh.positions.resize(data.Vertices.size() * 3);
+	mesh.normals.resize(data.Vertices.size() * 3);
+	for (size_t i = 0; i < data.Vertices.size(); i++)
+	{
+		memcpy(&mesh.positions[i * 3], &data.Vertices[i].Position, sizeof(float) * 3);
+		memcpy(&mesh.normals[i * 3], &data.Vertices[i].Normal, sizeof(float) * 3);
+	}
+	mesh.indices = data.Indices32;
+	return mesh;
+}
+
+template<typename Tree>
+static void FillTree(Tree& tree, const TraceMesh& mesh)
+{
+	for (uint i = 0; i < mesh.TriangleCount(); i++)
+	{
+		tree.AddTriangle((int)i, const_cast<float*>(mesh.Position(i, 0)),
+			const_cast<float*>(mesh.Position(i, 1)), const_cast<float*>(mesh.Position(i, 2)));
+	}
+}
+
+static void ReportBuilders(const std::string& name, const TraceMesh& mesh)
+{
+	printf("\n%s: %u vertices, %u triangles\n", name.c_str(), (uint)mesh.positions.size() / 3, mesh.TriangleCount());
+	printf("%-9s %10s %8s %8s %6s %6s %8s %8s %6s %8s\n",
+		"builder", "build(ms)", "nodes", "leaves", "empty", "depth", "avgLeaf", "maxLeaf", "dup", "SAH");
+	const KDSplitMethod methods[] = { KDSplitMethod::Midpoint, KDSplitMethod::SAH };
+	const char* names[] = { "midpoint", "sah" };
+	for (int m = 0; m < 2; m++)
+	{
+		KDTree tree(mesh.TriangleCount());
+		tree.splitMethod = methods[m];
+		FillTree(tree, mesh);
+		std::vector<KDNode_GPU> nodes;
+		std::vector<uint> indices;
+		auto start = Clock::now();
+		tree.Build(nodes, indices);
+		auto end = Clock::now();
+		KDTreeStats stats = tree.GetStats(nodes, indices);
+		printf("%-9s %10.2f %8u %8u %6u %6u %8.2f %8u %6.2f %8.2f\n",
+			names[m], Milliseconds(start, end), stats.nodeCount, stats.leafCount, stats.emptyLeafCount, stats.maxDepth,
+			stats.averageLeafSize, stats.maxLeafSize, stats.duplication, stats.sahCost);
+	}
+}
+
+// Best of three build times for 1, 2, 4, ... hardware threads.
+static void ReportBuildScaling(const std::string& name, const TraceMesh& mesh)
+{
+	printf("\n%s: %u triangles, SAH build scaling\n", name.c_str(), mesh.TriangleCount());
+	printf("%8s %10s %8s\n", "threads", "build(ms)", "speedup");
+	int maxThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+	double baseline = 0.0;
+	for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+	{
+		double best = 1e30;
+		for (int run = 0; run < 3; run++)
+		{
+			KDTree tree(mesh.TriangleCount());
+			tree.numThreads = threads;
+			FillTree(tree, mesh);
+			std::vector<KDNode_GPU> nodes;
+			std::vector<uint> indices;
+			auto start = Clock::now();
+			tree.Build(nodes, indices);
+			best = std::min(best, Milliseconds(start, Clock::now()));
+		}
+		if (threads == 1)
+			baseline = best;
+		printf("%8d %10.2f %8.2f\n", threads, best, baseline / best);
+		if (threads == maxThreads)
+			break;
+	}
+}
+
+// Pinhole camera rays looking at the box from the front-right, above.
+static std::vector<CpuRay> MakePrimaryRays(BBox bounds, int width, int height)
+{
+	float center[3];
+	bounds.GetCenter(center);
+	float size[3] = { bounds.max[0] - bounds.min[0], bounds.max[1] - bounds.min[1], bounds.max[2] - bounds.min[2] };
+	float radius = 0.5f * sqrtf(size[0] * size[0] + size[1] * size[1] + size[2] * size[2]);
+	float forward[3] = { -0.4f, -0.3f, 0.866f };
+	float len = sqrtf(forward[0] * forward[0] + forward[1] * forward[1] + forward[2] * forward[2]);
+	for (int i = 0; i < 3; i++)
+		forward[i] /= len;
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+	float right[3] = { up[1] * forward[2] - up[2] * forward[1], up[2] * forward[0] - up[0] * forward[2], up[0] * forward[1] - up[1] * forward[0] };
+	len = sqrtf(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+	for (int i = 0; i < 3; i++)
+		right[i] /= len;
+	float trueUp[3] = { forward[1] * right[2] - forward[2] * right[1], forward[2] * right[0] - forward[0] * right[2], forward[0] * right[1] - forward[1] * right[0] };
+	float tanHalfFov = tanf(0.125f * 3.14159265f);
+	float distance = radius / tanHalfFov;
+
+	std::vector<CpuRay> rays(width * height);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float sx = ((x + 0.5f) / width * 2.0f - 1.0f) * tanHalfFov;
+			float sy = (1.0f - (y + 0.5f) / height * 2.0f) * tanHalfFov;
+			CpuRay& ray = rays[y * width + x];
+			float dir[3];
+			for (int i = 0; i < 3; i++)
+			{
+				ray.origin[i] = center[i] - forward[i] * distance;
+				dir[i] = forward[i] + right[i] * sx + trueUp[i] * sy;
+			}
+			len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+			for (int i = 0; i < 3; i++)
+				ray.direction[i] = dir[i] / len;
+		}
+	}
+	return rays;
+}
+
+static std::vector<CpuRay> MakePrimaryRays(const TraceMesh& mesh, int width, int height)
+{
+	return MakePrimaryRays(mesh.Bounds(), width, height);
+}
+
+// Uniform hemisphere rays leaving the surface at every primary hit, like Shade().
+static std::vector<CpuRay> MakeDiffuseRays(const TraceMesh& mesh, const std::vector<CpuRay>& primary, const std::vector<CpuHit>& hits)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	std::vector<CpuRay> rays;
+	for (size_t r = 0; r < primary.size(); r++)
+	{
+		if (hits[r].triangle == 0xFFFFFFFF)
+			continue;
+		const float* v0 = mesh.Position(hits[r].triangle, 0);
+		const float* v1 = mesh.Position(hits[r].triangle, 1);
+		const float* v2 = mesh.Position(hits[r].triangle, 2);
+		float e1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+		float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+		float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		float d[3];
+		float d2;
+		do
+		{
+			d[0] = dist(rng);
+			d[1] = dist(rng);
+			d[2] = dist(rng);
+			d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+		} while (d2 > 1.0f || d2 < 1e-4f);
+		// Backface culling means n faces the incoming ray, i.e. points outwards.
+		float sign = d[0] * n[0] + d[1] * n[1] + d[2] * n[2] > 0 ? 1.0f : -1.0f;
+		CpuRay ray;
+		for (int i = 0; i < 3; i++)
+		{
+			ray.direction[i] = sign * d[i] / sqrtf(d2);
+			ray.origin[i] = primary[r].origin[i] + primary[r].direction[i] * hits[r].distance + n[i] / len * 0.001f;
+		}
+		rays.push_back(ray);
+	}
+	return rays;
+}
+
+template<typename TraceFn>
+static void RunRays(const char* label, const std::vector<CpuRay>& rays, std::vector<CpuHit>& hits, TraceFn trace)
+{
+	TraceCounters counters;
+	hits.assign(rays.size(), CpuHit());
+	auto start = Clock::now();
+	for (size_t i = 0; i < rays.size(); i++)
+		trace(rays[i], hits[i], &counters);
+	double ms = Milliseconds(start, Clock::now());
+	printf("%-14s %9zu %10.3f %10.2f %10.2f %9llu\n", label, rays.size(), rays.size() / (ms * 1000.0),
+		(double)counters.nodesVisited / rays.size(), (double)counters.trianglesTested / rays.size(),
+		(unsigned long long)counters.stackOverflows);
+}
+
+static uint CountMismatches(const std::vector<CpuHit>& a, const std::vector<CpuHit>& b)
+{
+	uint mismatches = 0;
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (a[i].triangle != b[i].triangle && fabsf(a[i].distance - b[i].distance) > 1e-4f * std::max(a[i].distance, 1.0f))
+			mismatches++;
+	}
+	return mismatches;
+}
+
+// Traces identical primary and diffuse ray sets through the kd-tree and the BVH.
+static void CompareAccelerators(const std::string& name, const TraceMesh& mesh)
+{
+	KDTree kdTree(mesh.TriangleCount());
+	FillTree(kdTree, mesh);
+	std::vector<KDNode_GPU> kdNodes;
+	std::vector<uint> kdIndices;
+	auto start = Clock::now();
+	kdTree.Build(kdNodes, kdIndices);
+	double kdMs = Milliseconds(start, Clock::now());
+
+	BVH bvh(mesh.TriangleCount());
+	FillTree(bvh, mesh);
+	std::vector<BVHNode_GPU> bvhNodes;
+	std::vector<uint> bvhIndices;
+	start = Clock::now();
+	bvh.Build(bvhNodes, bvhIndices);
+	double bvhMs = Milliseconds(start, Clock::now());
+
+	printf("\n%s: kd-tree vs BVH\n", name.c_str());
+	printf("%-8s %10s %8s %12s\n", "", "build(ms)", "nodes", "memory(KB)");
+	printf("%-8s %10.2f %8zu %12.1f\n", "kd-tree", kdMs, kdNodes.size(),
+		(kdNodes.size() * sizeof(KDNode_GPU) + kdIndices.size() * sizeof(uint)) / 1024.0);
+	printf("%-8s %10.2f %8zu %12.1f\n", "bvh", bvhMs, bvhNodes.size(),
+		(bvhNodes.size() * sizeof(BVHNode_GPU) + bvhIndices.size() * sizeof(uint)) / 1024.0);
+
+	auto traceKD = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters) { TraceKDTree(mesh, kdNodes, kdIndices, ray, hit, counters); };
+	auto traceKDBFS = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters) { TraceKDTreeBreadthFirst(mesh, kdNodes, kdIndices, ray, hit, counters); };
+	auto traceBVH = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters) { TraceBVH(mesh, bvhNodes, bvhIndices, ray, hit, counters); };
+
+	printf("%-14s %9s %10s %10s %10s %9s\n", "rays", "count", "Mrays/s", "nodes/ray", "tris/ray", "overflow");
+	std::vector<CpuRay> primary = MakePrimaryRays(mesh, 256, 256);
+	std::vector<CpuHit> kdHits, bvhHits;
+	std::vector<CpuHit> bfsHits;
+	RunRays("primary kd bfs", primary, bfsHits, traceKDBFS);
+	RunRays("primary kd", primary, kdHits, traceKD);
+	RunRays("primary bvh", primary, bvhHits, traceBVH);
+	uint primaryMismatches = CountMismatches(kdHits, bvhHits);
+	uint primaryBFSMismatches = CountMismatches(bfsHits, bvhHits);
+
+	std::vector<CpuRay> diffuse = MakeDiffuseRays(mesh, primary, bvhHits);
+	RunRays("diffuse kd bfs", diffuse, bfsHits, traceKDBFS);
+	RunRays("diffuse kd", diffuse, kdHits, traceKD);
+	RunRays("diffuse bvh", diffuse, bvhHits, traceBVH);
+	printf("mismatched hits: %u primary, %u diffuse (kd bfs: %u, %u)\n", primaryMismatches, CountMismatches(kdHits, bvhHits),
+		primaryBFSMismatches, CountMismatches(bfsHits, bvhHits));
+}
+
+// Full-size against compact node encodings: memory, throughput and hit agreement.
+static void CompareCompactNodes(const std::string& name, const TraceMesh& mesh)
+{
+	KDTree kdTree(mesh.TriangleCount());
+	FillTree(kdTree, mesh);
+	std::vector<KDNode_GPU> kdNodes;
+	std::vector<KDNodeCompact> kdCompact;
+	std::vector<uint> kdIndices;
+	bool kdEncoded = kdTree.Build(kdNodes, kdIndices, kdCompact);
+
+	BVH bvh(mesh.TriangleCount());
+	FillTree(bvh, mesh);
+	std::vector<BVHNode_GPU> bvhNodes;
+	std::vector<BVHNodeCompact> bvhCompact;
+	BVHQuantization quantization;
+	std::vector<uint> bvhIndices;
+	bool bvhEncoded = bvh.Build(bvhNodes, bvhIndices, bvhCompact, quantization);
+
+	printf("\n%s: full vs compact nodes\n", name.c_str());
+	if (!kdEncoded || !bvhEncoded)
+	{
+		printf("tree does not fit the compact encoding\n");
+		return;
+	}
+	printf("%-12s %8s %10s %12s %12s\n", "", "nodes", "node size", "nodes(KB)", "indices(KB)");
+	printf("%-12s %8zu %10zu %12.1f %12.1f\n", "kd-tree", kdNodes.size(), sizeof(KDNode_GPU),
+		kdNodes.size() * sizeof(KDNode_GPU) / 1024.0, kdIndices.size() * sizeof(uint) / 1024.0);
+	printf("%-12s %8zu %10zu %12.1f %12.1f\n", "kd compact", kdCompact.size(), sizeof(KDNodeCompact),
+		kdCompact.size() * sizeof(KDNodeCompact) / 1024.0, kdIndices.size() * sizeof(uint) / 1024.0);
+	printf("%-12s %8zu %10zu %12.1f %12.1f\n", "bvh", bvhNodes.size(), sizeof(BVHNode_GPU),
+		bvhNodes.size() * sizeof(BVHNode_GPU) / 1024.0, bvhIndices.size() * sizeof(uint) / 1024.0);
+	printf("%-12s %8zu %10zu %12.1f %12.1f\n", "bvh compact", bvhCompact.size(), sizeof(BVHNodeCompact),
+		bvhCompact.size() * sizeof(BVHNodeCompact) / 1024.0, bvhIndices.size() * sizeof(uint) / 1024.0);
+
+	auto traceKD = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters) { TraceKDTree(mesh, kdNodes, kdIndices, ray, hit, counters); };
+	auto traceKDCompact = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+		{ TraceKDTreeCompact(mesh, kdCompact, kdNodes[0].box, kdIndices, ray, hit, counters); };
+	auto traceBVH = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters) { TraceBVH(mesh, bvhNodes, bvhIndices, ray, hit, counters); };
+	auto traceBVHCompact = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters)
+		{ TraceBVHCompact(mesh, bvhCompact, quantization, bvhIndices, ray, hit, counters); };
+
+	std::vector<CpuRay> primary = MakePrimaryRays(mesh, 256, 256);
+	std::vector<CpuHit> hits[4];
+	for (size_t i = 0; i < primary.size(); i++)
+	{
+		hits[0].push_back(CpuHit());
+		traceBVH(primary[i], hits[0].back(), nullptr);
+	}
+	const std::vector<CpuRay> raySets[2] = { primary, MakeDiffuseRays(mesh, primary, hits[0]) };
+	const char* setNames[2] = { "primary", "diffuse" };
+	printf("%-14s %9s %10s %10s %10s %9s\n", "rays", "count", "Mrays/s", "nodes/ray", "tris/ray", "overflow");
+	for (int set = 0; set < 2; set++)
+	{
+		std::string label = setNames[set];
+		RunRays((label + " kd").c_str(), raySets[set], hits[0], traceKD);
+		RunRays((label + " kd c").c_str(), raySets[set], hits[1], traceKDCompact);
+		RunRays((label + " bvh").c_str(), raySets[set], hits[2], traceBVH);
+		RunRays((label + " bvh c").c_str(), raySets[set], hits[3], traceBVHCompact);
+		printf("%s hits differing from the full encoding: kd %u, bvh %u\n", setNames[set],
+			CountMismatches(hits[0], hits[1]), CountMismatches(hits[2], hits[3]));
+	}
+}
+
+// Animates the mesh and keeps one BVH up to date with Refit, rebuilding only when
+// its SAH cost degrades past rebuildThreshold.  Each frame is compared with a
+// fresh build of the same geometry: update time, tree quality and trace speed.
+template<typename DeformFn>
+static void ReportRefit(const std::string& name, const TraceMesh& mesh, int frames, DeformFn deform)
+{
+	TraceMesh animated = mesh;
+	BVH bvh(mesh.TriangleCount());
+	FillTree(bvh, animated);
+	std::vector<BVHNode_GPU> nodes;
+	std::vector<uint> indices;
+	bvh.Build(nodes, indices);
+
+	printf("\n%s: refit vs rebuild (threshold %.2f)\n", name.c_str(), bvh.rebuildThreshold);
+	printf("%5s %10s %11s %9s %13s %13s %10s %8s\n",
+		"frame", "refit(ms)", "rebuild(ms)", "SAH/build", "refit Mrays/s", "fresh Mrays/s", "mismatch", "action");
+	for (int frame = 1; frame <= frames; frame++)
+	{
+		for (size_t v = 0; v < mesh.positions.size(); v += 3)
+			deform(frame, &mesh.positions[v], &animated.positions[v]);
+		std::vector<CpuRay> rays = MakePrimaryRays(animated, 128, 128);
+
+		auto start = Clock::now();
+		FillTree(bvh, animated);
+		bool keep = bvh.Refit(nodes, indices);
+		double refitMs = Milliseconds(start, Clock::now());
+		float degradation = bvh.refitCost / bvh.buildCost;
+
+		BVH fresh(mesh.TriangleCount());
+		FillTree(fresh, animated);
+		std::vector<BVHNode_GPU> freshNodes;
+		std::vector<uint> freshIndices;
+		start = Clock::now();
+		fresh.Build(freshNodes, freshIndices);
+		double buildMs = Milliseconds(start, Clock::now());
+
+		std::vector<CpuHit> refitHits(rays.size()), freshHits(rays.size());
+		start = Clock::now();
+		for (size_t i = 0; i < rays.size(); i++)
+			TraceBVH(animated, nodes, indices, rays[i], refitHits[i]);
+		double refitTraceMs = Milliseconds(start, Clock::now());
+		start = Clock::now();
+		for (size_t i = 0; i < rays.size(); i++)
+			TraceBVH(animated, freshNodes, freshIndices, rays[i], freshHits[i]);
+		double freshTraceMs = Milliseconds(start, Clock::now());
+
+		printf("%5d %10.2f %11.2f %9.2f %13.3f %13.3f %10u %8s\n", frame, refitMs, buildMs, degradation,
+			rays.size() / (refitTraceMs * 1000.0), rays.size() / (freshTraceMs * 1000.0),
+			CountMismatches(refitHits, freshHits), keep ? "refit" : "rebuild");
+		if (!keep)
+			bvh.Build(nodes, indices);
+	}
+}
+
+// A grid of randomly rotated and scaled copies of the mesh, like the skulls of
+// InstancingAndCulling, traced through one shared bottom-level tree.  Small scenes
+// are also baked into a single mesh to compare memory, speed and hits.
+static void ReportInstancing(const std::string& name, const TraceMesh& mesh, int n)
+{
+	std::vector<TraceBLAS> blases(1);
+	blases[0].mesh = &mesh;
+	auto start = Clock::now();
+	blases[0].Build();
+	double blasMs = Milliseconds(start, Clock::now());
+
+	BBox bounds = mesh.Bounds();
+	float size = std::max(bounds.max[0] - bounds.min[0], std::max(bounds.max[1] - bounds.min[1], bounds.max[2] - bounds.min[2]));
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	InstanceBVH top;
+	for (int k = 0; k < n; k++)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			for (int j = 0; j < n; j++)
+			{
+				float angle = dist(rng) * 6.2831853f;
+				float scale = 0.5f + dist(rng);
+				float c = cosf(angle) * scale;
+				float s = sinf(angle) * scale;
+				// Rotation about y, then a translation on a grid 1.5 mesh sizes apart.
+				float world[16] =
+				{
+					c, 0.0f, -s, 0.0f,
+					0.0f, scale, 0.0f, 0.0f,
+					s, 0.0f, c, 0.0f,
+					j * 1.5f * size, k * 1.5f * size, i * 1.5f * size, 1.0f
+				};
+				top.AddInstance(world, 0, bounds);
+			}
+		}
+	}
+	start = Clock::now();
+	top.Build();
+	double tlasMs = Milliseconds(start, Clock::now());
+
+	BBox sceneBounds = top.instances[0].bounds;
+	for (const TraceInstance& instance : top.instances)
+		sceneBounds.Join(instance.bounds);
+	std::vector<CpuRay> rays = MakePrimaryRays(sceneBounds, 256, 256);
+
+	size_t meshBytes = mesh.positions.size() * sizeof(float) * 2 + mesh.indices.size() * sizeof(uint);
+	size_t blasBytes = blases[0].nodes.size() * sizeof(BVHNode_GPU) + blases[0].indices.size() * sizeof(uint);
+	size_t twoLevelBytes = meshBytes + blasBytes + top.nodes.size() * sizeof(BVHNode_GPU) + top.instances.size() * sizeof(TraceInstance);
+	size_t count = top.instances.size();
+	printf("\n%s: %zu instances\n", name.c_str(), count);
+	printf("%-10s %10s %12s %10s %10s %10s\n", "", "build(ms)", "memory(MB)", "Mrays/s", "nodes/ray", "tris/ray");
+
+	TraceCounters counters;
+	std::vector<CpuHit> hits(rays.size());
+	start = Clock::now();
+	for (size_t r = 0; r < rays.size(); r++)
+		TraceInstances(top, blases, rays[r], hits[r], &counters);
+	double ms = Milliseconds(start, Clock::now());
+	printf("%-10s %10.2f %12.2f %10.3f %10.2f %10.2f\n", "two-level", blasMs + tlasMs, twoLevelBytes / 1048576.0,
+		rays.size() / (ms * 1000.0), (double)counters.nodesVisited / rays.size(), (double)counters.trianglesTested / rays.size());
+
+	// Baking scales mesh and tree memory with the instance count.
+	if (count * mesh.TriangleCount() > 1000000)
+	{
+		printf("%-10s %10s %12.2f  (not built, %zu triangles)\n", "flattened", "-", (meshBytes + blasBytes) * count / 1048576.0,
+			count * mesh.TriangleCount());
+		return;
+	}
+	TraceMesh flat;
+	uint vertexCount = (uint)mesh.positions.size() / 3;
+	for (const TraceInstance& instance : top.instances)
+	{
+		uint base = (uint)flat.positions.size() / 3;
+		for (uint v = 0; v < vertexCount; v++)
+		{
+			const float* p = &mesh.positions[v * 3];
+			for (int j = 0; j < 3; j++)
+				flat.positions.push_back(p[0] * instance.world[0][j] + p[1] * instance.world[1][j] + p[2] * instance.world[2][j] + instance.world[3][j]);
+		}
+		flat.normals.insert(flat.normals.end(), mesh.normals.begin(), mesh.normals.end());
+		for (uint index : mesh.indices)
+			flat.indices.push_back(base + index);
+	}
+	BVH bvh(flat.TriangleCount());
+	FillTree(bvh, flat);
+	std::vector<BVHNode_GPU> nodes;
+	std::vector<uint> indices;
+	start = Clock::now();
+	bvh.Build(nodes, indices);
+	double flatMs = Milliseconds(start, Clock::now());
+	size_t flatBytes = flat.positions.size() * sizeof(float) * 2 + flat.indices.size() * sizeof(uint) +
+		nodes.size() * sizeof(BVHNode_GPU) + indices.size() * sizeof(uint);
+
+	counters = TraceCounters();
+	std::vector<CpuHit> flatHits(rays.size());
+	start = Clock::now();
+	for (size_t r = 0; r < rays.size(); r++)
+		TraceBVH(flat, nodes, indices, rays[r], flatHits[r], &counters);
+	ms = Milliseconds(start, Clock::now());
+	printf("%-10s %10.2f %12.2f %10.3f %10.2f %10.2f\n", "flattened", flatMs, flatBytes / 1048576.0,
+		rays.size() / (ms * 1000.0), (double)counters.nodesVisited / rays.size(), (double)counters.trianglesTested / rays.size());
+	printf("hits differing from the flattened scene: %u\n", CountMismatches(hits, flatHits));
+}
+
+// Startup cost of parsing the text model and building the BVH against loading the
+// same data from a binary cache (hashing the model file included).
+static void ReportCache(const std::string& name)
+{
+	std::string cacheFile = name + ".bench.cache";
+	remove(cacheFile.c_str());
+	auto start = Clock::now();
+	TraceMesh mesh;
+	LoadTraceMeshText(name.c_str(), mesh);
+	double parseMs = Milliseconds(start, Clock::now());
+	start = Clock::now();
+	BVH bvh(mesh.TriangleCount());
+	FillTree(bvh, mesh);
+	std::vector<BVHNode_GPU> nodes;
+	std::vector<uint> indices;
+	bvh.Build(nodes, indices);
+	double buildMs = Milliseconds(start, Clock::now());
+
+	start = Clock::now();
+	uint64_t key = AccelCache::HashFile(name.c_str(), "bench-bvh", bvh.CacheSettings());
+	bool written = AccelCache::Write(cacheFile.c_str(), key, { MakeCacheSection(mesh.positions), MakeCacheSection(mesh.normals),
+		MakeCacheSection(mesh.indices), MakeCacheSection(nodes), MakeCacheSection(indices) });
+	double writeMs = Milliseconds(start, Clock::now());
+
+	start = Clock::now();
+	key = AccelCache::HashFile(name.c_str(), "bench-bvh", bvh.CacheSettings());
+	double hashMs = Milliseconds(start, Clock::now());
+	AccelCache cache;
+	size_t vertexFloats = 0, nodeCount = 0;
+	bool loaded = cache.Open(cacheFile.c_str(), key) && cache.Get<float>(0, vertexFloats) != nullptr &&
+		cache.Get<BVHNode_GPU>(3, nodeCount) != nullptr;
+	double openMs = Milliseconds(start, Clock::now());
+	// Views of every section in place, as RayTracingApp reads them before uploading.
+	CacheView<float> cachedPositions, cachedNormals;
+	CacheView<uint> cachedTriangles, cachedIndices;
+	CacheView<BVHNode_GPU> cachedNodes;
+	loaded = loaded && cache.Get(0, cachedPositions) && cache.Get(1, cachedNormals) && cache.Get(2, cachedTriangles) &&
+		cache.Get(3, cachedNodes) && cache.Get(4, cachedIndices) &&
+		BVH::StackSize(cachedNodes.data, cachedNodes.size()) <= BVH_MAX_STACK_SIZE;
+	double viewMs = Milliseconds(start, Clock::now());
+	bool identical = loaded && cachedPositions.size() == mesh.positions.size() && cachedTriangles.size() == mesh.indices.size() &&
+		cachedIndices.size() == indices.size() && cachedNodes.size() == nodes.size() &&
+		std::equal(cachedPositions.begin(), cachedPositions.end(), mesh.positions.begin()) &&
+		std::equal(cachedTriangles.begin(), cachedTriangles.end(), mesh.indices.begin()) &&
+		std::equal(cachedIndices.begin(), cachedIndices.end(), indices.begin()) &&
+		memcmp(cachedNodes.data, nodes.data(), nodes.size() * sizeof(BVHNode_GPU)) == 0;
+
+	printf("\n%s: text + build vs binary cache\n", name.c_str());
+	printf("parse %.2f ms + build %.2f ms; cache write %.2f ms\n", parseMs, buildMs, writeMs);
+	printf("hash %.2f ms, hash + map %.2f ms, hash + map + views %.2f ms (%s, %zu nodes)\n", hashMs, openMs, viewMs,
+		!written ? "not written" : identical ? "identical" : "MISMATCH", nodeCount);
+	AccelCache stale;
+	printf("stale key rejected: %s\n", stale.Open(cacheFile.c_str(), key ^ 1) ? "no" : "yes");
+	remove(cacheFile.c_str());
+}
+
+// Writes a mesh in the "VertexCount:/TriangleCount:" text format of Models/*.txt.
+static bool WriteTextMesh(const char* file, const TraceMesh& mesh)
+{
+	std::ofstream fout(file);
+	uint vcount = (uint)mesh.positions.size() / 3;
+	fout << "VertexCount: " << vcount << "\nTriangleCount: " << mesh.TriangleCount() << "\nVertexList (pos, normal)\n{\n";
+	for (uint i = 0; i < vcount; i++)
+	{
+		const float* p = &mesh.positions[i * 3];
+		const float* n = &mesh.normals[i * 3];
+		fout << '\t' << p[0] << ' ' << p[1] << ' ' << p[2] << ' ' << n[0] << ' ' << n[1] << ' ' << n[2] << '\n';
+	}
+	fout << "}\nTriangleList\n{\n";
+	for (uint i = 0; i < mesh.TriangleCount(); i++)
+		fout << '\t' << mesh.indices[i * 3 + 0] << ' ' << mesh.indices[i * 3 + 1] << ' ' << mesh.indices[i * 3 + 2] << '\n';
+	fout << "}\n";
+	return (bool)fout;
+}
+
+// The ifstream extraction loop every sample used before Common/TextMesh.
+static bool LoadTextMeshStream(const char* file, TextMeshData& mesh)
+{
+	std::ifstream fin(file);
+	if (!fin)
+		return false;
+	uint vcount = 0;
+	uint tcount = 0;
+	std::string ignore;
+	fin >> ignore >> vcount;
+	fin >> ignore >> tcount;
+	fin >> ignore >> ignore >> ignore >> ignore;
+	mesh.Positions.resize(vcount * 3);
+	mesh.Normals.resize(vcount * 3);
+	for (uint i = 0; i < vcount; ++i)
+	{
+		fin >> mesh.Positions[i * 3 + 0] >> mesh.Positions[i * 3 + 1] >> mesh.Positions[i * 3 + 2];
+		fin >> mesh.Normals[i * 3 + 0] >> mesh.Normals[i * 3 + 1] >> mesh.Normals[i * 3 + 2];
+	}
+	fin >> ignore >> ignore >> ignore;
+	mesh.Indices32.resize(tcount * 3);
+	for (uint i = 0; i < tcount * 3; ++i)
+		fin >> mesh.Indices32[i];
+	return (bool)fin;
+}
+
+// Parse throughput of the ifstream loop against the in-place scanner of LoadTextMesh.
+static void ReportTextParse(const std::string& name)
+{
+	auto start = Clock::now();
+	TextMeshData stream;
+	if (!LoadTextMeshStream(name.c_str(), stream) || stream.TriangleCount() == 0)
+		return;
+	double streamMs = Milliseconds(start, Clock::now());
+	start = Clock::now();
+	TextMeshData fast;
+	bool parsed = LoadTextMesh(name.c_str(), fast);
+	double fastMs = Milliseconds(start, Clock::now());
+
+	uint64_t bytes = 0;
+	{
+		std::ifstream fin(name.c_str(), std::ios::binary | std::ios::ate);
+		bytes = (uint64_t)fin.tellg();
+	}
+	uint differing = 0;
+	for (size_t i = 0; parsed && i < stream.Positions.size(); i++)
+		differing += stream.Positions[i] != fast.Positions[i] || stream.Normals[i] != fast.Normals[i];
+	bool indicesMatch = parsed && stream.Indices32 == fast.Indices32;
+	TraceMesh bounds;
+	bounds.positions = stream.Positions;
+	BBox box = bounds.Bounds();
+	bool boundsMatch = parsed && memcmp(fast.BoundsMin, box.min, sizeof(box.min)) == 0 &&
+		memcmp(fast.BoundsMax, box.max, sizeof(box.max)) == 0;
+
+	printf("\n%s: text parse throughput (%.2f MB, %u triangles)\n", name.c_str(), bytes / 1048576.0, stream.TriangleCount());
+	printf("%-10s %10s %10s %14s\n", "parser", "ms", "MB/s", "Mtriangles/s");
+	printf("%-10s %10.2f %10.1f %14.2f\n", "ifstream", streamMs, bytes / 1048576.0 / (streamMs / 1000.0), stream.TriangleCount() / (streamMs * 1000.0));
+	printf("%-10s %10.2f %10.1f %14.2f\n", "scanner", fastMs, bytes / 1048576.0 / (fastMs / 1000.0), stream.TriangleCount() / (fastMs * 1000.0));
+	printf("floats differing: %u of %zu, indices %s, bounds %s\n", differing, stream.Positions.size() * 2,
+		indicesMatch ? "identical" : "MISMATCH", boundsMatch ? "match" : "MISMATCH");
+}
+
+// Load time of a text model against its converted .mesh file, per million triangles.
+static void ReportMeshFile(const std::string& name)
+{
+	std::string meshName = name + ".bench.mesh";
+	auto start = Clock::now();
+	TraceMesh text;
+	if (!LoadTraceMeshText(name.c_str(), text) || text.TriangleCount() == 0)
+		return;
+	double parseMs = Milliseconds(start, Clock::now());
+	start = Clock::now();
+	bool converted = MeshFile::Convert(name.c_str(), meshName.c_str());
+	double convertMs = Milliseconds(start, Clock::now());
+
+	start = Clock::now();
+	MeshFile mesh;
+	bool opened = converted && mesh.Open(meshName.c_str());
+	double openMs = Milliseconds(start, Clock::now());
+	// Reads every stream once, which is what an upload from the mapping costs.
+	uint64_t checksum = 0;
+	if (opened)
+	{
+		const uint32_t* words[] = { (const uint32_t*)mesh.Positions(), (const uint32_t*)mesh.Normals(), mesh.Indices() };
+		size_t counts[] = { mesh.VertexCount() * 3u, mesh.VertexCount() * 3u, mesh.IndexCount() };
+		for (int s = 0; s < 3; s++)
+			for (size_t i = 0; i < counts[s]; i++)
+				checksum += words[s][i];
+	}
+	double touchMs = Milliseconds(start, Clock::now());
+	bool identical = opened && mesh.IndexCount() == text.indices.size() &&
+		memcmp(mesh.Positions(), text.positions.data(), text.positions.size() * sizeof(float)) == 0 &&
+		memcmp(mesh.Normals(), text.normals.data(), text.normals.size() * sizeof(float)) == 0 &&
+		memcmp(mesh.Indices(), text.indices.data(), text.indices.size() * sizeof(uint)) == 0;
+	BBox bounds = text.Bounds();
+	bool boundsMatch = opened && memcmp(mesh.BoundsMin(), bounds.min, sizeof(bounds.min)) == 0 &&
+		memcmp(mesh.BoundsMax(), bounds.max, sizeof(bounds.max)) == 0;
+
+	double perMillion = 1e6 / text.TriangleCount();
+	printf("\n%s: text vs .mesh (%u triangles)\n", name.c_str(), text.TriangleCount());
+	printf("%-14s %12s %16s\n", "path", "ms", "ms/Mtriangles");
+	printf("%-14s %12.2f %16.2f\n", "text parse", parseMs, parseMs * perMillion);
+	printf("%-14s %12.2f %16.2f\n", "convert", convertMs, convertMs * perMillion);
+	printf("%-14s %12.3f %16.3f\n", "map", openMs, openMs * perMillion);
+	printf("%-14s %12.3f %16.3f\n", "map + read", touchMs, touchMs * perMillion);
+	printf("streams %s, bounds %s (checksum %llx)\n", !opened ? "not written" : identical ? "identical" : "MISMATCH",
+		boundsMatch ? "match" : "MISMATCH", (unsigned long long)checksum);
+	mesh.Close();
+	remove(meshName.c_str());
+}
+
+// Converts a text model to a .mesh file offline.
+static int ConvertMesh(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		printf("usage: RayTracingBench convert <model.txt> <model.mesh>\n");
+		return 1;
+	}
+	if (!MeshFile::Convert(argv[2], argv[3]))
+	{
+		printf("failed to convert %s\n", argv[2]);
+		return 1;
+	}
+	return 0;
+}
+
+// Reorders a row-major ray grid into 4x2 pixel tiles made of two 2x2 quads, so
+// every 4 (or 8) consecutive rays form a coherent packet.
+static std::vector<CpuRay> TileOrder(const std::vector<CpuRay>& rays, int width, int height)
+{
+	std::vector<CpuRay> tiled;
+	tiled.reserve(rays.size());
+	for (int by = 0; by < height; by += 2)
+		for (int bx = 0; bx < width; bx += 4)
+			for (int quad = 0; quad < 2; quad++)
+				for (int y = by; y < std::min(by + 2, height); y++)
+					for (int x = bx + quad * 2; x < std::min(bx + quad * 2 + 2, width); x++)
+						tiled.push_back(rays[y * width + x]);
+	return tiled;
+}
+
+template<typename PacketFn>
+static void RunPackets(const char* label, const std::vector<CpuRay>& rays, std::vector<CpuHit>& hits, int width, PacketFn trace)
+{
+	TraceCounters counters;
+	hits.assign(rays.size(), CpuHit());
+	auto start = Clock::now();
+	for (size_t i = 0; i < rays.size(); i += width)
+		trace(&rays[i], &hits[i], (int)std::min<size_t>(width, rays.size() - i), &counters);
+	double ms = Milliseconds(start, Clock::now());
+	printf("%-14s %9zu %10.3f %10.2f %10.2f %9.1f%%\n", label, rays.size(), rays.size() / (ms * 1000.0),
+		(double)counters.nodesVisited * width / rays.size(), (double)counters.trianglesTested * width / rays.size(),
+		100.0 * counters.packetFallbacks / rays.size());
+}
+
+// Scalar against 4 (and with AVX, 8) wide packets on coherent primary rays and
+// incoherent diffuse bounces.  Packet node and triangle counts are per packet
+// step scaled by the packet width, so they compare directly with the scalar ones.
+static void ComparePacketTraversal(const std::string& name, const TraceMesh& mesh)
+{
+	CpuScene kd, bvh;
+	kd.mesh = bvh.mesh = &mesh;
+	kd.accel = CpuAccel::KDTree;
+	kd.BuildAccel();
+	bvh.BuildAccel();
+
+	auto traceKD = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters) { TraceKDTree(mesh, kd.kdNodes, kd.indices, ray, hit, counters); };
+	auto traceBVH = [&](const CpuRay& ray, CpuHit& hit, TraceCounters* counters) { TraceBVH(mesh, bvh.bvhNodes, bvh.indices, ray, hit, counters); };
+	auto kd4 = [&](const CpuRay* r, CpuHit* h, int n, TraceCounters* c) { TraceKDTreePacket4(mesh, kd.kdNodes, kd.indices, r, h, n, c); };
+	auto bvh4 = [&](const CpuRay* r, CpuHit* h, int n, TraceCounters* c) { TraceBVHPacket4(mesh, bvh.bvhNodes, bvh.indices, r, h, n, c); };
+#if PACKET_TRACER_AVX
+	auto kd8 = [&](const CpuRay* r, CpuHit* h, int n, TraceCounters* c) { TraceKDTreePacket8(mesh, kd.kdNodes, kd.indices, r, h, n, c); };
+	auto bvh8 = [&](const CpuRay* r, CpuHit* h, int n, TraceCounters* c) { TraceBVHPacket8(mesh, bvh.bvhNodes, bvh.indices, r, h, n, c); };
+#endif
+
+	std::vector<CpuRay> primary = MakePrimaryRays(mesh, 256, 256);
+	std::vector<CpuHit> scalarHits(primary.size()), packetHits, referenceHits;
+	for (size_t i = 0; i < primary.size(); i++)
+		traceBVH(primary[i], scalarHits[i], nullptr);
+	std::vector<CpuRay> diffuse = MakeDiffuseRays(mesh, primary, scalarHits);
+	const std::vector<CpuRay> raySets[2] = { TileOrder(primary, 256, 256), diffuse };
+	const char* setNames[2] = { "primary", "diffuse" };
+
+	printf("\n%s: scalar vs packet traversal\n", name.c_str());
+#if !PACKET_TRACER_AVX
+	printf("8-wide packets skipped: built without AVX\n");
+#endif
+	printf("%-14s %9s %10s %10s %10s %10s\n", "rays", "count", "Mrays/s", "nodes/ray", "tris/ray", "fallback");
+	for (int set = 0; set < 2; set++)
+	{
+		const std::vector<CpuRay>& rays = raySets[set];
+		std::string label = setNames[set];
+		// The single-ray BVH walk is the reference.
+		uint mismatches = 0;
+		RunRays((label + " bvh").c_str(), rays, referenceHits, traceBVH);
+		RunRays((label + " kd").c_str(), rays, scalarHits, traceKD);
+		RunPackets((label + " kd x4").c_str(), rays, packetHits, 4, kd4);
+		mismatches += CountMismatches(referenceHits, packetHits);
+#if PACKET_TRACER_AVX
+		RunPackets((label + " kd x8").c_str(), rays, packetHits, 8, kd8);
+		mismatches += CountMismatches(referenceHits, packetHits);
+#endif
+		RunPackets((label + " bvh x4").c_str(), rays, packetHits, 4, bvh4);
+		mismatches += CountMismatches(referenceHits, packetHits);
+#if PACKET_TRACER_AVX
+		RunPackets((label + " bvh x8").c_str(), rays, packetHits, 8, bvh8);
+		mismatches += CountMismatches(referenceHits, packetHits);
+#endif
+		printf("%s packet hits differing from single-ray bvh: %u\n", label.c_str(), mismatches);
+	}
+}
+
+static void SphereCamera(CpuCamera& camera, int width, int height)
+{
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+	float eye[3] = { -12.0f, 14.0f, -12.0f };
+	float target[3] = { 28.0f, 0.0f, 28.0f };
+	camera.LookAt(eye, target, up, 0.25f * 3.14159265f, (float)width / height);
+}
+
+// Looks at the model from the front, a little above and to the side.
+static void ModelCamera(CpuCamera& camera, const TraceMesh& mesh, int width, int height)
+{
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+	BBox bounds = mesh.Bounds();
+	float target[3];
+	bounds.GetCenter(target);
+	float extent = std::max(bounds.max[0] - bounds.min[0], std::max(bounds.max[1] - bounds.min[1], bounds.max[2] - bounds.min[2]));
+	float eye[3] = { target[0] + 0.6f * extent, target[1] + 0.5f * extent, target[2] - 1.6f * extent };
+	camera.LookAt(eye, target, up, 0.25f * 3.14159265f, (float)width / height);
+}
+
+// Root mean square error, absolute and relative to the reference (the error the
+// adaptive sampler targets).
+static void ImageError(const CpuImage& image, const CpuImage& reference, double& rmse, double& relative)
+{
+	double sum = 0.0;
+	double relativeSum = 0.0;
+	for (size_t i = 0; i < image.pixels.size(); i++)
+	{
+		double d = image.pixels[i] - reference.pixels[i];
+		double r = std::max((double)reference.pixels[i], 0.01);
+		sum += d * d;
+		relativeSum += d * d / (r * r);
+	}
+	rmse = sqrt(sum / image.pixels.size());
+	relative = sqrt(relativeSum / image.pixels.size());
+}
+
+// Adaptive sampling at a few target errors against uniform sampling with the same
+// average sample count, both measured against a high sample count reference.
+static void ReportAdaptiveSampling(int width, int height, int maxSamples, int referenceSamples)
+{
+	CpuScene scene;
+	scene.AddRandomSpheres(64);
+	CpuCamera camera;
+	SphereCamera(camera, width, height);
+
+	CpuImage reference;
+	reference.Resize(width, height);
+	CpuRenderSettings settings;
+	settings.samples = referenceSamples;
+	settings.seed = 7;
+	CpuRenderStats stats = RenderCpu(scene, camera, settings, reference);
+	printf("spheres %dx%d reference: %d samples in %.1f ms\n", width, height, referenceSamples, stats.seconds * 1e3);
+
+	const float targets[] = { 0.1f, 0.05f, 0.02f };
+	CpuImage image;
+	image.Resize(width, height);
+	for (float target : targets)
+	{
+		settings = CpuRenderSettings();
+		settings.samples = maxSamples;
+		settings.targetError = target;
+		CpuRenderStats adaptive = RenderCpu(scene, camera, settings, image);
+		double adaptiveError, adaptiveRelative;
+		ImageError(image, reference, adaptiveError, adaptiveRelative);
+		double averageSamples = (double)adaptive.samples / (width * height);
+
+		settings = CpuRenderSettings();
+		settings.samples = std::max(1, (int)(averageSamples + 0.5));
+		CpuRenderStats uniform = RenderCpu(scene, camera, settings, image);
+		double uniformError, uniformRelative;
+		ImageError(image, reference, uniformError, uniformRelative);
+
+		printf("  target %.2f: adaptive %.1f spp (%.1f%% converged) rmse %.4f rel %.4f %.1f ms | uniform %d spp rmse %.4f rel %.4f %.1f ms\n",
+			target, averageSamples, 100.0 * adaptive.convergedPixels / (width * height), adaptiveError, adaptiveRelative,
+			adaptive.seconds * 1e3, settings.samples, uniformError, uniformRelative, uniform.seconds * 1e3);
+	}
+}
+
+// Error against a reference as the sample count doubles, for the shader's hash rand()
+// and the scrambled Sobol sampler.  The reference uses differently seeded Sobol points.
+static void ReportSamplerConvergence(int width, int height, int maxSamples, int referenceSamples)
+{
+	CpuScene scene;
+	scene.AddRandomSpheres(64);
+	CpuCamera camera;
+	SphereCamera(camera, width, height);
+
+	CpuImage reference;
+	reference.Resize(width, height);
+	CpuRenderSettings settings;
+	settings.samples = referenceSamples;
+	settings.seed = 7;
+	RenderCpu(scene, camera, settings, reference);
+
+	printf("spheres %dx%d rmse vs samples (%d sample reference):\n", width, height, referenceSamples);
+	printf("  %6s %10s %10s %8s\n", "spp", "hash", "sobol", "ratio");
+	CpuImage image;
+	image.Resize(width, height);
+	for (int samples = 1; samples <= maxSamples; samples *= 2)
+	{
+		double error[2];
+		const CpuSampler samplers[2] = { CpuSampler::Hash, CpuSampler::Sobol };
+		for (int i = 0; i < 2; i++)
+		{
+			settings = CpuRenderSettings();
+			settings.samples = samples;
+			settings.sampler = samplers[i];
+			RenderCpu(scene, camera, settings, image);
+			double relative;
+			ImageError(image, reference, error[i], relative);
+		}
+		printf("  %6d %10.4f %10.4f %8.2f\n", samples, error[0], error[1], error[0] / error[1]);
+	}
+}
+
+// Megakernel against wavefront rendering of the same frame: both must produce the
+// same image, the wavefront stats show where the time goes and how the queues shrink.
+static void ReportWavefront(const char* name, const CpuScene& scene, const CpuCamera& camera, int width, int height, int samples)
+{
+	CpuImage megakernel, wavefront;
+	megakernel.Resize(width, height);
+	wavefront.Resize(width, height);
+	CpuRenderSettings settings;
+	settings.samples = samples;
+	CpuRenderStats megaStats = RenderCpu(scene, camera, settings, megakernel);
+	settings.wavefront = true;
+	CpuRenderStats waveStats = RenderCpu(scene, camera, settings, wavefront);
+
+	float maxDifference = 0.0f;
+	for (size_t i = 0; i < megakernel.pixels.size(); i++)
+		maxDifference = std::max(maxDifference, fabsf(megakernel.pixels[i] - wavefront.pixels[i]));
+	printf("%s %dx%d, %d samples: megakernel %.1f ms %.2f Mrays/s | wavefront %.1f ms %.2f Mrays/s, max difference %g\n",
+		name, width, height, samples, megaStats.seconds * 1e3, megaStats.RaysPerSecond() / 1e6,
+		waveStats.seconds * 1e3, waveStats.RaysPerSecond() / 1e6, maxDifference);
+	printf("  stages: generate %.1f ms, extend %.1f ms, shade %.1f ms, compact %.1f ms\n",
+		waveStats.generateSeconds * 1e3, waveStats.extendSeconds * 1e3, waveStats.shadeSeconds * 1e3, waveStats.compactSeconds * 1e3);
+	printf("  paths per bounce:");
+	for (uint64_t paths : waveStats.bouncePaths)
+		printf(" %.1f%%", 100.0 * paths / waveStats.bouncePaths[0]);
+	printf("\n");
+}
+
+// Renders a reference frame with the CPU integrator and reports rays/sec.
+static int RenderReference(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		printf("usage: RayTracingBench render <model.txt|spheres> <output> [width height samples kd|bvh targetError]\n");
+		return 1;
+	}
+	int width = argc > 4 ? atoi(argv[4]) : 800;
+	int height = argc > 5 ? atoi(argv[5]) : 600;
+	CpuRenderSettings settings;
+	settings.samples = argc > 6 ? atoi(argv[6]) : 16;
+	settings.targetError = argc > 8 ? (float)atof(argv[8]) : 0.0f;
+
+	CpuScene scene;
+	TraceMesh mesh;
+	CpuCamera camera;
+	if (strcmp(argv[2], "spheres") == 0)
+	{
+		scene.AddRandomSpheres(64);
+		SphereCamera(camera, width, height);
+	}
+	else
+	{
+		if (!LoadTraceMesh(argv[2], mesh))
+		{
+			printf("%s not found.\n", argv[2]);
+			return 1;
+		}
+		scene.mesh = &mesh;
+		scene.accel = (argc > 7 && strcmp(argv[7], "kd") == 0) ? CpuAccel::KDTree : CpuAccel::BVH;
+		scene.BuildAccel();
+		ModelCamera(camera, mesh, width, height);
+	}
+
+	CpuImage image;
+	image.Resize(width, height);
+	CpuRenderStats stats = RenderCpu(scene, camera, settings, image);
+	printf("%dx%d, %d samples: %.2f s, %llu rays, %.3f Mrays/s\n", width, height, settings.samples,
+		stats.seconds, (unsigned long long)stats.rays, stats.RaysPerSecond() / 1e6);
+	if (settings.targetError > 0.0f)
+		printf("target error %.3f: %.1f samples/pixel, %llu of %d pixels converged\n", settings.targetError,
+			(double)stats.samples / (width * height), (unsigned long long)stats.convergedPixels, width * height);
+
+	std::string output = argv[3];
+	if (!image.WritePFM((output + ".pfm").c_str()) || !image.WritePPM((output + ".ppm").c_str()))
+	{
+		printf("failed to write %s.pfm/.ppm\n", output.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && strcmp(argv[1], "render") == 0)
+		return RenderReference(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "convert") == 0)
+		return ConvertMesh(argc, argv);
+
+	std::vector<const char*> files;
+	for (int i = 1; i < argc; i++)
+		files.push_back(argv[i]);
+	if (files.empty())
+	{
+		files.push_back("Models/car.txt");
+		files.push_back("Models/skull.txt");
+	}
+	for (const char* file : files)
+	{
+		TraceMesh mesh;
+		if (!LoadTraceMesh(file, mesh))
+		{
+			printf("%s not found.\n", file);
+			continue;
+		}
+		ReportBuilders(file, mesh);
+		ReportCache(file);
+		ReportTextParse(file);
+		ReportMeshFile(file);
+		ReportBuildScaling(file, mesh);
+		CompareAccelerators(file, mesh);
+		CompareCompactNodes(file, mesh);
+		BBox bounds = mesh.Bounds();
+		float center[3];
+		bounds.GetCenter(center);
+		float height = std::max(bounds.max[1] - bounds.min[1], 1e-6f);
+		// Twists the model about its vertical axis, more with every frame.
+		ReportInstancing(file, mesh, 2);
+		ReportInstancing(file, mesh, 16);
+		ReportRefit(file, mesh, 12, [&](int frame, const float* in, float* out)
+		{
+			float angle = frame * 0.15f * (in[1] - bounds.min[1]) / height;
+			float x = in[0] - center[0];
+			float z = in[2] - center[2];
+			out[0] = center[0] + x * cosf(angle) - z * sinf(angle);
+			out[1] = in[1];
+			out[2] = center[2] + x * sinf(angle) + z * cosf(angle);
+		});
+		ComparePacketTraversal(file, mesh);
+
+		CpuScene scene;
+		scene.mesh = &mesh;
+		scene.BuildAccel();
+		CpuCamera camera;
+		ModelCamera(camera, mesh, 160, 120);
+		ReportWavefront(file, scene, camera, 160, 120, 4);
+	}
+
+	GeometryGenerator geoGen;
+	ReportBuildScaling("geosphere(7)", ToTraceMesh(geoGen.CreateGeosphere(1.0f, 7)));
+	ReportBuildScaling("sphere(1024x512)", ToTraceMesh(geoGen.CreateSphere(1.0f, 1024, 512)));
+	TraceMesh grid = ToTraceMesh(geoGen.CreateGrid(100.0f, 100.0f, 1024, 1024));
+	ReportBuildScaling("grid(1024x1024)", grid);
+	if (WriteTextMesh("grid1024.bench.txt", grid))
+	{
+		ReportTextParse("grid1024.bench.txt");
+		ReportMeshFile("grid1024.bench.txt");
+	}
+	remove("grid1024.bench.txt");
+	// Travelling waves on a grid like the one in the Waves demos.
+	ReportRefit("grid(256x256) waves", ToTraceMesh(geoGen.CreateGrid(100.0f, 100.0f, 256, 256)), 12,
+		[](int frame, const float* in, float* out)
+	{
+		out[0] = in[0];
+		out[1] = 2.0f * sinf(0.2f * in[0] + 0.5f * frame) * cosf(0.15f * in[2] + 0.3f * frame);
+		out[2] = in[2];
+	});
+	CpuScene spheres;
+	spheres.AddRandomSpheres(64);
+	CpuCamera sphereCamera;
+	SphereCamera(sphereCamera, 160, 120);
+	ReportWavefront("spheres", spheres, sphereCamera, 160, 120, 16);
+	ReportAdaptiveSampling(96, 72, 256, 1024);
+	ReportSamplerConvergence(96, 72, 256, 1024);
+	return 0;
+}
@@ -0,0 +1,72 @@
+#include "Sampler.h"
+
+uint HashUint(uint x)
+{
+	// lowbias32 by Chris Wellons.
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+uint HashCombine(uint seed, uint value)
+{
+	return seed ^ (HashUint(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+static uint ReverseBits(uint x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// Scrambles the bits of x, least significant first: every bit only depends on the
+// ones below it, which is an Owen scramble once the bits are reversed.
+static uint LaineKarrasPermutation(uint x, uint seed)
+{
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed)
+{
+	return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+// Second Sobol dimension; its direction numbers follow v[k+1] = v[k] ^ (v[k] >> 1).
+static uint Sobol1(uint index)
+{
+	uint result = 0;
+	for (uint v = 0x80000000u; index != 0; index >>= 1, v ^= v >> 1)
+	{
+		if (index & 1)
+			result ^= v;
+	}
+	return result;
+}
+
+void SobolOwen2D(uint index, uint seed, float* u)
+{
+	// Shuffling the index decorrelates the dimension pairs from each other.
+	index = NestedUniformScramble(index, seed);
+	uint x = NestedUniformScramble(ReverseBits(index), HashCombine(seed, 0));
+	uint y = NestedUniformScramble(Sobol1(index), HashCombine(seed, 1));
+	// 24 bits keep the result below 1 in single precision.
+	u[0] = (x >> 8) * (1.0f / 16777216.0f);
+	u[1] = (y >> 8) * (1.0f / 16777216.0f);
+}
+
+uint PixelSeed(uint x, uint y, uint seed)
+{
+	return HashCombine(HashUint(x | (y << 16)), seed);
+}
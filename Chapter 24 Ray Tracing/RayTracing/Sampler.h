@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+
+typedef unsigned int uint;
+
+// Low-discrepancy samples for the path tracer, mirrored by Shaders/Sampling.hlsl.
+// Every 2D dimension pair the integrator draws (pixel jitter, then one hemisphere
+// sample per bounce) is the first two Sobol dimensions, shuffled and Owen-scrambled
+// with a hash of the pixel and the dimension, following Burley, "Practical
+// Hash-based Owen Scrambling" (JCGT 2020).  Each pixel's samples stay stratified
+// across frames as long as the sample index keeps counting up.
+
+uint HashUint(uint x);
+uint HashCombine(uint seed, uint value);
+// Owen scrambling of the bits of x, most significant bit first.
+uint NestedUniformScramble(uint x, uint seed);
+// Point index of the shuffled, scrambled 2D Sobol sequence, in [0,1)^2.
+void SobolOwen2D(uint index, uint seed, float* u);
+// Seed of a pixel's sequence; dimension pairs use HashCombine(pixelSeed, dimension).
+uint PixelSeed(uint x, uint y, uint seed);
@@ -1,6 +1,15 @@
+#include "Sampling.hlsl"
+
 TextureCube gCubeMap : register(t0);
 Texture2D gTexture2D : register(t0);
 RWTexture2D<float4> gOutput : register(u0);
+#if ADAPTIVE_SAMPLING
+// Running mean in rgb and the sample count in a, plus the mean and M2 (Welford) of
+// the luminance; the CS skips pixels whose relative error reached gTargetError.
+RWTexture2D<float4> gAccumulation : register(u1);
+RWTexture2D<float2> gMoments : register(u2);
+RWStructuredBuffer<uint> gActivePixels : register(u3);
+#endif
 
 SamplerState gsamPointWrap        : register(s0);
 SamplerState gsamPointClamp       : register(s1);
@@ -22,6 +31,13 @@ cbuffer rtPass : register(b0)
 	float _Seed;
 	int NumSpheres;
 	int NumTriangles;
+	float3 gNodeOrigin;	// quantization grid of the compact BVH nodes
+	float3 gNodeScale;
+	int gResetAccumulation;
+	float gTargetError;
+	int gMinSamples;
+	int gMaxSamples;
+	int gSampleIndex;	// frames accumulated since the last reset
 };
 cbuffer accPass : register(b0)
 {
@@ -60,6 +76,9 @@ struct Triangle
 	uint indices[3];
 	uint material;
 };
+// Depth-first layout.  Interior nodes store their split plane, leaves link to the
+// neighbouring node across each face (-x,+x,-y,+y,-z,+z).
+static const uint KD_NO_ROPE = 0xFFFFFFFF;
 struct KDNode
 {
 	float3 min;
@@ -68,14 +87,53 @@ struct KDNode
 	uint right;
 	uint start;
 	uint count;
+	uint axis;	// 3 for leaves
+	float split;
+	uint ropes[6];
+};
+// Depth-first layout: the left child follows its parent, offset is the right
+// child for interior nodes and the first index for leaves.
+struct BVHNode
+{
+	float3 min;
+	float3 max;
+	uint offset;
+	uint count;
+};
+// 16 bit box on the gNodeOrigin/gNodeScale grid, packed min.xy, min.z max.x,
+// max.yz.  link is right child << 1, or start << 8 | count << 1 | 1 for leaves.
+struct BVHNodeCompact
+{
+	uint3 bounds;
+	uint link;
 };
 StructuredBuffer<Sphere> gSpheres : register(t1);
 StructuredBuffer<Vertex> gVertices : register(t2);
 StructuredBuffer<Triangle> gTriangles : register(t3);
+#if USE_BVH && USE_COMPACT_NODES
+StructuredBuffer<BVHNodeCompact> gBVHNodes : register(t4);
+#elif USE_BVH
+StructuredBuffer<BVHNode> gBVHNodes : register(t4);
+#else
 StructuredBuffer<KDNode> gNodes : register(t4);
+#endif
 StructuredBuffer<uint> gIndices : register(t5);
+#if USE_INSTANCES
+// Uploaded without transposing, like the pass matrices: mul(invWorld, p) maps a
+// world point into object space.
+struct Instance
+{
+	float4x4 invWorld;
+};
+StructuredBuffer<Instance> gInstances : register(t6);
+// Top-level BVH; leaves cover contiguous ranges of gInstances.
+StructuredBuffer<BVHNode> gTLASNodes : register(t7);
+#endif
 
 static float2 _Pixel;
+static uint _SampleIndex;
+static uint _PixelSeed;
+static uint _Dimension;
 static const float PI = 3.14159265358979;
 float rand()
 {
@@ -83,6 +141,17 @@ float rand()
 	_Seed += 1.0f;
 	return result;
 }
+// Next dimension pair of the current pixel sample.
+float2 Sample2D()
+{
+#if USE_SOBOL
+	return SobolOwen2D(_SampleIndex, HashCombine(_PixelSeed, _Dimension++));
+#else
+	float u = rand();
+	float v = rand();
+	return float2(u, v);
+#endif
+}
 float3x3 GetTangentSpace(float3 normal)
 {
 	// Choose a helper vector for the cross product
@@ -97,9 +166,10 @@ float3x3 GetTangentSpace(float3 normal)
 float3 SampleHemisphere(float3 normal)
 {
 	// Uniformly sample hemisphere direction
-	float cosTheta = rand();
+	float2 u = Sample2D();
+	float cosTheta = u.x;
 	float sinTheta = sqrt(max(0.0f, 1.0f - cosTheta * cosTheta));
-	float phi = 2 * PI * rand();
+	float phi = 2 * PI * u.y;
 	float3 tangentSpaceDir = float3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
 	// Transform direction to world space
 	return mul(tangentSpaceDir, GetTangentSpace(normal));
@@ -179,6 +249,16 @@ bool IntersectBox(float3 min, float3 max, Ray r)
 		tmax = tzmax;
 	return true;
 }
+// Returns the entry and exit distances of the ray; it misses when x > y.
+float2 IntersectBoxRange(float3 boxMin, float3 boxMax, Ray r)
+{
+	float3 invDir = 1.0f / r.direction;
+	float3 t0 = (boxMin - r.origin) * invDir;
+	float3 t1 = (boxMax - r.origin) * invDir;
+	float3 tsmaller = min(t0, t1);
+	float3 tbigger = max(t0, t1);
+	return float2(max(tsmaller.x, max(tsmaller.y, tsmaller.z)), min(tbigger.x, min(tbigger.y, tbigger.z)));
+}
 void IntersectGroundPlane(Ray ray, inout RayHit bestHit)
 {
 	// Calculate distance along the ray where the ground plane is intersected
@@ -264,46 +344,201 @@ RayHit Trace(Ray ray)
 	//IntersectGroundPlane(ray, bestHit);
 	return bestHit;
 }*/
-RayHit Trace(Ray ray)
+void IntersectLeaf(Ray ray, uint start, uint count, inout RayHit bestHit)
 {
-	RayHit bestHit = CreateRayHit();
-#if KDTREE_TESTING
-	uint NumNodes = 0;
-	uint Nodes[256];
-	Nodes[NumNodes++] = 0;
-	for (uint i = 0; i < NumNodes; i++)
+	for (uint j = 0; j < count; j++)
 	{
-		KDNode node = gNodes[Nodes[i]];
+		Triangle tri = gTriangles[gIndices[start + j]];
+		Vertex v0 = gVertices[tri.indices[0]];
+		Vertex v1 = gVertices[tri.indices[1]];
+		Vertex v2 = gVertices[tri.indices[2]];
+		float t, u, v;
+		if (IntersectTriangle_MT97(ray, v0.position, v1.position, v2.position, t, u, v) && t > 0 && t < bestHit.distance)
+		{
+			float w = 1 - u - v;
+			bestHit.distance = t;
+			bestHit.position = ray.origin + t * ray.direction;
+			bestHit.normal = normalize(v0.normal * u + v1.normal * v + v2.normal * w);
+		//	bestHit.albedo = sphere.albedo;
+		//	bestHit.specular = sphere.specular;
+		}
+	}
+}
+#if USE_BVH
+// Sized by the app from the depth of the trees it built (BVH::StackSize), so the
+// ordered traversals below never run out of entries.
+#ifndef BVH_STACK_SIZE
+#define BVH_STACK_SIZE 64
+#endif
+#ifndef TLAS_STACK_SIZE
+#define TLAS_STACK_SIZE 64
+#endif
+#if USE_COMPACT_NODES
+float2 IntersectBVHNode(uint index, Ray ray)
+{
+	uint3 b = gBVHNodes[index].bounds;
+	float3 boxMin = gNodeOrigin + float3(b.x & 0xFFFF, b.x >> 16, b.y & 0xFFFF) * gNodeScale;
+	float3 boxMax = gNodeOrigin + float3(b.y >> 16, b.z & 0xFFFF, b.z >> 16) * gNodeScale;
+	return IntersectBoxRange(boxMin, boxMax, ray);
+}
+void GetBVHLink(uint index, out uint offset, out uint count)
+{
+	uint link = gBVHNodes[index].link;
+	offset = (link & 1) ? link >> 8 : link >> 1;
+	count = (link & 1) ? (link >> 1) & 127 : 0;
+}
+#else
+float2 IntersectBVHNode(uint index, Ray ray)
+{
+	return IntersectBoxRange(gBVHNodes[index].min, gBVHNodes[index].max, ray);
+}
+void GetBVHLink(uint index, out uint offset, out uint count)
+{
+	offset = gBVHNodes[index].offset;
+	count = gBVHNodes[index].count;
+}
+#endif
+void TraceBVH(Ray ray, inout RayHit bestHit)
+{
+	uint stack[BVH_STACK_SIZE];
+	uint stackSize = 0;
+	float2 range = IntersectBVHNode(0, ray);
+	if (range.x <= range.y && range.y > 0)
+		stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		uint index = stack[--stackSize];
+		uint offset, count;
+		GetBVHLink(index, offset, count);
+		if (count > 0)
+		{
+			IntersectLeaf(ray, offset, count, bestHit);
+			continue;
+		}
+		float2 leftRange = IntersectBVHNode(index + 1, ray);
+		float2 rightRange = IntersectBVHNode(offset, ray);
+		bool hitLeft = leftRange.x <= leftRange.y && leftRange.y > 0 && leftRange.x < bestHit.distance;
+		bool hitRight = rightRange.x <= rightRange.y && rightRange.y > 0 && rightRange.x < bestHit.distance;
+		// Push the far child first so the near one is visited next.
+		bool leftFirst = leftRange.x <= rightRange.x;
+		uint nearChild = leftFirst ? index + 1 : offset;
+		uint farChild = leftFirst ? offset : index + 1;
+		bool hitNear = leftFirst ? hitLeft : hitRight;
+		bool hitFar = leftFirst ? hitRight : hitLeft;
+		if (hitFar)
+			stack[stackSize++] = farChild;
+		if (hitNear)
+			stack[stackSize++] = nearChild;
+	}
+}
+#if USE_INSTANCES
+// Traces the instances of the shared bottom-level tree in gBVHNodes.  The object
+// space ray is not renormalized so its hit distances stay in world units.
+void TraceInstance(Ray ray, uint instance, inout RayHit bestHit)
+{
+	float4x4 invWorld = gInstances[instance].invWorld;
+	Ray local = ray;
+	local.origin = mul(invWorld, float4(ray.origin, 1.0f)).xyz;
+	local.direction = mul(invWorld, float4(ray.direction, 0.0f)).xyz;
+	float closest = bestHit.distance;
+	TraceBVH(local, bestHit);
+	if (bestHit.distance < closest)
+	{
+		// Back to world space; normals take the inverse transpose.
+		bestHit.position = ray.origin + bestHit.distance * ray.direction;
+		bestHit.normal = normalize(mul(bestHit.normal, (float3x3)invWorld));
+	}
+}
+void TraceInstances(Ray ray, inout RayHit bestHit)
+{
+	uint stack[TLAS_STACK_SIZE];
+	uint stackSize = 0;
+	float2 range = IntersectBoxRange(gTLASNodes[0].min, gTLASNodes[0].max, ray);
+	if (range.x <= range.y && range.y > 0)
+		stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		uint index = stack[--stackSize];
+		BVHNode node = gTLASNodes[index];
 		if (node.count > 0)
 		{
-			for (uint j = 0; j < node.count; j++)
-			{
-				Triangle tri = gTriangles[gIndices[node.start + j]];
-				Vertex v0 = gVertices[tri.indices[0]];
-				Vertex v1 = gVertices[tri.indices[1]];
-				Vertex v2 = gVertices[tri.indices[2]];
-				float t, u, v;
-				if (IntersectTriangle_MT97(ray, v0.position, v1.position, v2.position, t, u, v) && t > 0 && t < bestHit.distance)
-				{
-					float w = 1 - u - v;
-					bestHit.distance = t;
-					bestHit.position = ray.origin + t * ray.direction;
-					bestHit.normal = normalize(v0.normal * u + v1.normal * v + v2.normal * w);
-				//	bestHit.albedo = sphere.albedo;
-				//	bestHit.specular = sphere.specular;
-				}
-			}
+			for (uint k = node.offset; k < node.offset + node.count; k++)
+				TraceInstance(ray, k, bestHit);
+			continue;
+		}
+		BVHNode left = gTLASNodes[index + 1];
+		BVHNode right = gTLASNodes[node.offset];
+		float2 leftRange = IntersectBoxRange(left.min, left.max, ray);
+		float2 rightRange = IntersectBoxRange(right.min, right.max, ray);
+		bool hitLeft = leftRange.x <= leftRange.y && leftRange.y > 0 && leftRange.x < bestHit.distance;
+		bool hitRight = rightRange.x <= rightRange.y && rightRange.y > 0 && rightRange.x < bestHit.distance;
+		bool leftFirst = leftRange.x <= rightRange.x;
+		uint nearChild = leftFirst ? index + 1 : node.offset;
+		uint farChild = leftFirst ? node.offset : index + 1;
+		bool hitNear = leftFirst ? hitLeft : hitRight;
+		bool hitFar = leftFirst ? hitRight : hitLeft;
+		if (hitFar)
+			stack[stackSize++] = farChild;
+		if (hitNear)
+			stack[stackSize++] = nearChild;
+	}
+}
+#endif
+#else
+// Stackless: find the leaf holding the entry point, test it, then follow the rope
+// of the face the ray leaves through until a hit lies inside the current leaf.
+void TraceKDTree(Ray ray, inout RayHit bestHit)
+{
+	float2 range = IntersectBoxRange(gNodes[0].min, gNodes[0].max, ray);
+	if (range.x > range.y || range.y <= 0)
+		return;
+	float entry = max(range.x, 0.0f);
+	uint index = 0;
+	uint numNodes, stride;
+	gNodes.GetDimensions(numNodes, stride);
+	for (uint steps = 0; index != KD_NO_ROPE && steps < numNodes; steps++)
+	{
+		float3 p = ray.origin + ray.direction * entry;
+		KDNode node = gNodes[index];
+		while (node.axis < 3)
+		{
+			bool goLeft = p[node.axis] < node.split || (p[node.axis] == node.split && ray.direction[node.axis] <= 0);
+			index = goLeft ? node.left : node.right;
+			node = gNodes[index];
 		}
-		else
+		IntersectLeaf(ray, node.start, node.count, bestHit);
+		// A ray parallel to an axis never leaves through that axis' faces.
+		float3 exits = ray.direction != 0 ? ((ray.direction > 0 ? node.max : node.min) - ray.origin) / ray.direction : 1e30f;
+		uint face = 0;
+		float leafExit = exits.x;
+		if (exits.y < leafExit)
 		{
-			KDNode left = gNodes[node.left];
-			if (IntersectBox(left.min, left.max, ray))
-				Nodes[NumNodes++] = node.left;
-			KDNode right = gNodes[node.right];
-			if (IntersectBox(right.min, right.max, ray))
-				Nodes[NumNodes++] = node.right;
+			face = 2;
+			leafExit = exits.y;
 		}
+		if (exits.z < leafExit)
+		{
+			face = 4;
+			leafExit = exits.z;
+		}
+		if (bestHit.distance <= leafExit)
+			break;
+		index = node.ropes[face + (ray.direction[face / 2] > 0 ? 1 : 0)];
+		entry = max(entry, leafExit);
 	}
+}
+#endif
+RayHit Trace(Ray ray)
+{
+	RayHit bestHit = CreateRayHit();
+#if KDTREE_TESTING
+#if USE_BVH && USE_INSTANCES
+	TraceInstances(ray, bestHit);
+#elif USE_BVH
+	TraceBVH(ray, bestHit);
+#else
+	TraceKDTree(ray, bestHit);
+#endif
 #else
 	for (int i = 0; i < NumSpheres; i++)
 		IntersectSphere(ray, bestHit, gSpheres[i]);
@@ -333,27 +568,204 @@ float3 Shade(inout Ray ray, RayHit hit)
 
 
 
-[numthreads(8, 8, 1)]
-void CS(int3 groupThreadID : SV_GroupID, int3 id : SV_DispatchThreadID)
+#if ADAPTIVE_SAMPLING
+// Keeps black pixels from never converging.
+static const float ERROR_FLOOR = 0.01f;
+
+bool Converged(float4 acc, float2 moments)
 {
-	_Pixel = id.xy;
+	float n = acc.w;
+	if (n >= gMaxSamples)
+		return true;
+	if (n < max(gMinSamples, 2))
+		return false;
+	float standardError = sqrt(moments.y / (n - 1) / n);
+	return standardError <= gTargetError * max(moments.x, ERROR_FLOOR);
+}
+#endif
+
+static const uint MAX_BOUNCES = 8;
+
+// Starts a sample of the pixel: sets up the sampler and returns the camera ray, or
+// false when the pixel is outside the target or has already converged.
+bool BeginPixel(uint2 pixel, out Ray ray)
+{
+	ray = (Ray)0;
 	// Get the dimensions of the RenderTexture
 	uint width, height;
 	gOutput.GetDimensions(width, height);
+	if (pixel.x >= width || pixel.y >= height)
+		return false;
+#if ADAPTIVE_SAMPLING
+	float4 acc = gResetAccumulation ? float4(0, 0, 0, 0) : gAccumulation[pixel];
+	float2 moments = gResetAccumulation ? float2(0, 0) : gMoments[pixel];
+	if (Converged(acc, moments))
+		return false;
+	_SampleIndex = (uint)acc.w;
+#else
+	_SampleIndex = gSampleIndex;
+#endif
+	_Pixel = pixel;
+	_PixelSeed = PixelSeed(pixel, 1);
+	_Dimension = 0;
 	// Transform pixel to [-1,1] range
-	float2 uv = float2((id.xy + float2(rand(), rand())) / float2(width, height) * 2.0f - 1.0f);
+	float2 uv = float2((pixel + Sample2D()) / float2(width, height) * 2.0f - 1.0f);
 	// Get a ray for the UVs
-	Ray ray = CreateCameraRay(float2(uv.x,-uv.y));
+	ray = CreateCameraRay(float2(uv.x, -uv.y));
+	return true;
+}
+// Adds the radiance of a finished sample to the pixel.
+void EndPixel(uint2 pixel, float3 result)
+{
+#if ADAPTIVE_SAMPLING
+	float4 acc = gResetAccumulation ? float4(0, 0, 0, 0) : gAccumulation[pixel];
+	float2 moments = gResetAccumulation ? float2(0, 0) : gMoments[pixel];
+	acc.w += 1.0f;
+	acc.rgb += (result - acc.rgb) / acc.w;
+	float lum = dot(result, float3(0.2126f, 0.7152f, 0.0722f));
+	float delta = lum - moments.x;
+	moments.x += delta / acc.w;
+	moments.y += delta * (lum - moments.x);
+	gAccumulation[pixel] = acc;
+	gMoments[pixel] = moments;
+	if (!Converged(acc, moments))
+		InterlockedAdd(gActivePixels[0], 1);
+#else
+	gOutput[pixel] = float4(result, 1);
+#endif
+}
+
+// Megakernel: one thread runs every bounce of its pixel's path.
+[numthreads(8, 8, 1)]
+void CS(int3 groupThreadID : SV_GroupID, int3 id : SV_DispatchThreadID)
+{
+	Ray ray;
+	if (!BeginPixel(id.xy, ray))
+		return;
 	// Write some colors
 	float3 result = float3(0, 0, 0);
-	for (int i = 0; i < 8; i++)
+	for (uint i = 0; i < MAX_BOUNCES; i++)
 	{
 		RayHit hit = Trace(ray);
 		result += ray.energy * Shade(ray, hit);
 		if (!any(ray.energy))
 			break;
 	}
-	gOutput[id.xy] = float4(result, 1);
+	EndPixel(id.xy, result);
+}
+
+// Wavefront path tracing: GenerateCS fills the queue of bounce 0 with camera rays,
+// then for every bounce ExtendCS traces the queued paths, ShadeCS shades the hits
+// and retires finished paths, and CompactCS appends the survivors to the queue of
+// the next bounce.  Paths ping-pong between the two halves of gPaths and each
+// bounce has its own counter in gQueueCounts, cleared once per frame.
+struct PathState
+{
+	float3 origin;
+	uint pixel;			// x | y << 16
+	float3 direction;
+	uint bounce;
+	float3 energy;
+	float seed;			// rand() state
+	float3 radiance;
+	uint sampleIndex;
+};
+RWStructuredBuffer<PathState> gPaths : register(u4);
+RWStructuredBuffer<RayHit> gHits : register(u5);
+RWStructuredBuffer<uint> gQueueCounts : register(u6);
+cbuffer wavefrontPass : register(b1)
+{
+	uint gBounce;
+};
+
+uint QueueSlot(uint bounce, uint i)
+{
+	uint width, height;
+	gOutput.GetDimensions(width, height);
+	return (bounce & 1) * width * height + i;
+}
+uint2 PathPixel(PathState path)
+{
+	return uint2(path.pixel & 0xFFFF, path.pixel >> 16);
+}
+Ray PathRay(PathState path)
+{
+	Ray ray;
+	ray.origin = path.origin;
+	ray.direction = path.direction;
+	ray.energy = path.energy;
+	return ray;
+}
+bool PathAlive(PathState path)
+{
+	return any(path.energy) && path.bounce < MAX_BOUNCES;
+}
+
+[numthreads(8, 8, 1)]
+void GenerateCS(int3 id : SV_DispatchThreadID)
+{
+	Ray ray;
+	if (!BeginPixel(id.xy, ray))
+		return;
+	PathState path;
+	path.origin = ray.origin;
+	path.pixel = id.x | (id.y << 16);
+	path.direction = ray.direction;
+	path.bounce = 0;
+	path.energy = ray.energy;
+	path.seed = _Seed;
+	path.radiance = float3(0, 0, 0);
+	path.sampleIndex = _SampleIndex;
+	uint i;
+	InterlockedAdd(gQueueCounts[0], 1, i);
+	gPaths[QueueSlot(0, i)] = path;
+}
+
+[numthreads(64, 1, 1)]
+void ExtendCS(int3 id : SV_DispatchThreadID)
+{
+	if ((uint)id.x >= gQueueCounts[gBounce])
+		return;
+	gHits[id.x] = Trace(PathRay(gPaths[QueueSlot(gBounce, id.x)]));
+}
+
+[numthreads(64, 1, 1)]
+void ShadeCS(int3 id : SV_DispatchThreadID)
+{
+	if ((uint)id.x >= gQueueCounts[gBounce])
+		return;
+	uint slot = QueueSlot(gBounce, id.x);
+	PathState path = gPaths[slot];
+	uint2 pixel = PathPixel(path);
+	_Pixel = pixel;
+	_Seed = path.seed;
+	_SampleIndex = path.sampleIndex;
+	_PixelSeed = PixelSeed(pixel, 1);
+	_Dimension = 1 + path.bounce;
+
+	Ray ray = PathRay(path);
+	path.radiance += ray.energy * Shade(ray, gHits[id.x]);
+	path.origin = ray.origin;
+	path.direction = ray.direction;
+	path.energy = ray.energy;
+	path.seed = _Seed;
+	path.bounce++;
+	if (!PathAlive(path))
+		EndPixel(pixel, path.radiance);
+	gPaths[slot] = path;
+}
+
+[numthreads(64, 1, 1)]
+void CompactCS(int3 id : SV_DispatchThreadID)
+{
+	if ((uint)id.x >= gQueueCounts[gBounce])
+		return;
+	PathState path = gPaths[QueueSlot(gBounce, id.x)];
+	if (!PathAlive(path))
+		return;
+	uint i;
+	InterlockedAdd(gQueueCounts[gBounce + 1], 1, i);
+	gPaths[QueueSlot(gBounce + 1, i)] = path;
 }
 
 
@@ -388,5 +800,10 @@ VertexOut VS(uint vid : SV_VertexID)
 float4 PS(VertexOut pin) : SV_Target
 {
 	float4 c = gTexture2D.SampleLevel(gsamPointWrap, pin.TexC, 0.0f);
+#if ADAPTIVE_SAMPLING
+	// gTexture2D is gAccumulation, which already holds the mean.
+	return float4(c.rgb, 1.0f);
+#else
 	return float4(c.rgb, 1.0 / NumSamples);
+#endif
 }
\ No newline at end of file
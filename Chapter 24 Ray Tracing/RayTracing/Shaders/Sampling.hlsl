@@ -0,0 +1,62 @@
+//***************************************************************************************
+// Sampling.hlsl
+//
+// Owen-scrambled Sobol points (Burley, "Practical Hash-based Owen Scrambling", JCGT
+// 2020), mirrored by Sampler.cpp.  Each 2D dimension pair is the first two Sobol
+// dimensions, shuffled and scrambled with a hash of the pixel and the dimension.
+//***************************************************************************************
+
+uint HashUint(uint x)
+{
+	// lowbias32 by Chris Wellons.
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+uint HashCombine(uint seed, uint value)
+{
+	return seed ^ (HashUint(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+uint LaineKarrasPermutation(uint x, uint seed)
+{
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed)
+{
+	return reversebits(LaineKarrasPermutation(reversebits(x), seed));
+}
+
+uint Sobol1(uint index)
+{
+	uint result = 0;
+	for (uint v = 0x80000000u; index != 0; index >>= 1, v ^= v >> 1)
+	{
+		if (index & 1)
+			result ^= v;
+	}
+	return result;
+}
+
+float2 SobolOwen2D(uint index, uint seed)
+{
+	index = NestedUniformScramble(index, seed);
+	uint x = NestedUniformScramble(reversebits(index), HashCombine(seed, 0));
+	uint y = NestedUniformScramble(Sobol1(index), HashCombine(seed, 1));
+	return float2(x >> 8, y >> 8) * (1.0f / 16777216.0f);
+}
+
+uint PixelSeed(uint2 pixel, uint seed)
+{
+	return HashCombine(HashUint(pixel.x | (pixel.y << 16)), seed);
+}
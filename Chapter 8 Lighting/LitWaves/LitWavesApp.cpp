@@ -128,6 +128,9 @@ private:
 
 	std::unique_ptr<Waves> mWaves;
 
+	// Grid region each frame resource's WavesVB is out of date in.
+	Waves::Region mWavesDirty[gNumFrameResources];
+
     PassConstants mMainPassCB;
 
 	XMFLOAT3 mEyePos = { 0.0f, 0.0f, 0.0f };
@@ -485,17 +488,28 @@ void LitWavesApp::UpdateWaves(const GameTimer& gt)
 	// Update the wave simulation.
 	mWaves->Update(gt.DeltaTime());
 
-	// Update the wave vertex buffer with the new solution.
+	// Update the wave vertex buffer with the new solution.  Each frame resource has
+	// its own vertex buffer, so the changed region is queued for all of them and only
+	// what the current one is missing gets copied.
+	for(auto& dirty : mWavesDirty)
+		dirty.Add(mWaves->DirtyRegion());
+	Waves::Region& currDirty = mWavesDirty[mCurrFrameResourceIndex];
+
 	auto currWavesVB = mCurrFrameResource->WavesVB.get();
-	for(int i = 0; i < mWaves->VertexCount(); ++i)
+	for(int row = currDirty.FirstRow; row < currDirty.EndRow; ++row)
 	{
-		Vertex v;
+		for(int col = currDirty.FirstCol; col < currDirty.EndCol; ++col)
+		{
+			int i = row*mWaves->ColumnCount() + col;
+			Vertex v;
 
-		v.Pos = mWaves->Position(i);
-		v.Normal = mWaves->Normal(i);
+			v.Pos = mWaves->Position(i);
+			v.Normal = mWaves->Normal(i);
 
-		currWavesVB->CopyData(i, v);
+			currWavesVB->CopyData(i, v);
+		}
 	}
+	currDirty = Waves::Region();
 
 	// Set the dynamic VB of the wave renderitem to the current frame VB.
 	mWavesRitem->Geo->VertexBufferGPU = currWavesVB->Resource();
@@ -695,6 +709,10 @@ void LitWavesApp::BuildFrameResources()
     {
         mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
             1, (UINT)mAllRitems.size(), (UINT)mMaterials.size(), mWaves->VertexCount()));
+
+        // The new vertex buffer has to be filled in completely.
+        mWavesDirty[i].EndRow = mWaves->RowCount();
+        mWavesDirty[i].EndCol = mWaves->ColumnCount();
     }
 }
 
@@ -0,0 +1,249 @@
+//***************************************************************************************
+// SpectralOcean.cpp
+//***************************************************************************************
+
+#include "SpectralOcean.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+
+const float Gravity = 9.81f;
+const float Pi = 3.14159265358979323846f;
+
+}
+
+SpectralOcean::SpectralOcean(int n, float patchSize, const OceanSettings& settings)
+{
+	assert(n >= 2 && (n & (n - 1)) == 0);
+
+	mNumPoints = n;
+	mPatchSize = patchSize;
+	mSpatialStep = patchSize / n;
+	mSettings = settings;
+
+	float windLength = std::sqrt(settings.WindDirection.x*settings.WindDirection.x +
+		settings.WindDirection.y*settings.WindDirection.y);
+	mSettings.WindDirection.x /= windLength;
+	mSettings.WindDirection.y /= windLength;
+
+	mMinX = -(n - 1)*mSpatialStep*0.5f;
+	mMaxZ = (n - 1)*mSpatialStep*0.5f;
+
+	mFFT = std::make_unique<FFT2D>(n);
+	for(int part = 0; part < 2; ++part)
+	{
+		mHeightDisplaceX[part].assign(n*n, 0.0f);
+		mDisplaceZSlopeX[part].assign(n*n, 0.0f);
+		mSlopeZ[part].assign(n*n, 0.0f);
+	}
+
+	// Spectrum point (p, q) holds the wave with exp(2*pi*i*(p*r + q*c)/n) at grid point
+	// (r, c).  Rows run towards -z, hence the sign of kz.
+	mKx.resize(n*n);
+	mKz.resize(n*n);
+	mOmega.resize(n*n);
+	mH0Re.resize(n*n);
+	mH0Im.resize(n*n);
+	float dk = 2.0f*Pi / patchSize;
+	std::mt19937 rng(settings.Seed);
+	std::normal_distribution<float> gaussian;
+	for(int p = 0; p < n; ++p)
+	{
+		for(int q = 0; q < n; ++q)
+		{
+			int i = p*n + q;
+			mKx[i] = dk*(q < n/2 ? q : q - n);
+			mKz[i] = -dk*(p < n/2 ? p : p - n);
+			float k = std::sqrt(mKx[i]*mKx[i] + mKz[i]*mKz[i]);
+			mOmega[i] = std::sqrt(Gravity*k);
+
+			// Each wave's amplitude is normally distributed with the variance the
+			// spectrum gives its dk by dk cell, split over the real and imaginary parts.
+			float amplitude = std::sqrt(0.5f*SpectrumDensity(mKx[i], mKz[i])*dk*dk);
+			mH0Re[i] = amplitude*gaussian(rng);
+			mH0Im[i] = amplitude*gaussian(rng);
+		}
+	}
+
+	mH0MirrorRe.resize(n*n);
+	mH0MirrorIm.resize(n*n);
+	for(int p = 0; p < n; ++p)
+	{
+		for(int q = 0; q < n; ++q)
+		{
+			int mirror = ((n - p) % n)*n + (n - q) % n;
+			mH0MirrorRe[p*n + q] = mH0Re[mirror];
+			mH0MirrorIm[p*n + q] = -mH0Im[mirror];
+		}
+	}
+
+	Update(0.0f);
+}
+
+SpectralOcean::~SpectralOcean()
+{
+}
+
+int SpectralOcean::RowCount()const
+{
+	return mNumPoints;
+}
+
+int SpectralOcean::ColumnCount()const
+{
+	return mNumPoints;
+}
+
+int SpectralOcean::VertexCount()const
+{
+	return mNumPoints*mNumPoints;
+}
+
+int SpectralOcean::TriangleCount()const
+{
+	return (mNumPoints - 1)*(mNumPoints - 1)*2;
+}
+
+float SpectralOcean::Width()const
+{
+	return mNumPoints*mSpatialStep;
+}
+
+float SpectralOcean::Depth()const
+{
+	return mNumPoints*mSpatialStep;
+}
+
+XMFLOAT3 SpectralOcean::Position(int i)const
+{
+	float choppiness = mSettings.Choppiness;
+	return XMFLOAT3(
+		mMinX + (i % mNumPoints)*mSpatialStep + choppiness*mHeightDisplaceX[1][i],
+		mHeightDisplaceX[0][i],
+		mMaxZ - (i / mNumPoints)*mSpatialStep + choppiness*mDisplaceZSlopeX[0][i]);
+}
+
+XMFLOAT3 SpectralOcean::Normal(int i)const
+{
+	float slopeX = mDisplaceZSlopeX[1][i];
+	float slopeZ = mSlopeZ[0][i];
+	float invLength = 1.0f / std::sqrt(slopeX*slopeX + 1.0f + slopeZ*slopeZ);
+	return XMFLOAT3(-slopeX*invLength, invLength, -slopeZ*invLength);
+}
+
+XMFLOAT3 SpectralOcean::TangentX(int i)const
+{
+	float slopeX = mDisplaceZSlopeX[1][i];
+	float invLength = 1.0f / std::sqrt(1.0f + slopeX*slopeX);
+	return XMFLOAT3(invLength, slopeX*invLength, 0.0f);
+}
+
+void SpectralOcean::Update(float dt)
+{
+	mTime += dt;
+
+	int n = mNumPoints;
+	mThreadPool->ParallelFor(0, n, 16, [this](int firstRow, int endRow)
+	{
+		BuildSpectrumRows(firstRow, endRow);
+	});
+
+	mFFT->Inverse(mHeightDisplaceX[0].data(), mHeightDisplaceX[1].data(), *mThreadPool);
+	mFFT->Inverse(mDisplaceZSlopeX[0].data(), mDisplaceZSlopeX[1].data(), *mThreadPool);
+	mFFT->Inverse(mSlopeZ[0].data(), mSlopeZ[1].data(), *mThreadPool);
+}
+
+void SpectralOcean::SetThreadPool(ThreadPool* pool)
+{
+	mThreadPool = pool;
+}
+
+float SpectralOcean::SpectrumDensity(float kx, float kz)const
+{
+	float k = std::sqrt(kx*kx + kz*kz);
+	if(k == 0.0f)
+		return 0.0f;
+
+	float windSpeed = mSettings.WindSpeed;
+	float cosine = (kx*mSettings.WindDirection.x + kz*mSettings.WindDirection.y) / k;
+
+	if(mSettings.Spectrum == OceanSpectrum::Phillips)
+	{
+		// Waves much shorter than the longest the wind raises are cut off too, as they
+		// only alias at the grid spacing.
+		float longest = windSpeed*windSpeed / Gravity;
+		float shortest = 0.001f*longest;
+		return mSettings.PhillipsConstant*std::exp(-1.0f / (k*longest*k*longest)) / (k*k*k*k) *
+			cosine*cosine*std::exp(-k*k*shortest*shortest);
+	}
+
+	// JONSWAP, S(w) in m^2*s, turned into a density over the wave vector plane with the
+	// deep water dispersion relation w^2 = g*k: P(k) = S(w)*(dw/dk)/k*D(theta).
+	if(cosine <= 0.0f)
+		return 0.0f;
+	float fetch = mSettings.Fetch;
+	float omega = std::sqrt(Gravity*k);
+	float peakOmega = 22.0f*std::pow(Gravity*Gravity / (windSpeed*fetch), 1.0f / 3.0f);
+	float alpha = 0.076f*std::pow(windSpeed*windSpeed / (fetch*Gravity), 0.22f);
+	float sigma = omega <= peakOmega ? 0.07f : 0.09f;
+	float peakOffset = (omega - peakOmega) / (sigma*peakOmega);
+	float ratio = peakOmega / omega;
+	float s = alpha*Gravity*Gravity / std::pow(omega, 5.0f) *
+		std::exp(-1.25f*ratio*ratio*ratio*ratio) *
+		std::pow(mSettings.PeakEnhancement, std::exp(-0.5f*peakOffset*peakOffset));
+	float dOmegaDk = 0.5f*Gravity / omega;
+	float spread = 2.0f / Pi*cosine*cosine;
+	return s*dOmegaDk / k*spread;
+}
+
+void SpectralOcean::BuildSpectrumRows(int firstRow, int endRow)
+{
+	int n = mNumPoints;
+	for(int p = firstRow; p < endRow; ++p)
+	{
+		for(int q = 0; q < n; ++q)
+		{
+			int i = p*n + q;
+
+			// A wave vector on the Nyquist row or column is its own mirror, so i*k*h there
+			// has no conjugate to cancel against and would leak into the imaginary parts
+			// the pairs below rely on.  Only the height keeps those terms.
+			bool nyquist = p == n/2 || q == n/2;
+
+			// h(k, t) = h0(k)*exp(i*w*t) + conj(h0(-k))*exp(-i*w*t)
+			float c = std::cos(mOmega[i]*mTime);
+			float s = std::sin(mOmega[i]*mTime);
+			float hRe = (mH0Re[i] + mH0MirrorRe[i])*c - (mH0Im[i] - mH0MirrorIm[i])*s;
+			float hIm = (mH0Re[i] - mH0MirrorRe[i])*s + (mH0Im[i] + mH0MirrorIm[i])*c;
+
+			// Displacement i*k/|k|*h, which pulls points in towards the crests, and slope
+			// i*k*h, along x and z.
+			float kx = mKx[i];
+			float kz = mKz[i];
+			if(nyquist)
+				kx = kz = 0.0f;
+			float k = std::sqrt(kx*kx + kz*kz);
+			float ux = k > 0.0f ? kx / k : 0.0f;
+			float uz = k > 0.0f ? kz / k : 0.0f;
+			float displaceXRe = -ux*hIm, displaceXIm = ux*hRe;
+			float displaceZRe = -uz*hIm, displaceZIm = uz*hRe;
+			float slopeXRe = -kx*hIm, slopeXIm = kx*hRe;
+			float slopeZRe = -kz*hIm, slopeZIm = kz*hRe;
+
+			// a + i*b, whose transform has the transform of a as its real part and that of
+			// b as its imaginary part, as both are real.
+			mHeightDisplaceX[0][i] = hRe - displaceXIm;
+			mHeightDisplaceX[1][i] = hIm + displaceXRe;
+			mDisplaceZSlopeX[0][i] = displaceZRe - slopeXIm;
+			mDisplaceZSlopeX[1][i] = displaceZIm + slopeXRe;
+			mSlopeZ[0][i] = slopeZRe;
+			mSlopeZ[1][i] = slopeZIm;
+		}
+	}
+}
@@ -0,0 +1,127 @@
+//***************************************************************************************
+// SpectralOcean.h
+//
+// Open ocean surface built from a wave spectrum, after Tessendorf's "Simulating Ocean
+// Water".  Random amplitudes are drawn once per wave vector from a Phillips or JONSWAP
+// spectrum; every Update advances their phases with the deep water dispersion relation
+// and inverse FFTs them into heights, horizontal (choppy) displacement and slopes.
+// The surface is one periodic patch of n by n points, so it tiles.
+//
+// The vertex interface matches Waves, so a demo could swap one for the other.  None
+// does yet; WavesBench is the only user.
+//***************************************************************************************
+
+#ifndef SPECTRALOCEAN_H
+#define SPECTRALOCEAN_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <DirectXMath.h>
+#include "../../Common/FFT.h"
+#include "../../Common/ThreadPool.h"
+
+enum class OceanSpectrum
+{
+	// A*exp(-1/(kL)^2)/k^4 * cos^2 of the angle to the wind, L = V^2/g.
+	Phillips,
+
+	// Fetch limited JONSWAP frequency spectrum with a cos^2 spread over the half plane
+	// facing downwind.
+	Jonswap
+};
+
+struct OceanSettings
+{
+	OceanSpectrum Spectrum = OceanSpectrum::Phillips;
+
+	// Wind speed 10m above the surface, in m/s, and the direction it blows in the xz
+	// plane.
+	float WindSpeed = 10.0f;
+	DirectX::XMFLOAT2 WindDirection = { 1.0f, 0.0f };
+
+	// Phillips only.
+	float PhillipsConstant = 8.1e-3f;
+
+	// JONSWAP only: distance the wind has blown over open water, in m, and the peak
+	// enhancement factor.
+	float Fetch = 100000.0f;
+	float PeakEnhancement = 3.3f;
+
+	// Scales the horizontal displacement; 0 gives plain height field waves.
+	float Choppiness = 1.0f;
+
+	std::uint32_t Seed = 1;
+};
+
+class SpectralOcean
+{
+public:
+	// n by n points (n a power of two) over a patchSize by patchSize patch, in m.
+	SpectralOcean(int n, float patchSize, const OceanSettings& settings = OceanSettings());
+	SpectralOcean(const SpectralOcean& rhs) = delete;
+	SpectralOcean& operator=(const SpectralOcean& rhs) = delete;
+	~SpectralOcean();
+
+	int RowCount()const;
+	int ColumnCount()const;
+	int VertexCount()const;
+	int TriangleCount()const;
+	float Width()const;
+	float Depth()const;
+
+	// Returns the displaced surface at the ith grid point.
+	DirectX::XMFLOAT3 Position(int i)const;
+
+	// Returns the surface normal at the ith grid point.
+	DirectX::XMFLOAT3 Normal(int i)const;
+
+	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
+	DirectX::XMFLOAT3 TangentX(int i)const;
+
+	// Advances the surface by dt seconds.  Every call evaluates the spectrum at the new
+	// time, so there is no fixed time step to catch up on.
+	void Update(float dt);
+
+	// The transforms run on ThreadPool::Default() unless given another pool.
+	void SetThreadPool(ThreadPool* pool);
+
+private:
+	// Variance of the surface per unit area of wave vector space.
+	float SpectrumDensity(float kx, float kz)const;
+
+	// Fills the three transform inputs for the rows [firstRow, endRow).
+	void BuildSpectrumRows(int firstRow, int endRow);
+
+	int mNumPoints = 0;
+	float mPatchSize = 0.0f;
+	float mSpatialStep = 0.0f;
+	OceanSettings mSettings;
+	float mTime = 0.0f;
+
+	// Grid point (0, 0) is at (mMinX, 0, mMaxZ).
+	float mMinX = 0.0f;
+	float mMaxZ = 0.0f;
+
+	std::unique_ptr<FFT2D> mFFT;
+	ThreadPool* mThreadPool = &ThreadPool::Default();
+
+	// Wave vector, angular frequency and initial amplitude h0(k) of every spectrum
+	// point, plus conj(h0(-k)) so a row can be built without looking up its mirror.
+	std::vector<float> mKx;
+	std::vector<float> mKz;
+	std::vector<float> mOmega;
+	std::vector<float> mH0Re;
+	std::vector<float> mH0Im;
+	std::vector<float> mH0MirrorRe;
+	std::vector<float> mH0MirrorIm;
+
+	// Real fields are transformed two at a time as the real and imaginary parts of one
+	// complex transform: height and x displacement, z displacement and x slope, and
+	// the z slope on its own.
+	std::vector<float> mHeightDisplaceX[2];
+	std::vector<float> mDisplaceZSlopeX[2];
+	std::vector<float> mSlopeZ[2];
+};
+
+#endif // SPECTRALOCEAN_H
@@ -0,0 +1,320 @@
+//***************************************************************************************
+// WaveClipmap.cpp
+//***************************************************************************************
+
+#include "WaveClipmap.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace DirectX;
+
+WaveClipmap::WaveClipmap(int levelCount, int n, float dx, float dt, float speed, float damping)
+{
+	assert(levelCount > 0);
+	assert(n >= 13 && (n - 1) % 4 == 0);
+
+	mNumLevels = levelCount;
+	mNumPoints = n;
+	mSpatialStep = dx;
+	mTimeStep = dt;
+
+	for(int level = 0; level < levelCount; ++level)
+		mLevels.push_back(std::make_unique<Waves>(n, n, Spacing(level), dt, speed, damping));
+	mCenterX.assign(levelCount, 0);
+	mCenterZ.assign(levelCount, 0);
+	mDirtyRegions.resize(levelCount);
+}
+
+WaveClipmap::~WaveClipmap()
+{
+}
+
+int WaveClipmap::LevelCount()const
+{
+	return mNumLevels;
+}
+
+int WaveClipmap::LevelVertexCount()const
+{
+	return mNumPoints*mNumPoints;
+}
+
+int WaveClipmap::VertexCount()const
+{
+	return mNumLevels*LevelVertexCount();
+}
+
+const Waves& WaveClipmap::Level(int level)const
+{
+	return *mLevels[level];
+}
+
+XMFLOAT3 WaveClipmap::Position(int i)const
+{
+	int level = i / LevelVertexCount();
+	XMFLOAT3 p = mLevels[level]->Position(i % LevelVertexCount());
+	p.x += mCenterX[level]*Spacing(level);
+	p.z += mCenterZ[level]*Spacing(level);
+	return p;
+}
+
+XMFLOAT3 WaveClipmap::Normal(int i)const
+{
+	return mLevels[i / LevelVertexCount()]->Normal(i % LevelVertexCount());
+}
+
+XMFLOAT3 WaveClipmap::TangentX(int i)const
+{
+	return mLevels[i / LevelVertexCount()]->TangentX(i % LevelVertexCount());
+}
+
+const Waves::Region& WaveClipmap::DirtyRegion(int level)const
+{
+	return mDirtyRegions[level];
+}
+
+bool WaveClipmap::SetCenter(float x, float z)
+{
+	bool moved = false;
+
+	// Coarse levels first, as the levels inside them are filled in from them.
+	for(int level = mNumLevels - 1; level >= 0; --level)
+	{
+		float step = 2.0f*Spacing(level);
+		int centerX = 2*(int)std::floor(x / step + 0.5f);
+		int centerZ = 2*(int)std::floor(z / step + 0.5f);
+		int colOffset = centerX - mCenterX[level];
+		int rowOffset = mCenterZ[level] - centerZ;
+		if(colOffset == 0 && rowOffset == 0)
+			continue;
+
+		mLevels[level]->Scroll(rowOffset, colOffset);
+		mCenterX[level] = centerX;
+		mCenterZ[level] = centerZ;
+		moved = true;
+
+		// The coarsest level scrolls in still water.  The others take what the level
+		// around them has for the points that were not inside them before.
+		if(level == mNumLevels - 1)
+			continue;
+		int n = mNumPoints;
+		for(int i = 0; i < n; ++i)
+		{
+			for(int j = 0; j < n; ++j)
+			{
+				int oldI = i + rowOffset;
+				int oldJ = j + colOffset;
+				if(oldI < 1 || oldI >= n - 1 || oldJ < 1 || oldJ >= n - 1)
+					CopyFromCoarse(level, i, j);
+			}
+		}
+	}
+
+	// A level that stayed put may still sit differently inside one that moved.
+	if(moved)
+	{
+		for(int level = mNumLevels - 2; level >= 0; --level)
+			SetBoundary(level);
+	}
+	return moved;
+}
+
+void WaveClipmap::BuildIndices(std::vector<std::uint32_t>& indices)const
+{
+	indices.clear();
+
+	int n = mNumPoints;
+	for(int level = 0; level < mNumLevels; ++level)
+	{
+		// Cells of this level the finer level covers.
+		int holeRow = level > 0 ? CoarseRow(level - 1) : 0;
+		int holeCol = level > 0 ? CoarseCol(level - 1) : 0;
+		int holeSize = level > 0 ? (n - 1)/2 : 0;
+
+		std::uint32_t base = (std::uint32_t)(level*LevelVertexCount());
+		for(int i = 0; i < n - 1; ++i)
+		{
+			for(int j = 0; j < n - 1; ++j)
+			{
+				if(i >= holeRow && i < holeRow + holeSize && j >= holeCol && j < holeCol + holeSize)
+					continue;
+
+				indices.push_back(base + i*n + j);
+				indices.push_back(base + i*n + j + 1);
+				indices.push_back(base + (i + 1)*n + j);
+
+				indices.push_back(base + (i + 1)*n + j);
+				indices.push_back(base + i*n + j + 1);
+				indices.push_back(base + (i + 1)*n + j + 1);
+			}
+		}
+	}
+}
+
+int WaveClipmap::Update(float dt)
+{
+	mAccumulator += dt;
+	int steps = (int)(mAccumulator / mTimeStep);
+	mAccumulator -= steps*mTimeStep;
+	steps = std::min(steps, mMaxSubsteps);
+
+	for(int level = 0; level < mNumLevels; ++level)
+		mDirtyRegions[level] = Waves::Region();
+
+	// Without a step the levels still report what SetCenter and Disturb changed.
+	if(steps == 0)
+	{
+		for(int level = 0; level < mNumLevels; ++level)
+		{
+			mLevels[level]->Update(0.0f);
+			mDirtyRegions[level].Add(mLevels[level]->DirtyRegion());
+		}
+		return 0;
+	}
+
+	for(int k = 0; k < steps; ++k)
+	{
+		// Each level's own accumulator stays at zero, so this is exactly one step.
+		for(int level = 0; level < mNumLevels; ++level)
+		{
+			mLevels[level]->Update(mTimeStep);
+			mDirtyRegions[level].Add(mLevels[level]->DirtyRegion());
+		}
+
+		// Fine to coarse, so the coarse levels see the fine solution, then coarse to
+		// fine, so each boundary matches the level around it as of this step.
+		for(int level = 0; level < mNumLevels - 1; ++level)
+			Restrict(level);
+		for(int level = mNumLevels - 2; level >= 0; --level)
+			SetBoundary(level);
+	}
+
+	// The levels computed their normals before the coupling moved their boundaries and
+	// the coarse points around each hole, so the points next to those are redone.
+	int n = mNumPoints;
+	for(int level = 0; level < mNumLevels; ++level)
+	{
+		Waves::Region ring;
+		if(level < mNumLevels - 1)
+		{
+			ring.FirstRow = ring.FirstCol = 1;
+			ring.EndRow = ring.EndCol = n - 1;
+			mLevels[level]->ComputeRingNormals(ring);
+			mDirtyRegions[level].Add(ring);
+		}
+		if(level > 0)
+		{
+			ring.FirstRow = CoarseRow(level - 1);
+			ring.EndRow = ring.FirstRow + (n - 1)/2 + 1;
+			ring.FirstCol = CoarseCol(level - 1);
+			ring.EndCol = ring.FirstCol + (n - 1)/2 + 1;
+			mLevels[level]->ComputeRingNormals(ring);
+			mDirtyRegions[level].Add(ring);
+		}
+	}
+	return steps;
+}
+
+void WaveClipmap::Disturb(float x, float z, float magnitude)
+{
+	int n = mNumPoints;
+	for(int level = 0; level < mNumLevels; ++level)
+	{
+		float dx = Spacing(level);
+		int i = (int)std::floor((mCenterZ[level]*dx - z) / dx + 0.5f) + (n - 1)/2;
+		int j = (int)std::floor((x - mCenterX[level]*dx) / dx + 0.5f) + (n - 1)/2;
+		if(i > 1 && i < n - 2 && j > 1 && j < n - 2)
+		{
+			mLevels[level]->Disturb(i, j, magnitude);
+			return;
+		}
+	}
+}
+
+float WaveClipmap::Spacing(int level)const
+{
+	return std::ldexp(mSpatialStep, level);
+}
+
+int WaveClipmap::CoarseRow(int level)const
+{
+	return mCenterZ[level + 1] - mCenterZ[level]/2 + (mNumPoints - 1)/4;
+}
+
+int WaveClipmap::CoarseCol(int level)const
+{
+	return mCenterX[level]/2 - mCenterX[level + 1] + (mNumPoints - 1)/4;
+}
+
+float WaveClipmap::CoarseHeight(const float* coarseHeights, int level, int i, int j)const
+{
+	// In half coarse grid spacings.
+	int row = 2*CoarseRow(level) + i;
+	int col = 2*CoarseCol(level) + j;
+
+	int n = mNumPoints;
+	int i0 = row/2, i1 = (row + 1)/2;
+	int j0 = col/2, j1 = (col + 1)/2;
+	return 0.25f*(coarseHeights[i0*n + j0] + coarseHeights[i0*n + j1] +
+		coarseHeights[i1*n + j0] + coarseHeights[i1*n + j1]);
+}
+
+void WaveClipmap::SetHeight(int level, int i, int j, float height, float previousHeight)
+{
+	// Waves::SetHeight holds a boundary point at height in both solutions.
+	const Waves& waves = *mLevels[level];
+	int n = mNumPoints;
+	int k = i*n + j;
+	bool boundary = i == 0 || i == n - 1 || j == 0 || j == n - 1;
+	if(waves.Heights()[k] == height && (boundary || waves.PreviousHeights()[k] == previousHeight))
+		return;
+
+	mLevels[level]->SetHeight(i, j, height, previousHeight);
+
+	Waves::Region point;
+	point.FirstRow = i;
+	point.EndRow = i + 1;
+	point.FirstCol = j;
+	point.EndCol = j + 1;
+	mDirtyRegions[level].Add(point);
+}
+
+void WaveClipmap::CopyFromCoarse(int level, int i, int j)
+{
+	const Waves& coarse = *mLevels[level + 1];
+	SetHeight(level, i, j, CoarseHeight(coarse.Heights(), level, i, j),
+		CoarseHeight(coarse.PreviousHeights(), level, i, j));
+}
+
+void WaveClipmap::Restrict(int level)
+{
+	// The coarse points on the fine grid, leaving out the fine boundary and the points
+	// next to it, which follow the coarse solution.
+	const Waves& fine = *mLevels[level];
+	int n = mNumPoints;
+	for(int i = 2; i <= n - 3; i += 2)
+	{
+		for(int j = 2; j <= n - 3; j += 2)
+		{
+			int k = i*n + j;
+			SetHeight(level + 1, CoarseRow(level) + i/2, CoarseCol(level) + j/2,
+				fine.Heights()[k], fine.PreviousHeights()[k]);
+		}
+	}
+}
+
+void WaveClipmap::SetBoundary(int level)
+{
+	int n = mNumPoints;
+	for(int k = 0; k < n; ++k)
+	{
+		CopyFromCoarse(level, 0, k);
+		CopyFromCoarse(level, n - 1, k);
+		if(k > 0 && k < n - 1)
+		{
+			CopyFromCoarse(level, k, 0);
+			CopyFromCoarse(level, k, n - 1);
+		}
+	}
+}
@@ -0,0 +1,95 @@
+//***************************************************************************************
+// WaveClipmap.h
+//
+// Nested wave grids for large water surfaces.  Level 0 is the finest grid; every level
+// after it has the same number of points at twice the spacing, so it covers twice the
+// extent for the same cost.  The levels follow a center point, usually the camera, each
+// one inside the next.  After every step the coarse points a finer level covers take
+// its solution, and the finer level's boundary takes the coarse solution in turn.
+//
+// The levels' vertices form one stream, level after level, and BuildIndices triangulates
+// each level around the hole the finer level inside it fills.
+//
+// No demo draws it yet; WavesBench is the only user.
+//***************************************************************************************
+
+#ifndef WAVECLIPMAP_H
+#define WAVECLIPMAP_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Waves.h"
+
+class WaveClipmap
+{
+public:
+	// levelCount levels of n by n points, with n = 4k+1 and at least 13.  Level 0 has
+	// spacing dx; the other arguments are as for Waves.
+	WaveClipmap(int levelCount, int n, float dx, float dt, float speed, float damping);
+	WaveClipmap(const WaveClipmap& rhs) = delete;
+	WaveClipmap& operator=(const WaveClipmap& rhs) = delete;
+	~WaveClipmap();
+
+	int LevelCount()const;
+	int LevelVertexCount()const;
+	int VertexCount()const;
+	const Waves& Level(int level)const;
+
+	// The ith vertex of the combined stream, in world space.
+	DirectX::XMFLOAT3 Position(int i)const;
+	DirectX::XMFLOAT3 Normal(int i)const;
+	DirectX::XMFLOAT3 TangentX(int i)const;
+
+	// Points of a level changed by the last Update, including those moved by SetCenter
+	// and Disturb since the Update before it.  The level's vertices start at
+	// level*LevelVertexCount() in the stream.
+	const Waves::Region& DirtyRegion(int level)const;
+
+	// Moves the levels to follow (x, z).  A level moves two of its own grid spacings at
+	// a time, so that it stays on the grid of the level around it.  Returns true if any
+	// level moved, in which case the indices have to be built again.
+	bool SetCenter(float x, float z);
+
+	// Triangle list over the combined stream.
+	void BuildIndices(std::vector<std::uint32_t>& indices)const;
+
+	// Same as Waves::Update, with all levels stepping together.
+	int Update(float dt);
+
+	// Disturbs the finest level that has (x, z) well inside it.
+	void Disturb(float x, float z, float magnitude);
+
+private:
+	float Spacing(int level)const;
+
+	// Where grid point (0, 0) of a level falls on the grid of the level after it.
+	int CoarseRow(int level)const;
+	int CoarseCol(int level)const;
+
+	// Height of the level after this one at point (i, j) of this one.  Points between
+	// coarse points are interpolated.
+	float CoarseHeight(const float* coarseHeights, int level, int i, int j)const;
+
+	void SetHeight(int level, int i, int j, float height, float previousHeight);
+	void CopyFromCoarse(int level, int i, int j);
+	void Restrict(int level);
+	void SetBoundary(int level);
+
+	int mNumLevels = 0;
+	int mNumPoints = 0;
+	float mSpatialStep = 0.0f;
+	float mTimeStep = 0.0f;
+	float mAccumulator = 0.0f;
+	int mMaxSubsteps = 8;
+
+	std::vector<std::unique_ptr<Waves>> mLevels;
+
+	// Level centers in grid spacings of the level, always even.
+	std::vector<int> mCenterX;
+	std::vector<int> mCenterZ;
+
+	std::vector<Waves::Region> mDirtyRegions;
+};
+
+#endif // WAVECLIPMAP_H
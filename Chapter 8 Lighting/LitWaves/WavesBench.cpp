@@ -0,0 +1,531 @@
+//***************************************************************************************
+// WavesBench.cpp
+//
+// Console harness that times Waves::Update without a D3D12 device, against the
+// original array-of-structures solver kept below as a reference, and the FFT behind
+// SpectralOcean against a plain scalar one.
+//
+// Usage: WavesBench [maxGridSize [maxThreads]]
+//        Grids are 128, 256, ... up to maxGridSize (4096 by default); the thread and
+//        grain size sweep goes up to maxThreads (hardware threads by default).
+//***************************************************************************************
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include "SpectralOcean.h"
+#include "WaveClipmap.h"
+#include "Waves.h"
+
+using namespace DirectX;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Seconds(Clock::time_point start, Clock::time_point end)
+{
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// The solver Waves used before the structure-of-arrays rewrite: XMFLOAT3 positions,
+// then a second pass for normals and tangents.  Runs single threaded.
+class ReferenceWaves
+{
+public:
+	ReferenceWaves(int m, int n, float dx, float dt, float speed, float damping) : mNumRows(m), mNumCols(n), mSpatialStep(dx)
+	{
+		float d = damping*dt + 2.0f;
+		float e = (speed*speed)*(dt*dt) / (dx*dx);
+		mK1 = (damping*dt - 2.0f) / d;
+		mK2 = (4.0f - 8.0f*e) / d;
+		mK3 = (2.0f*e) / d;
+
+		mPrevSolution.resize(m*n);
+		mCurrSolution.resize(m*n);
+		mNormals.resize(m*n);
+		mTangentX.resize(m*n);
+		float halfWidth = (n - 1)*dx*0.5f;
+		float halfDepth = (m - 1)*dx*0.5f;
+		for(int i = 0; i < m; ++i)
+		{
+			for(int j = 0; j < n; ++j)
+			{
+				mPrevSolution[i*n + j] = XMFLOAT3(-halfWidth + j*dx, 0.0f, halfDepth - i*dx);
+				mCurrSolution[i*n + j] = mPrevSolution[i*n + j];
+				mNormals[i*n + j] = XMFLOAT3(0.0f, 1.0f, 0.0f);
+				mTangentX[i*n + j] = XMFLOAT3(1.0f, 0.0f, 0.0f);
+			}
+		}
+	}
+
+	void Step()
+	{
+		for(int i = 1; i < mNumRows - 1; ++i)
+		{
+			for(int j = 1; j < mNumCols - 1; ++j)
+			{
+				mPrevSolution[i*mNumCols+j].y =
+					mK1*mPrevSolution[i*mNumCols+j].y +
+					mK2*mCurrSolution[i*mNumCols+j].y +
+					mK3*(mCurrSolution[(i+1)*mNumCols+j].y +
+						mCurrSolution[(i-1)*mNumCols+j].y +
+						mCurrSolution[i*mNumCols+j+1].y +
+						mCurrSolution[i*mNumCols+j-1].y);
+			}
+		}
+		std::swap(mPrevSolution, mCurrSolution);
+		for(int i = 1; i < mNumRows - 1; ++i)
+		{
+			for(int j = 1; j < mNumCols - 1; ++j)
+			{
+				float l = mCurrSolution[i*mNumCols+j-1].y;
+				float r = mCurrSolution[i*mNumCols+j+1].y;
+				float t = mCurrSolution[(i-1)*mNumCols+j].y;
+				float b = mCurrSolution[(i+1)*mNumCols+j].y;
+				XMFLOAT3& n = mNormals[i*mNumCols+j];
+				n = XMFLOAT3(-r+l, 2.0f*mSpatialStep, b-t);
+				float invLength = 1.0f / sqrtf(n.x*n.x + n.y*n.y + n.z*n.z);
+				n = XMFLOAT3(n.x*invLength, n.y*invLength, n.z*invLength);
+
+				XMFLOAT3& tangent = mTangentX[i*mNumCols+j];
+				tangent = XMFLOAT3(2.0f*mSpatialStep, r-l, 0.0f);
+				invLength = 1.0f / sqrtf(tangent.x*tangent.x + tangent.y*tangent.y);
+				tangent = XMFLOAT3(tangent.x*invLength, tangent.y*invLength, 0.0f);
+			}
+		}
+	}
+
+	void Disturb(int i, int j, float magnitude)
+	{
+		float halfMag = 0.5f*magnitude;
+		mCurrSolution[i*mNumCols+j].y     += magnitude;
+		mCurrSolution[i*mNumCols+j+1].y   += halfMag;
+		mCurrSolution[i*mNumCols+j-1].y   += halfMag;
+		mCurrSolution[(i+1)*mNumCols+j].y += halfMag;
+		mCurrSolution[(i-1)*mNumCols+j].y += halfMag;
+	}
+
+	const XMFLOAT3& Position(int i)const { return mCurrSolution[i]; }
+	const XMFLOAT3& Normal(int i)const { return mNormals[i]; }
+	const XMFLOAT3& TangentX(int i)const { return mTangentX[i]; }
+
+private:
+	int mNumRows;
+	int mNumCols;
+	float mSpatialStep;
+	float mK1, mK2, mK3;
+	std::vector<XMFLOAT3> mPrevSolution;
+	std::vector<XMFLOAT3> mCurrSolution;
+	std::vector<XMFLOAT3> mNormals;
+	std::vector<XMFLOAT3> mTangentX;
+};
+
+static float MaxDifference(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+	return std::max(std::fabs(a.x - b.x), std::max(std::fabs(a.y - b.y), std::fabs(a.z - b.z)));
+}
+
+template<class WaveSolver>
+static void DisturbGrid(WaveSolver& waves, int size)
+{
+	std::mt19937 rng(size);
+	std::uniform_int_distribution<int> cell(4, size - 5);
+	for(int k = 0; k < 64; ++k)
+	{
+		int i = cell(rng);
+		int j = cell(rng);
+		waves.Disturb(i, j, 0.2f + 0.3f * (k % 4));
+	}
+}
+
+// Same settings as the demos, with the grid size varied.  Both solvers get the same
+// disturbances, so after the timed steps their solutions should agree.  Nothing is
+// allowed to come to rest, as the reference simulates the whole grid.
+static void ReportGrid(int size)
+{
+	const float timeStep = 0.03f;
+	Waves waves(size, size, 1.0f, timeStep, 4.0f, 0.2f);
+	waves.SetRestThreshold(0.0f);
+	ReferenceWaves reference(size, size, 1.0f, timeStep, 4.0f, 0.2f);
+	DisturbGrid(waves, size);
+	DisturbGrid(reference, size);
+
+	// Enough steps for roughly 2^28 cell updates, at least 4.
+	int steps = std::max(4, (int)((1ll << 28) / ((long long)size * size)));
+	auto start = Clock::now();
+	for(int s = 0; s < steps; ++s)
+		reference.Step();
+	double referenceSeconds = Seconds(start, Clock::now());
+	start = Clock::now();
+	for(int s = 0; s < steps; ++s)
+		waves.Update(timeStep);
+	double seconds = Seconds(start, Clock::now());
+
+	float heightError = 0.0f, normalError = 0.0f, tangentError = 0.0f;
+	for(int i = 0; i < waves.VertexCount(); ++i)
+	{
+		heightError = std::max(heightError, MaxDifference(waves.Position(i), reference.Position(i)));
+		normalError = std::max(normalError, MaxDifference(waves.Normal(i), reference.Normal(i)));
+		tangentError = std::max(tangentError, MaxDifference(waves.TangentX(i), reference.TangentX(i)));
+	}
+
+	double cells = (double)(size - 2) * (size - 2) * steps;
+	printf("%5d^2 %6d %12.1f %12.1f %8.2fx %10.2e %10.2e %10.2e\n", size, steps, cells / referenceSeconds / 1e6,
+		cells / seconds / 1e6, referenceSeconds / seconds, heightError, normalError, tangentError);
+}
+
+// Update throughput on one grid for pools of 1..maxThreads threads and a few grain
+// sizes, checking every run ends with the same heights as the single threaded one.
+static void ReportThreads(int size, int maxThreads)
+{
+	const float timeStep = 0.03f;
+	int steps = std::max(4, (int)((1ll << 27) / ((long long)size * size)));
+	std::vector<float> expected;
+	printf("\n%d^2, %d steps: Mcells/s by threads and grain size (rows per task)\n", size, steps);
+	printf("%8s %10s %10s %10s %10s\n", "threads", "grain 4", "grain 16", "grain 64", "same");
+	for(int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		ThreadPool pool(threads);
+		printf("%8d", threads);
+		bool same = true;
+		for(int grain : { 4, 16, 64 })
+		{
+			Waves waves(size, size, 1.0f, timeStep, 4.0f, 0.2f);
+			waves.SetThreadPool(&pool);
+			waves.SetGrainSize(grain);
+			DisturbGrid(waves, size);
+			auto start = Clock::now();
+			for(int s = 0; s < steps; ++s)
+				waves.Update(timeStep);
+			double seconds = Seconds(start, Clock::now());
+			printf(" %10.1f", (double)(size - 2) * (size - 2) * steps / seconds / 1e6);
+			if(expected.empty())
+				expected.assign(waves.Heights(), waves.Heights() + waves.VertexCount());
+			else
+				same = same && memcmp(expected.data(), waves.Heights(), expected.size() * sizeof(float)) == 0;
+		}
+		printf(" %10s\n", same ? "yes" : "NO");
+	}
+}
+
+// Time per step when each Update is due substeps steps, taken one sweep per step and
+// temporally blocked, checking both end with the same solution.
+static void ReportSubsteps(int size)
+{
+	const float timeStep = 0.03f;
+	int updates = std::max(4, (int)((1ll << 27) / ((long long)size * size)));
+	printf("\n%d^2: ms per step by substeps per Update\n", size);
+	printf("%9s %10s %10s %9s %10s\n", "substeps", "sweeps", "blocked", "speedup", "same");
+	for(int substeps : { 1, 2, 4, 8 })
+	{
+		double seconds[2];
+		std::vector<float> heights[2];
+		std::vector<XMFLOAT3> normals[2];
+		bool counted = true;
+		for(int blocked = 0; blocked < 2; ++blocked)
+		{
+			Waves waves(size, size, 1.0f, timeStep, 4.0f, 0.2f);
+			waves.SetMaxSubsteps(substeps);
+			waves.SetTemporalBlocking(blocked != 0);
+			DisturbGrid(waves, size);
+
+			// Half a step extra per call, so rounding never leaves a step short; the
+			// excess piles up and is dropped by the catch-up limit.  The first call
+			// allocates the blocking buffers and is left out of the timing.
+			counted = waves.Update((substeps + 0.5f) * timeStep) == substeps && counted;
+			auto start = Clock::now();
+			for(int u = 1; u < updates; ++u)
+				counted = waves.Update((substeps + 0.5f) * timeStep) == substeps && counted;
+			seconds[blocked] = Seconds(start, Clock::now());
+
+			heights[blocked].assign(waves.Heights(), waves.Heights() + waves.VertexCount());
+			for(int i = 0; i < waves.VertexCount(); ++i)
+				normals[blocked].push_back(waves.Normal(i));
+		}
+
+		bool same = counted && heights[0] == heights[1] &&
+			memcmp(normals[0].data(), normals[1].data(), normals[0].size() * sizeof(XMFLOAT3)) == 0;
+		double steps = (double)(updates - 1) * substeps;
+		printf("%9d %10.3f %10.3f %8.2fx %10s\n", substeps, seconds[0] / steps * 1e3, seconds[1] / steps * 1e3,
+			seconds[0] / seconds[1], same ? "yes" : "NO");
+	}
+}
+
+// Temporal blocking against one sweep per step on small grids of odd shapes, including
+// row counts that leave a last block of a single row, where a block is grain rows or
+// 8*(substeps+1), whichever is larger.  Both must end with the same solution.
+static void CheckTemporalBlocking()
+{
+	const float timeStep = 0.03f;
+	printf("\nTemporal blocking against sweeps on odd grids\n");
+	printf("%9s %8s %10s\n", "substeps", "grids", "same");
+	for(int substeps = 2; substeps <= 8; ++substeps)
+	{
+		int blockRows = 8*(substeps + 1);
+		int grids = 0;
+		bool same = true;
+		for(int m : { 2 + blockRows + 1, 2 + 2*blockRows + 1, 2 + blockRows + 5, 27, 59 })
+		{
+			for(int n : { 45, 103 })
+			{
+				for(int grain : { 3, 11, 16 })
+				{
+					std::vector<float> heights[2];
+					std::vector<XMFLOAT3> normals[2];
+					for(int blocked = 0; blocked < 2; ++blocked)
+					{
+						Waves waves(m, n, 1.0f, timeStep, 4.0f, 0.2f);
+						waves.SetRestThreshold(0.0f);
+						waves.SetGrainSize(grain);
+						waves.SetMaxSubsteps(substeps);
+						waves.SetTemporalBlocking(blocked != 0);
+						std::mt19937 rng(m*n + grain);
+						for(int u = 0; u < 4; ++u)
+						{
+							for(int k = 0; k < 4; ++k)
+								waves.Disturb(2 + rng() % (m - 4), 2 + rng() % (n - 4), 0.5f);
+							waves.Update((substeps + 0.5f) * timeStep);
+						}
+
+						heights[blocked].assign(waves.Heights(), waves.Heights() + waves.VertexCount());
+						for(int i = 0; i < waves.VertexCount(); ++i)
+							normals[blocked].push_back(waves.Normal(i));
+					}
+					same = same && heights[0] == heights[1] &&
+						memcmp(normals[0].data(), normals[1].data(), normals[0].size() * sizeof(XMFLOAT3)) == 0;
+					++grids;
+				}
+			}
+		}
+		printf("%9d %8d %10s\n", substeps, grids, same ? "yes" : "NO");
+	}
+}
+
+// One disturbance in the middle of a large grid, left to spread and die down.  Reports
+// the cost of Update and the share of the grid it marks dirty as time goes on.
+static void ReportSettling(int size)
+{
+	const float timeStep = 0.03f;
+	Waves waves(size, size, 1.0f, timeStep, 4.0f, 0.2f);
+	waves.Disturb(size / 2, size / 2, 0.5f);
+
+	printf("\n%d^2, one disturbance: ms per Update and dirty share of the grid\n", size);
+	printf("%8s %10s %10s %10s\n", "seconds", "ms", "dirty", "active");
+	const int updatesPerReport = 256;
+	for(int report = 1; report <= 16; ++report)
+	{
+		long long dirtyPoints = 0;
+		auto start = Clock::now();
+		for(int u = 0; u < updatesPerReport; ++u)
+		{
+			waves.Update(timeStep);
+			const Waves::Region& dirty = waves.DirtyRegion();
+			if(!dirty.Empty())
+				dirtyPoints += (long long)(dirty.EndRow - dirty.FirstRow) * (dirty.EndCol - dirty.FirstCol);
+		}
+		double seconds = Seconds(start, Clock::now());
+
+		const Waves::Region& active = waves.ActiveRegion();
+		long long activePoints = active.Empty() ? 0 :
+			(long long)(active.EndRow - active.FirstRow) * (active.EndCol - active.FirstCol);
+		double gridPoints = (double)waves.VertexCount();
+		printf("%8.1f %10.3f %9.2f%% %9.2f%%\n", report * updatesPerReport * timeStep,
+			seconds / updatesPerReport * 1e3, 100.0 * dirtyPoints / updatesPerReport / gridPoints, 100.0 * activePoints / gridPoints);
+	}
+}
+
+// A clipmap against one uniform grid at its finest spacing and full extent, with
+// disturbances all over the water and the camera drifting across it.
+static void ReportClipmap(int levels, int size)
+{
+	const float timeStep = 0.03f;
+	WaveClipmap clipmap(levels, size, 1.0f, timeStep, 4.0f, 0.2f);
+	int uniformSize = ((size - 1) << (levels - 1)) + 1;
+	Waves uniform(uniformSize, uniformSize, 1.0f, timeStep, 4.0f, 0.2f);
+
+	std::mt19937 rng(size);
+	std::uniform_real_distribution<float> offset(-0.45f*(uniformSize - 1), 0.45f*(uniformSize - 1));
+	for(int k = 0; k < 256; ++k)
+	{
+		float x = offset(rng), z = offset(rng);
+		clipmap.Disturb(x, z, 0.5f);
+		uniform.Disturb(uniformSize/2 - (int)z, uniformSize/2 + (int)x, 0.5f);
+	}
+
+	const int updates = 64;
+	int recenters = 0;
+	auto start = Clock::now();
+	for(int u = 0; u < updates; ++u)
+	{
+		recenters += clipmap.SetCenter(0.5f*u, 0.25f*u) ? 1 : 0;
+		clipmap.Update(timeStep);
+	}
+	double clipmapSeconds = Seconds(start, Clock::now());
+	start = Clock::now();
+	for(int u = 0; u < updates; ++u)
+		uniform.Update(timeStep);
+	double uniformSeconds = Seconds(start, Clock::now());
+
+	std::vector<std::uint32_t> indices;
+	clipmap.BuildIndices(indices);
+	printf("\n%d levels of %d^2 (%d recenters) against a uniform %d^2 grid\n", levels, size, recenters, uniformSize);
+	printf("%10s %12s %12s %10s\n", "", "vertices", "triangles", "ms/update");
+	printf("%10s %12d %12zu %10.3f\n", "clipmap", clipmap.VertexCount(), indices.size() / 3, clipmapSeconds / updates * 1e3);
+	printf("%10s %12d %12d %10.3f\n", "uniform", uniform.VertexCount(), uniform.TriangleCount(), uniformSeconds / updates * 1e3);
+}
+
+// Textbook scalar radix-2 transform of one row or column, with the same sign and
+// scaling as FFT2D::Inverse.
+static void ReferenceFFT(std::vector<double>& re, std::vector<double>& im)
+{
+	int n = (int)re.size();
+	for(int i = 1, j = 0; i < n; ++i)
+	{
+		int bit = n >> 1;
+		for(; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if(i < j)
+		{
+			std::swap(re[i], re[j]);
+			std::swap(im[i], im[j]);
+		}
+	}
+	for(int len = 2; len <= n; len *= 2)
+	{
+		double angle = 2.0 * 3.14159265358979323846 / len;
+		for(int group = 0; group < n; group += len)
+		{
+			for(int k = 0; k < len / 2; ++k)
+			{
+				double wRe = std::cos(angle * k), wIm = std::sin(angle * k);
+				int a = group + k, b = group + k + len / 2;
+				double tRe = wRe * re[b] - wIm * im[b];
+				double tIm = wRe * im[b] + wIm * re[b];
+				re[b] = re[a] - tRe;
+				im[b] = im[a] - tIm;
+				re[a] += tRe;
+				im[a] += tIm;
+			}
+		}
+	}
+}
+
+static void ReferenceFFT2D(std::vector<double>& re, std::vector<double>& im, int n)
+{
+	std::vector<double> lineRe(n), lineIm(n);
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		for(int line = 0; line < n; ++line)
+		{
+			int start = pass == 0 ? line * n : line;
+			int stride = pass == 0 ? 1 : n;
+			for(int k = 0; k < n; ++k)
+			{
+				lineRe[k] = re[start + k * stride];
+				lineIm[k] = im[start + k * stride];
+			}
+			ReferenceFFT(lineRe, lineIm);
+			for(int k = 0; k < n; ++k)
+			{
+				re[start + k * stride] = lineRe[k];
+				im[start + k * stride] = lineIm[k];
+			}
+		}
+	}
+}
+
+// FFT2D::Inverse against the scalar transform in double precision on random data.  The
+// error is relative to the largest output.  GFLOP/s counts 5*N*log2(N) per transform
+// of N = n*n points.
+static void ReportFFT(int size)
+{
+	int n = size;
+	std::vector<float> re(n * n), im(n * n);
+	std::mt19937 rng(n);
+	std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+	for(int i = 0; i < n * n; ++i)
+	{
+		re[i] = value(rng);
+		im[i] = value(rng);
+	}
+	std::vector<double> referenceRe(re.begin(), re.end()), referenceIm(im.begin(), im.end());
+
+	auto start = Clock::now();
+	ReferenceFFT2D(referenceRe, referenceIm, n);
+	double referenceSeconds = Seconds(start, Clock::now());
+
+	FFT2D fft(n);
+	std::vector<float> outRe = re, outIm = im;
+	fft.Inverse(outRe.data(), outIm.data(), ThreadPool::Default());
+	double largest = 0.0, error = 0.0;
+	for(int i = 0; i < n * n; ++i)
+	{
+		largest = std::max(largest, std::max(std::fabs(referenceRe[i]), std::fabs(referenceIm[i])));
+		error = std::max(error, std::max(std::fabs(outRe[i] - referenceRe[i]), std::fabs(outIm[i] - referenceIm[i])));
+	}
+
+	int transforms = std::max(4, (int)((1ll << 26) / ((long long)n * n)));
+	start = Clock::now();
+	for(int t = 0; t < transforms; ++t)
+	{
+		outRe = re;
+		outIm = im;
+		fft.Inverse(outRe.data(), outIm.data(), ThreadPool::Default());
+	}
+	double seconds = Seconds(start, Clock::now()) / transforms;
+
+	double flops = 5.0 * n * n * std::log2((double)n * n);
+	printf("%5d^2 %12.3f %12.3f %8.2fx %10.2f %10.2e\n", n, referenceSeconds * 1e3, seconds * 1e3,
+		referenceSeconds / seconds, flops / seconds / 1e9, error / largest);
+}
+
+// Cost of SpectralOcean::Update, three transforms plus the spectrum, for both spectra.
+static void ReportOcean(int size)
+{
+	double seconds[2];
+	for(int spectrum = 0; spectrum < 2; ++spectrum)
+	{
+		OceanSettings settings;
+		settings.Spectrum = spectrum == 0 ? OceanSpectrum::Phillips : OceanSpectrum::Jonswap;
+		SpectralOcean ocean(size, 0.5f * size, settings);
+		int updates = std::max(4, (int)((1ll << 24) / ((long long)size * size)));
+		auto start = Clock::now();
+		for(int u = 0; u < updates; ++u)
+			ocean.Update(1.0f / 60.0f);
+		seconds[spectrum] = Seconds(start, Clock::now()) / updates;
+	}
+	printf("%5d^2 %12.3f %12.3f\n", size, seconds[0] * 1e3, seconds[1] * 1e3);
+}
+
+int main(int argc, char** argv)
+{
+	int maxSize = argc > 1 ? atoi(argv[1]) : 4096;
+	int maxThreads = argc > 2 ? atoi(argv[2]) : std::max(1, (int)std::thread::hardware_concurrency());
+	printf("Mcells/s per step, height + normal + tangent\n");
+	printf("%7s %6s %12s %12s %9s %10s %10s %10s\n", "grid", "steps", "reference", "Waves", "speedup",
+		"max dh", "max dn", "max dt");
+	for(int size = 128; size <= maxSize; size *= 2)
+		ReportGrid(size);
+	ReportThreads(std::min(maxSize, 1024), maxThreads);
+	for(int size = 1024; size <= maxSize; size *= 4)
+		ReportSubsteps(size);
+	CheckTemporalBlocking();
+	ReportSettling(maxSize);
+	ReportClipmap(5, 257);
+
+	printf("\nInverse FFT: ms per transform against a scalar reference\n");
+	printf("%7s %12s %12s %9s %10s %10s\n", "grid", "reference", "FFT2D", "speedup", "GFLOP/s", "rel error");
+	for(int size = 256; size <= std::min(maxSize, 1024); size *= 2)
+		ReportFFT(size);
+	printf("\nSpectralOcean: ms per Update\n");
+	printf("%7s %12s %12s\n", "grid", "Phillips", "JONSWAP");
+	for(int size = 256; size <= std::min(maxSize, 1024); size *= 2)
+		ReportOcean(size);
+	return 0;
+}
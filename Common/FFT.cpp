@@ -0,0 +1,202 @@
+//***************************************************************************************
+// FFT.cpp
+//***************************************************************************************
+
+#include "FFT.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <immintrin.h>
+
+namespace
+{
+
+#if defined(__AVX__)
+typedef __m256 SimdFloat;
+const int SimdWidth = 8;
+inline SimdFloat SimdLoad(const float* p) { return _mm256_loadu_ps(p); }
+inline void SimdStore(float* p, SimdFloat v) { _mm256_storeu_ps(p, v); }
+inline SimdFloat SimdSet1(float x) { return _mm256_set1_ps(x); }
+inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a, b); }
+inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+#else
+typedef __m128 SimdFloat;
+const int SimdWidth = 4;
+inline SimdFloat SimdLoad(const float* p) { return _mm_loadu_ps(p); }
+inline void SimdStore(float* p, SimdFloat v) { _mm_storeu_ps(p, v); }
+inline SimdFloat SimdSet1(float x) { return _mm_set1_ps(x); }
+inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm_add_ps(a, b); }
+inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a, b); }
+inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a, b); }
+#endif
+
+// Columns per task of the column transform; a strip of a 1024 point transform is
+// 256KB, which stays in L2 through all the passes.
+const int StripWidth = 32;
+
+// Rows and columns of the tiles the transpose swaps.
+const int TileSize = 32;
+
+}
+
+FFT2D::FFT2D(int n)
+{
+	assert(n > 0 && (n & (n - 1)) == 0);
+	mSize = n;
+
+	int logSize = 0;
+	while((1 << logSize) < n)
+		++logSize;
+
+	mBitReverse.resize(n);
+	for(int i = 0; i < n; ++i)
+	{
+		int reversed = 0;
+		for(int bit = 0; bit < logSize; ++bit)
+			reversed |= ((i >> bit) & 1) << (logSize - 1 - bit);
+		mBitReverse[i] = reversed;
+	}
+
+	mTwiddleRe.resize(std::max(1, n / 2));
+	mTwiddleIm.resize(std::max(1, n / 2));
+	for(int k = 0; k < n / 2; ++k)
+	{
+		double angle = 2.0 * 3.14159265358979323846 * k / n;
+		mTwiddleRe[k] = (float)std::cos(angle);
+		mTwiddleIm[k] = (float)std::sin(angle);
+	}
+}
+
+int FFT2D::Size()const
+{
+	return mSize;
+}
+
+void FFT2D::Inverse(float* re, float* im, ThreadPool& pool)const
+{
+	int n = mSize;
+	int stripWidth = std::min(n, StripWidth);
+	int strips = n / stripWidth;
+	int tileRows = (n + TileSize - 1) / TileSize;
+
+	auto columns = [&](int firstStrip, int endStrip)
+	{
+		for(int strip = firstStrip; strip < endStrip; ++strip)
+			TransformColumns(re, im, strip*stripWidth, (strip + 1)*stripWidth);
+	};
+	auto transpose = [&](int firstTileRow, int endTileRow)
+	{
+		Transpose(re, firstTileRow, endTileRow);
+		Transpose(im, firstTileRow, endTileRow);
+	};
+
+	pool.ParallelFor(0, strips, 1, columns);
+	pool.ParallelFor(0, tileRows, 1, transpose);
+	pool.ParallelFor(0, strips, 1, columns);
+	pool.ParallelFor(0, tileRows, 1, transpose);
+}
+
+void FFT2D::TransformColumns(float* re, float* im, int firstCol, int endCol)const
+{
+	int n = mSize;
+	int width = endCol - firstCol;
+
+	// The strip is worked on in a packed copy.  Rows of the arrays themselves are a
+	// power of two apart and would all land in the same few cache sets.  The copy in
+	// also does the bit reversal.
+	thread_local std::vector<float> scratch;
+	scratch.resize(2*n*width);
+	float* stripRe = scratch.data();
+	float* stripIm = scratch.data() + n*width;
+	for(int i = 0; i < n; ++i)
+	{
+		int from = mBitReverse[i]*n + firstCol;
+		std::copy(re + from, re + from + width, stripRe + i*width);
+		std::copy(im + from, im + from + width, stripIm + i*width);
+	}
+
+	// Iterative radix-2 decimation in time.  Each butterfly combines rows a and b with
+	// one twiddle factor, across every column of the strip.
+	for(int half = 1; half < n; half *= 2)
+	{
+		int twiddleStep = n / (2*half);
+		for(int group = 0; group < n; group += 2*half)
+		{
+			for(int k = 0; k < half; ++k)
+			{
+				float wRe = mTwiddleRe[k*twiddleStep];
+				float wIm = mTwiddleIm[k*twiddleStep];
+				float* aRe = stripRe + (group + k)*width;
+				float* aIm = stripIm + (group + k)*width;
+				float* bRe = stripRe + (group + k + half)*width;
+				float* bIm = stripIm + (group + k + half)*width;
+
+				SimdFloat vwRe = SimdSet1(wRe);
+				SimdFloat vwIm = SimdSet1(wIm);
+				int c = 0;
+				for(; c + SimdWidth <= width; c += SimdWidth)
+				{
+					SimdFloat xRe = SimdLoad(bRe + c);
+					SimdFloat xIm = SimdLoad(bIm + c);
+					SimdFloat tRe = SimdSub(SimdMul(vwRe, xRe), SimdMul(vwIm, xIm));
+					SimdFloat tIm = SimdAdd(SimdMul(vwRe, xIm), SimdMul(vwIm, xRe));
+					SimdFloat yRe = SimdLoad(aRe + c);
+					SimdFloat yIm = SimdLoad(aIm + c);
+					SimdStore(bRe + c, SimdSub(yRe, tRe));
+					SimdStore(bIm + c, SimdSub(yIm, tIm));
+					SimdStore(aRe + c, SimdAdd(yRe, tRe));
+					SimdStore(aIm + c, SimdAdd(yIm, tIm));
+				}
+				for(; c < width; ++c)
+				{
+					float tRe = wRe*bRe[c] - wIm*bIm[c];
+					float tIm = wRe*bIm[c] + wIm*bRe[c];
+					bRe[c] = aRe[c] - tRe;
+					bIm[c] = aIm[c] - tIm;
+					aRe[c] += tRe;
+					aIm[c] += tIm;
+				}
+			}
+		}
+	}
+
+	for(int i = 0; i < n; ++i)
+	{
+		std::copy(stripRe + i*width, stripRe + (i + 1)*width, re + i*n + firstCol);
+		std::copy(stripIm + i*width, stripIm + (i + 1)*width, im + i*n + firstCol);
+	}
+}
+
+void FFT2D::Transpose(float* data, int firstTileRow, int endTileRow)const
+{
+	// Each task owns tile rows and swaps their tiles with the mirrored ones below the
+	// diagonal, so no tile is touched by two tasks.  Both tiles go through local copies
+	// so each row of a tile is read and written once, in order.
+	int n = mSize;
+	float upper[TileSize*TileSize];
+	float lower[TileSize*TileSize];
+	for(int tileRow = firstTileRow; tileRow < endTileRow; ++tileRow)
+	{
+		int i0 = tileRow*TileSize;
+		int rows = std::min(TileSize, n - i0);
+		for(int j0 = i0; j0 < n; j0 += TileSize)
+		{
+			int cols = std::min(TileSize, n - j0);
+			for(int i = 0; i < rows; ++i)
+				std::copy(data + (i0 + i)*n + j0, data + (i0 + i)*n + j0 + cols, upper + i*TileSize);
+			for(int j = 0; j < cols; ++j)
+				std::copy(data + (j0 + j)*n + i0, data + (j0 + j)*n + i0 + rows, lower + j*TileSize);
+			for(int i = 0; i < rows; ++i)
+			{
+				for(int j = 0; j < cols; ++j)
+					data[(i0 + i)*n + j0 + j] = lower[j*TileSize + i];
+			}
+			for(int j = 0; j < cols; ++j)
+			{
+				for(int i = 0; i < rows; ++i)
+					data[(j0 + j)*n + i0 + i] = upper[i*TileSize + j];
+			}
+		}
+	}
+}
@@ -0,0 +1,40 @@
+//***************************************************************************************
+// FFT.h
+//
+// Square 2D complex FFT on split real/imaginary arrays.  Rows are transformed as whole
+// vectors: every butterfly of the column transform combines two rows, so the inner
+// loops run over contiguous floats in SIMD registers.  The row transform is the column
+// transform between two transposes.  Strips of columns and blocks of the transposes
+// are spread over a ThreadPool.
+//***************************************************************************************
+
+#pragma once
+
+#include <vector>
+#include "ThreadPool.h"
+
+class FFT2D
+{
+public:
+	// n must be a power of two.
+	explicit FFT2D(int n);
+	FFT2D(const FFT2D& rhs) = delete;
+	FFT2D& operator=(const FFT2D& rhs) = delete;
+
+	int Size()const;
+
+	// In place, on row-major n by n arrays, without scaling:
+	// x[r][c] = sum over u, v of X[u][v] * exp(2*pi*i*(u*r + v*c)/n).
+	void Inverse(float* re, float* im, ThreadPool& pool)const;
+
+private:
+	void TransformColumns(float* re, float* im, int firstCol, int endCol)const;
+	void Transpose(float* data, int firstBlockRow, int endBlockRow)const;
+
+	int mSize = 0;
+	std::vector<int> mBitReverse;
+
+	// exp(2*pi*i*k/n) for k < n/2.
+	std::vector<float> mTwiddleRe;
+	std::vector<float> mTwiddleIm;
+};
@@ -0,0 +1,112 @@
+//***************************************************************************************
+// MappedFile.cpp
+//***************************************************************************************
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(view == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	mFile = file;
+	mMapping = mapping;
+	mData = (const uint8_t*)view;
+	mSize = (size_t)size.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if(mData != nullptr)
+		UnmapViewOfFile(mData);
+	if(mMapping != nullptr)
+		CloseHandle(mMapping);
+	if(mFile != nullptr)
+		CloseHandle(mFile);
+	mData = nullptr;
+	mMapping = nullptr;
+	mFile = nullptr;
+	mSize = 0;
+}
+
+#else
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+	int file = open(filename, O_RDONLY);
+	if(file < 0)
+		return false;
+	struct stat info;
+	if(fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		close(file);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps the file alive on its own.
+	close(file);
+	if(view == MAP_FAILED)
+		return false;
+	mData = (const uint8_t*)view;
+	mSize = (size_t)info.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if(mData != nullptr)
+		munmap((void*)mData, mSize);
+	mData = nullptr;
+	mSize = 0;
+}
+
+#endif
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for(size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
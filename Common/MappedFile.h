@@ -0,0 +1,38 @@
+//***************************************************************************************
+// MappedFile.h
+//
+// Read-only memory mapping of a whole file, so binary assets can be used in place
+// instead of being read into a separate buffer.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile& rhs) = delete;
+	MappedFile& operator=(const MappedFile& rhs) = delete;
+
+	// Fails for missing or empty files.
+	bool Open(const char* filename);
+	void Close();
+
+	const uint8_t* Data()const { return mData; }
+	size_t Size()const { return mSize; }
+
+private:
+	const uint8_t* mData = nullptr;
+	size_t mSize = 0;
+#ifdef _WIN32
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+#endif
+};
+
+// 64-bit FNV-1a.
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
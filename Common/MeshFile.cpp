@@ -0,0 +1,168 @@
+//***************************************************************************************
+// MeshFile.cpp
+//***************************************************************************************
+
+#include "MeshFile.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <utility>
+
+static const char MeshMagic[4] = { 'M', 'E', 'S', 'H' };
+
+static uint64_t AlignStream(uint64_t offset)
+{
+	return (offset + 15) & ~(uint64_t)15;
+}
+
+static bool GetSourceStamp(const char* filename, uint64_t& size, int64_t& time)
+{
+#ifdef _WIN32
+	struct __stat64 info;
+	if(_stat64(filename, &info) != 0)
+		return false;
+#else
+	struct stat info;
+	if(stat(filename, &info) != 0)
+		return false;
+#endif
+	size = (uint64_t)info.st_size;
+	time = (int64_t)info.st_mtime;
+	return true;
+}
+
+bool MeshFile::Open(const char* filename)
+{
+	Close();
+	if(!mFile.Open(filename) || mFile.Size() < sizeof(MeshFileHeader))
+	{
+		Close();
+		return false;
+	}
+	const MeshFileHeader* header = (const MeshFileHeader*)mFile.Data();
+	uint64_t size = mFile.Size();
+	uint64_t vertexBytes = (uint64_t)header->VertexCount * 3 * sizeof(float);
+	uint64_t indexBytes = (uint64_t)header->IndexCount * sizeof(uint32_t);
+	// Written so a damaged offset cannot wrap the end of a stream past the file size.
+	auto fits = [size](uint64_t offset, uint64_t bytes) { return offset <= size && bytes <= size - offset; };
+	if(memcmp(header->Magic, MeshMagic, sizeof(MeshMagic)) != 0 || header->Version != MESH_FILE_VERSION ||
+		!fits(header->PositionOffset, vertexBytes) ||
+		!fits(header->NormalOffset, vertexBytes) ||
+		!fits(header->IndexOffset, indexBytes) ||
+		(header->PositionOffset | header->NormalOffset | header->IndexOffset) % 16 != 0)
+	{
+		Close();
+		return false;
+	}
+	mHeader = header;
+	mPositions = (const float*)(mFile.Data() + header->PositionOffset);
+	mNormals = (const float*)(mFile.Data() + header->NormalOffset);
+	mIndices = (const uint32_t*)(mFile.Data() + header->IndexOffset);
+	return true;
+}
+
+bool MeshFile::OpenModel(const char* textFile)
+{
+	std::string meshFile = textFile;
+	size_t dot = meshFile.find_last_of('.');
+	if(dot != std::string::npos && meshFile.find_first_of("/\\", dot) == std::string::npos)
+		meshFile.resize(dot);
+	meshFile += ".mesh";
+
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if(!GetSourceStamp(textFile, sourceSize, sourceTime))
+		return Open(meshFile.c_str());
+	if(Open(meshFile.c_str()) && mHeader->SourceSize == sourceSize && mHeader->SourceTime == sourceTime)
+		return true;
+	Close();
+
+	TextMeshData mesh;
+	if(!LoadTextMesh(textFile, mesh))
+		return false;
+	if(Write(meshFile.c_str(), mesh, sourceSize, sourceTime) && Open(meshFile.c_str()))
+		return true;
+	// No .mesh could be written next to the model (read-only directory, full disk),
+	// so serve the streams from the parsed model instead.
+	UseText(mesh);
+	return true;
+}
+
+void MeshFile::UseText(TextMeshData& mesh)
+{
+	Close();
+	mText = std::move(mesh);
+	memcpy(mTextHeader.Magic, MeshMagic, sizeof(MeshMagic));
+	mTextHeader.Version = MESH_FILE_VERSION;
+	mTextHeader.VertexCount = mText.VertexCount();
+	mTextHeader.IndexCount = (uint32_t)mText.Indices32.size();
+	memcpy(mTextHeader.BoundsMin, mText.BoundsMin, sizeof(mTextHeader.BoundsMin));
+	memcpy(mTextHeader.BoundsMax, mText.BoundsMax, sizeof(mTextHeader.BoundsMax));
+	mHeader = &mTextHeader;
+	mPositions = mText.Positions.data();
+	mNormals = mText.Normals.data();
+	mIndices = mText.Indices32.data();
+}
+
+void MeshFile::Close()
+{
+	mFile.Close();
+	mHeader = nullptr;
+	mPositions = nullptr;
+	mNormals = nullptr;
+	mIndices = nullptr;
+	mText = TextMeshData();
+}
+
+bool MeshFile::Write(const char* filename, const TextMeshData& mesh, uint64_t sourceSize, int64_t sourceTime)
+{
+	MeshFileHeader header = {};
+	memcpy(header.Magic, MeshMagic, sizeof(MeshMagic));
+	header.Version = MESH_FILE_VERSION;
+	header.VertexCount = mesh.VertexCount();
+	header.IndexCount = (uint32_t)mesh.Indices32.size();
+	header.SourceSize = sourceSize;
+	header.SourceTime = sourceTime;
+	memcpy(header.BoundsMin, mesh.BoundsMin, sizeof(header.BoundsMin));
+	memcpy(header.BoundsMax, mesh.BoundsMax, sizeof(header.BoundsMax));
+	uint64_t vertexBytes = (uint64_t)header.VertexCount * 3 * sizeof(float);
+	header.PositionOffset = AlignStream(sizeof(MeshFileHeader));
+	header.NormalOffset = AlignStream(header.PositionOffset + vertexBytes);
+	header.IndexOffset = AlignStream(header.NormalOffset + vertexBytes);
+
+	std::ofstream fout(filename, std::ios::binary);
+	if(!fout)
+		return false;
+	static const char padding[16] = {};
+	auto writeStream = [&](uint64_t offset, const void* data, uint64_t size)
+	{
+		uint64_t position = (uint64_t)fout.tellp();
+		fout.write(padding, offset - position);
+		fout.write((const char*)data, size);
+	};
+	fout.write((const char*)&header, sizeof(header));
+	writeStream(header.PositionOffset, mesh.Positions.data(), vertexBytes);
+	writeStream(header.NormalOffset, mesh.Normals.data(), vertexBytes);
+	writeStream(header.IndexOffset, mesh.Indices32.data(), (uint64_t)header.IndexCount * sizeof(uint32_t));
+	fout.close();
+	if(!fout)
+	{
+		std::remove(filename);
+		return false;
+	}
+	return true;
+}
+
+bool MeshFile::Convert(const char* textFile, const char* meshFile)
+{
+	TextMeshData mesh;
+	if(!LoadTextMesh(textFile, mesh))
+		return false;
+
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+	GetSourceStamp(textFile, sourceSize, sourceTime);
+	return Write(meshFile, mesh, sourceSize, sourceTime);
+}
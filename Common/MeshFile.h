@@ -0,0 +1,75 @@
+//***************************************************************************************
+// MeshFile.h
+//
+// Binary container (.mesh) for the VertexCount:/TriangleCount: text models: a header
+// with precomputed bounds followed by position, normal and index streams.  The file
+// is memory-mapped and the streams are used in place, so opening a mesh costs no
+// parsing and no copies.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include "MappedFile.h"
+#include "TextMesh.h"
+
+// Bump when the layout of MeshFileHeader or the streams changes.
+#define MESH_FILE_VERSION 1
+
+struct MeshFileHeader
+{
+	char Magic[4];				// "MESH"
+	uint32_t Version;
+	uint32_t VertexCount;
+	uint32_t IndexCount;
+	float BoundsMin[3];
+	float BoundsMax[3];
+	// Size and modification time of the text model this was converted from.
+	uint64_t SourceSize;
+	int64_t SourceTime;
+	// Byte offsets of the 16 byte aligned streams.
+	uint64_t PositionOffset;	// float3 per vertex
+	uint64_t NormalOffset;		// float3 per vertex
+	uint64_t IndexOffset;		// uint32 per index, three per triangle
+};
+
+class MeshFile
+{
+public:
+	MeshFile() = default;
+	MeshFile(const MeshFile& rhs) = delete;
+	MeshFile& operator=(const MeshFile& rhs) = delete;
+
+	// Fails for missing, truncated or out of date files.
+	bool Open(const char* filename);
+	// Opens the .mesh next to a text model (Models/skull.txt -> Models/skull.mesh),
+	// converting the text model first if the .mesh is missing or was converted from
+	// a different version of it.  When the .mesh cannot be written the parsed text
+	// model is kept in memory instead.
+	bool OpenModel(const char* textFile);
+	void Close();
+
+	uint32_t VertexCount()const { return mHeader->VertexCount; }
+	uint32_t IndexCount()const { return mHeader->IndexCount; }
+	const float* Positions()const { return mPositions; }
+	const float* Normals()const { return mNormals; }
+	const uint32_t* Indices()const { return mIndices; }
+	const float* BoundsMin()const { return mHeader->BoundsMin; }
+	const float* BoundsMax()const { return mHeader->BoundsMax; }
+
+	static bool Write(const char* filename, const TextMeshData& mesh, uint64_t sourceSize = 0, int64_t sourceTime = 0);
+	// Offline conversion of a text model.
+	static bool Convert(const char* textFile, const char* meshFile);
+
+private:
+	void UseText(TextMeshData& mesh);
+
+	MappedFile mFile;
+	const MeshFileHeader* mHeader = nullptr;
+	const float* mPositions = nullptr;
+	const float* mNormals = nullptr;
+	const uint32_t* mIndices = nullptr;
+	// Backs the streams when OpenModel fell back to the text model.
+	TextMeshData mText;
+	MeshFileHeader mTextHeader = {};
+};
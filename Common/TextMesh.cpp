@@ -0,0 +1,194 @@
+//***************************************************************************************
+// TextMesh.cpp
+//***************************************************************************************
+
+#include "TextMesh.h"
+#include "MappedFile.h"
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+
+// Exact powers of ten; a mantissa below 2^53 scaled by one of these is rounded once.
+const double Pow10[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+class Scanner
+{
+public:
+	Scanner(const char* text, size_t size) : mPos(text), mEnd(text + size) {}
+
+	void SkipWhitespace()
+	{
+		while(mPos < mEnd && (*mPos == ' ' || *mPos == '\t' || *mPos == '\r' || *mPos == '\n'))
+			++mPos;
+	}
+
+	// Skips one whitespace-delimited word, like "fin >> ignore".
+	bool SkipToken()
+	{
+		SkipWhitespace();
+		const char* start = mPos;
+		while(mPos < mEnd && *mPos != ' ' && *mPos != '\t' && *mPos != '\r' && *mPos != '\n')
+			++mPos;
+		return mPos != start;
+	}
+
+	bool ReadUint(uint32_t& value)
+	{
+		SkipWhitespace();
+		const char* start = mPos;
+		uint64_t v = 0;
+		while(mPos < mEnd && (unsigned)(*mPos - '0') < 10 && v <= UINT32_MAX)
+			v = v * 10 + (*mPos++ - '0');
+		value = (uint32_t)v;
+		return mPos != start && v <= UINT32_MAX;
+	}
+
+	bool ReadFloat(float& value)
+	{
+		SkipWhitespace();
+		const char* start = mPos;
+		bool negative = false;
+		if(mPos < mEnd && (*mPos == '-' || *mPos == '+'))
+			negative = *mPos++ == '-';
+
+		uint64_t mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		bool any = false;
+		for(; mPos < mEnd && (unsigned)(*mPos - '0') < 10; ++mPos, any = true)
+		{
+			if(digits < 19)
+			{
+				mantissa = mantissa * 10 + (*mPos - '0');
+				digits += mantissa != 0;
+			}
+			else
+				++exponent;
+		}
+		if(mPos < mEnd && *mPos == '.')
+		{
+			for(++mPos; mPos < mEnd && (unsigned)(*mPos - '0') < 10; ++mPos, any = true)
+			{
+				if(digits < 19)
+				{
+					mantissa = mantissa * 10 + (*mPos - '0');
+					digits += mantissa != 0;
+					--exponent;
+				}
+			}
+		}
+		if(!any)
+			return false;
+		if(mPos < mEnd && (*mPos == 'e' || *mPos == 'E'))
+		{
+			const char* e = mPos + 1;
+			bool negativeExponent = false;
+			if(e < mEnd && (*e == '-' || *e == '+'))
+				negativeExponent = *e++ == '-';
+			if(e < mEnd && (unsigned)(*e - '0') < 10)
+			{
+				int v = 0;
+				for(; e < mEnd && (unsigned)(*e - '0') < 10; ++e)
+					v = v < 10000 ? v * 10 + (*e - '0') : v;
+				exponent += negativeExponent ? -v : v;
+				mPos = e;
+			}
+		}
+
+		// Fast path: mantissa and power of ten are both exact doubles, so the product
+		// or quotient is correctly rounded.  Anything else goes through strtod.
+		double result;
+		if(mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+			result = exponent < 0 ? (double)mantissa / Pow10[-exponent] : (double)mantissa * Pow10[exponent];
+		else
+		{
+			char buffer[64];
+			size_t length = (size_t)(mPos - start);
+			if(length >= sizeof(buffer))
+				return false;
+			memcpy(buffer, start, length);
+			buffer[length] = '\0';
+			result = strtod(buffer, nullptr);
+			negative = false;
+		}
+		value = (float)(negative ? -result : result);
+		return true;
+	}
+
+private:
+	const char* mPos;
+	const char* mEnd;
+};
+
+}
+
+bool ParseTextMesh(const char* text, size_t size, TextMeshData& mesh)
+{
+	Scanner scanner(text, size);
+
+	uint32_t vcount = 0;
+	uint32_t tcount = 0;
+	if(!scanner.SkipToken() || !scanner.ReadUint(vcount) ||
+		!scanner.SkipToken() || !scanner.ReadUint(tcount))
+		return false;
+	// "VertexList (pos, normal) {"
+	for(int i = 0; i < 4; ++i)
+	{
+		if(!scanner.SkipToken())
+			return false;
+	}
+
+	mesh.Positions.resize((size_t)vcount * 3);
+	mesh.Normals.resize((size_t)vcount * 3);
+	float* positions = mesh.Positions.data();
+	float* normals = mesh.Normals.data();
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		mesh.BoundsMin[axis] = vcount > 0 ? +FLT_MAX : 0.0f;
+		mesh.BoundsMax[axis] = vcount > 0 ? -FLT_MAX : 0.0f;
+	}
+	for(uint32_t i = 0; i < vcount; ++i)
+	{
+		float* p = positions + i * 3;
+		float* n = normals + i * 3;
+		if(!scanner.ReadFloat(p[0]) || !scanner.ReadFloat(p[1]) || !scanner.ReadFloat(p[2]) ||
+			!scanner.ReadFloat(n[0]) || !scanner.ReadFloat(n[1]) || !scanner.ReadFloat(n[2]))
+			return false;
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			mesh.BoundsMin[axis] = p[axis] < mesh.BoundsMin[axis] ? p[axis] : mesh.BoundsMin[axis];
+			mesh.BoundsMax[axis] = p[axis] > mesh.BoundsMax[axis] ? p[axis] : mesh.BoundsMax[axis];
+		}
+	}
+
+	// "} TriangleList {"
+	for(int i = 0; i < 3; ++i)
+	{
+		if(!scanner.SkipToken())
+			return false;
+	}
+
+	mesh.Indices32.resize((size_t)tcount * 3);
+	uint32_t* indices = mesh.Indices32.data();
+	for(size_t i = 0; i < mesh.Indices32.size(); ++i)
+	{
+		if(!scanner.ReadUint(indices[i]) || indices[i] >= vcount)
+			return false;
+	}
+	return true;
+}
+
+bool LoadTextMesh(const char* filename, TextMeshData& mesh)
+{
+	MappedFile file;
+	if(!file.Open(filename))
+		return false;
+	return ParseTextMesh((const char*)file.Data(), file.Size(), mesh);
+}
@@ -0,0 +1,30 @@
+//***************************************************************************************
+// TextMesh.h
+//
+// Loader for the "VertexCount:/TriangleCount:" text models (Models/skull.txt,
+// Models/car.txt).  The whole file is mapped at once and numbers are parsed in place
+// with a hand-written scanner instead of ifstream extraction; the bounds are found
+// in the same pass over the vertices.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct TextMeshData
+{
+	std::vector<float> Positions;		// xyz per vertex
+	std::vector<float> Normals;			// xyz per vertex
+	std::vector<uint32_t> Indices32;	// three per triangle
+	float BoundsMin[3] = { 0.0f, 0.0f, 0.0f };
+	float BoundsMax[3] = { 0.0f, 0.0f, 0.0f };
+
+	uint32_t VertexCount()const { return (uint32_t)(Positions.size() / 3); }
+	uint32_t TriangleCount()const { return (uint32_t)(Indices32.size() / 3); }
+};
+
+// Fails for missing or malformed files, including out of range indices.
+bool LoadTextMesh(const char* filename, TextMeshData& mesh);
+bool ParseTextMesh(const char* text, size_t size, TextMeshData& mesh);
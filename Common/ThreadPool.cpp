@@ -0,0 +1,176 @@
+//***************************************************************************************
+// ThreadPool.cpp
+//***************************************************************************************
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+// Set on pool threads and on a thread while it runs a loop, so nested loops run inline.
+static thread_local bool tInsideLoop = false;
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	if(threadCount <= 0)
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+
+	mSlices.reset(new Slice[threadCount]);
+	for(int i = 1; i < threadCount; ++i)
+		mWorkers.emplace_back(&ThreadPool::WorkerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mQuit = true;
+	}
+	mWake.notify_all();
+	for(auto& worker : mWorkers)
+		worker.join();
+}
+
+int ThreadPool::ThreadCount()const
+{
+	return (int)mWorkers.size() + 1;
+}
+
+ThreadPool& ThreadPool::Default()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::ParallelFor(int first, int last, int grainSize, const std::function<void(int, int)>& body)
+{
+	grainSize = std::max(1, grainSize);
+	if(last - first <= grainSize || mWorkers.empty() || tInsideLoop)
+	{
+		for(int begin = first; begin < last; begin += grainSize)
+			body(begin, std::min(begin + grainSize, last));
+		return;
+	}
+
+	std::lock_guard<std::mutex> loopLock(mLoopLock);
+
+	// Deal the range out evenly; stealing evens out whatever imbalance is left.
+	int threadCount = ThreadCount();
+	int64_t count = last - first;
+	for(int i = 0; i < threadCount; ++i)
+	{
+		std::lock_guard<std::mutex> lock(mSlices[i].Lock);
+		mSlices[i].Begin = first + (int)(count * i / threadCount);
+		mSlices[i].End = first + (int)(count * (i + 1) / threadCount);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mBody = &body;
+		mGrainSize = grainSize;
+		mException = nullptr;
+		mFailed = false;
+		mRunningWorkers = (int)mWorkers.size();
+		++mGeneration;
+	}
+	mWake.notify_all();
+
+	tInsideLoop = true;
+	RunSlices(0);
+	tInsideLoop = false;
+
+	// Every range has been taken once our slices are empty, but workers may still
+	// be running theirs.
+	std::unique_lock<std::mutex> lock(mLock);
+	mDone.wait(lock, [this] { return mRunningWorkers == 0; });
+	mBody = nullptr;
+	if(mException)
+	{
+		std::exception_ptr exception = mException;
+		mException = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+void ThreadPool::WorkerMain(int slot)
+{
+	tInsideLoop = true;
+	uint64_t generation = 0;
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mLock);
+			mWake.wait(lock, [&] { return mQuit || mGeneration != generation; });
+			if(mQuit)
+				return;
+			generation = mGeneration;
+		}
+
+		RunSlices(slot);
+
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			--mRunningWorkers;
+		}
+		mDone.notify_one();
+	}
+}
+
+void ThreadPool::RunSlices(int slot)
+{
+	int begin, end;
+	while(!mFailed && TakeRange(slot, begin, end))
+	{
+		try
+		{
+			(*mBody)(begin, end);
+		}
+		catch(...)
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			if(!mException)
+				mException = std::current_exception();
+			mFailed = true;
+		}
+	}
+}
+
+bool ThreadPool::TakeRange(int slot, int& begin, int& end)
+{
+	int threadCount = ThreadCount();
+	for(;;)
+	{
+		{
+			Slice& own = mSlices[slot];
+			std::lock_guard<std::mutex> lock(own.Lock);
+			if(own.Begin < own.End)
+			{
+				begin = own.Begin;
+				end = std::min(begin + mGrainSize, own.End);
+				own.Begin = end;
+				return true;
+			}
+		}
+
+		// Steal the back half of the first non-empty slice after ours.  Stolen ranges
+		// can be stolen again before we take from them, hence the loop; we only give
+		// up once every slice is empty.
+		int stolenBegin = 0, stolenEnd = 0;
+		for(int i = 1; i < threadCount && stolenBegin == stolenEnd; ++i)
+		{
+			Slice& victim = mSlices[(slot + i) % threadCount];
+			std::lock_guard<std::mutex> lock(victim.Lock);
+			int remaining = victim.End - victim.Begin;
+			if(remaining <= 0)
+				continue;
+			stolenBegin = remaining > mGrainSize ? victim.Begin + remaining / 2 : victim.Begin;
+			stolenEnd = victim.End;
+			victim.End = stolenBegin;
+		}
+		if(stolenBegin == stolenEnd)
+			return false;
+
+		Slice& own = mSlices[slot];
+		std::lock_guard<std::mutex> lock(own.Lock);
+		own.Begin = stolenBegin;
+		own.End = stolenEnd;
+	}
+}
@@ -0,0 +1,74 @@
+//***************************************************************************************
+// ThreadPool.h
+//
+// Portable replacement for concurrency::parallel_for built on std::thread.  Each
+// thread owns a slice of the index range and takes grain-sized pieces from its front;
+// a thread that runs out steals the back half of another thread's slice.
+//***************************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// 0 uses one thread per hardware thread.  The thread calling ParallelFor takes
+	// part in the loop, so a pool of N threads starts N-1 workers.
+	explicit ThreadPool(int threadCount = 0);
+	ThreadPool(const ThreadPool& rhs) = delete;
+	ThreadPool& operator=(const ThreadPool& rhs) = delete;
+	~ThreadPool();
+
+	int ThreadCount()const;
+
+	// Calls body(begin, end) on sub-ranges of [first, last) no longer than grainSize
+	// and returns once all of them have run.  A loop started from inside a body runs
+	// serially on that thread; loops started from other threads wait their turn.  If
+	// a body throws, the sub-ranges not yet started are skipped and the first
+	// exception is rethrown here once the others have finished.
+	void ParallelFor(int first, int last, int grainSize, const std::function<void(int, int)>& body);
+
+	// Shared pool with one thread per hardware thread.
+	static ThreadPool& Default();
+
+private:
+	struct Slice
+	{
+		std::mutex Lock;
+		int Begin = 0;
+		int End = 0;
+	};
+
+	void WorkerMain(int slot);
+	void RunSlices(int slot);
+	bool TakeRange(int slot, int& begin, int& end);
+
+	std::vector<std::thread> mWorkers;
+	std::unique_ptr<Slice[]> mSlices;
+
+	// Serializes loops from different threads.
+	std::mutex mLoopLock;
+
+	std::mutex mLock;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	uint64_t mGeneration = 0;
+	int mRunningWorkers = 0;
+	bool mQuit = false;
+
+	const std::function<void(int, int)>* mBody = nullptr;
+	int mGrainSize = 1;
+
+	// First exception thrown by a body of the current loop.
+	std::exception_ptr mException;
+	std::atomic<bool> mFailed{ false };
+};